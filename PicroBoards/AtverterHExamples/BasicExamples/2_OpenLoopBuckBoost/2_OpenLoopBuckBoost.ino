@@ -52,7 +52,7 @@ void controlUpdate(void)
   slowInterruptCounter++; // in this example, do some special stuff every 1 second (1000ms)
   if (slowInterruptCounter > 1000) {
     slowInterruptCounter = 0;
-    atverter.updateVCC(); // read on-board VCC voltage, update stored average (shouldn't change)
+    atverter.updateVCCAsync(); // measure on-board VCC in the background, update stored average (shouldn't change)
     atverter.updateTSensors(); // occasionally read thermistors and update temperature moving average
     atverter.checkThermalShutdown(); // checks average temperature and shut down gates if necessary
     // prints duty cycle, VCC, V1, V2, I1, I2, T1, T2 to the serial console of attached computer
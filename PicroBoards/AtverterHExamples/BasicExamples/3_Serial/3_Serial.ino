@@ -4,8 +4,8 @@
   A test program that shows how to set up the Atverter's serial communication, including
   UART and I2C. Standard commands include reading sensed or stored values such as terminal voltages,
   currents and FET temperatures, in addition to writing to and setting various software-defined limits.
-  This program also shows how to create your own command registers by registering a command interpretation
-  function as a callback listener.
+  This program also shows how to create your own command registers by listing each command name and its
+  handler function in a sorted command table stored in flash (PROGMEM).
 
   Works with the Arduino Serial Console (requires FTDI USB/TTL cable to a computer), Pi_UART_Shell.py
   (requires FTDI USB/TTL cable to a Raspberry Pi), and Pi_I2C_Shell.py (requires direct pin conection to
@@ -21,10 +21,22 @@ AtverterH atverter;
 long slowInterruptCounter = 0;
 char helloMessage[16] = "Hello World!";
 
+// serial command table, sorted by command name (in strcmp order) so that commands are found by binary search
+void readAuthor(const char* valueStr, int receiveProtocol);
+void readFileName(const char* valueStr, int receiveProtocol);
+void readHelloMessage(const char* valueStr, int receiveProtocol);
+void writeHelloMessage(const char* valueStr, int receiveProtocol);
+const CommandEntry COMMANDS[] PROGMEM = {
+  {"RAUT", readAuthor},
+  {"RFN", readFileName},
+  {"RHM", readHelloMessage},
+  {"WHM", writeHelloMessage}
+};
+
 void setup() {
   atverter.initializeSensors();
-  // add the command interpretation function below as a listener for serial commands
-  atverter.addCommandCallback(&interpretRXCommand);
+  // register the command table above so that its handler functions are called for matching serial commands
+  atverter.setCommandTable(COMMANDS, sizeof(COMMANDS)/sizeof(COMMANDS[0]));
   // initialize UART communication at 9600 bits per second
   atverter.startUART(); // can optionally specify baud rate with an argument
   // initialize I2C communciation and register receive and request callback functions
@@ -33,35 +45,23 @@ void setup() {
   ReceiveEventI2C receiveEvent = [] (int howMany) {atverter.receiveEventI2C(howMany);};
   RequestEventI2C requestEvent = [] () {atverter.requestEventI2C();};
   atverter.startI2C(8, receiveEvent, requestEvent); // first argument is the slave device address (max 127)
+  atverter.enableCommandQueue(); // run I2C commands from loop(), not inside the I2C interrupt
 }
 
 void loop() {
   atverter.readUART(); // if using UART, check every cycle if there are new characters in the UART buffer
+  atverter.processCommandQueue(); // run I2C commands queued by the I2C interrupt
 
   // everything below is just for standard sensor updating
   atverter.updateVISensors(); // read voltage and current sensors and update moving average
   slowInterruptCounter++; // in this example, do some special stuff every 1 second (1000ms)
   if (slowInterruptCounter > 5000) {
     slowInterruptCounter = 0;
-    atverter.updateVCC(); // read on-board VCC voltage, update stored average (shouldn't change)
+    atverter.updateVCCAsync(); // measure on-board VCC in the background, update stored average (shouldn't change)
     atverter.updateTSensors(); // occasionally read thermistors and update temperature moving average
   }
 }
 
-// command interpretation function specific to this program
-// compares the incoming command string with preset register names and calls the appropriate functions
-void interpretRXCommand(char* command, char* value, int receiveProtocol) {
-  if (strcmp(command, "RFN") == 0) {
-    readFileName(value, receiveProtocol);
-  } else if (strcmp(command, "RAUT") == 0) {
-    readAuthor(value, receiveProtocol);
-  } else if (strcmp(command, "RHM") == 0) {
-    readHelloMessage(value, receiveProtocol);
-  } else if (strcmp(command, "WHM") == 0) {
-    writeHelloMessage(value, receiveProtocol);
-  }
-}
-
 // sample function that responds to RFN (file name)
 void readFileName(const char* valueStr, int receiveProtocol) {
   sprintf(atverter.getTXBuffer(receiveProtocol), "WFN:%d%s", 3, "_Serial.ino");
@@ -96,9 +96,8 @@ void controlUpdate(void)
   // set duty cycle, depending on whether in classical feedback or gradient descent mode
   if(isClassicalFB) { // classical feedback voltage mode discrete compensation
     // calculate the compensator output based on past values and the numerator and demoninator
-    // duty cycle (0-100) = compensator output * 100% / 2^10
-    int duty = (atverter.calculateCompOut()*100)/1024;
-    atverter.setDutyCycle(duty);
+    // the compensator output is the duty cycle in Q10 (1024 = 100%)
+    atverter.setDutyCycleRaw(atverter.calculateCompOut());
   } else { // slow gradient descent mode, avoids light-load instability
     atverter.gradDescStep(vErr); // steps duty cycle up or down depending on the sign of the error
   }
@@ -107,7 +106,7 @@ void controlUpdate(void)
   slowInterruptCounter++;
   if (slowInterruptCounter > 3000) { // timer set such that each count is 1 ms
     slowInterruptCounter = 0;
-    atverter.updateVCC(); // read on-board VCC voltage, update stored average (shouldn't change)
+    atverter.updateVCCAsync(); // measure on-board VCC in the background, update stored average (shouldn't change)
     atverter.updateTSensors(); // occasionally read thermistors and update temperature moving average
     atverter.checkThermalShutdown(); // checks average temperature and shut down gates if necessary
 
@@ -206,6 +206,19 @@ denMult = [np.round(n).astype(int) for n in np.multiply(GcompD.den, multiplier)]
 print(*np.squeeze(numMult), sep=", ")
 print(*np.squeeze(denMult), sep=", ")
 # copy these coefficients directly into compNum and compDen in Atmega code
+# the multiplier must be a power of 2: it becomes compDen[0], which the compensator divides by with a shift
+
+# optionally, split higher-order compensators into second-order sections for atverter.setCompSections(), which keeps
+#  each coefficient small; tf2sos orders the pole closest to the unit circle (e.g. the integrator) last, and the
+#  last section output is the one the compensator clamps. Each section is normalized to a0 = 2^sosShift
+sosShift = 8
+sos = signal.tf2sos(np.squeeze(GcompD.num), np.squeeze(GcompD.den))
+print("const CompSection compSections [] = { // sosShift " + str(sosShift))
+for section in sos:
+    b = [int(np.round(c*2**sosShift)) for c in section[0:3]]
+    a = [int(np.round(c*2**sosShift)) for c in section[4:6]]
+    print("  {" + ", ".join(str(c) for c in b + a) + "},")
+print("};")
 
 
 
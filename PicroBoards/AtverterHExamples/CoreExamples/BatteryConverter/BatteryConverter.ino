@@ -113,7 +113,7 @@ int setIRefsCounter = 0;
 
 // global variables for coulomb counting (relevant for SOC calculations)
 long coulombCounter = 0; // coulomb counter (mA-sec)
-long ccntAccumulator = 0; // sub-second column counter accumulator for averaging (raw 0-1023)
+long ccntAccumulator = 0; // sub-second column counter accumulator for averaging (oversampled raw, see getWideRawI2())
 
 // discrete compensator coefficients for classical feedback in FORM mode, regulating the bus with CV1
 int compNum [] = {8, 0};
@@ -124,18 +124,46 @@ int outputMode = CC2; // CV1, CC1, CV2 or CC2 mode for book keeping
 int disconnectCondition = 0; // stored condition or reason for disconnecting
 long slowInterruptCounter = 0;
 
+// serial command table, sorted by command name (in strcmp order) so that commands are found by binary search
+void readCCNT(const char* valueStr, int receiveProtocol);
+void readFileName(const char* valueStr, int receiveProtocol);
+void readICHG(const char* valueStr, int receiveProtocol);
+void readIDIS(const char* valueStr, int receiveProtocol);
+void readMODE(const char* valueStr, int receiveProtocol);
+void readVBUS(const char* valueStr, int receiveProtocol);
+void writeICHG(const char* valueStr, int receiveProtocol);
+void writeIDIS(const char* valueStr, int receiveProtocol);
+void writeMODE(const char* valueStr, int receiveProtocol);
+void resetRCNT(const char* valueStr, int receiveProtocol);
+void writeVBUS(const char* valueStr, int receiveProtocol);
+const CommandEntry COMMANDS[] PROGMEM = {
+  {"RCCNT", readCCNT},
+  {"RFN", readFileName},
+  {"RICHG", readICHG},
+  {"RIDIS", readIDIS},
+  {"RMODE", readMODE},
+  {"RVBUS", readVBUS},
+  {"WICHG", writeICHG},
+  {"WIDIS", writeIDIS},
+  {"WMODE", writeMODE},
+  {"WRCNT", resetRCNT},
+  {"WVBUS", writeVBUS}
+};
+
 // the setup function runs once when you press reset or power the board
 void setup() {
   atverter.initialize();
+  atverter.startADCScan(); // from now on, sample every sensor from the ADC interrupt instead of loop()
   atverter.setComp(compNum, compDen, sizeof(compNum)/sizeof(compNum[0]), sizeof(compDen)/sizeof(compDen[0]));
   atverter.setRDroop(RDROOP);
 
   // set up UART and I2C command support
-  atverter.addCommandCallback(&interpretRXCommand);
+  atverter.setCommandTable(COMMANDS, sizeof(COMMANDS)/sizeof(COMMANDS[0]));
   atverter.startUART();
   ReceiveEventI2C receiveEvent = [] (int howMany) {atverter.receiveEventI2C(howMany);};
   RequestEventI2C requestEvent = [] () {atverter.requestEventI2C();};
   atverter.startI2C(2, receiveEvent, requestEvent); // first argument is the slave device address (max 127)
+  atverter.enableCommandQueue(); // run I2C commands from loop(), not inside the I2C interrupt
 
   // initialize voltage and current limits to default values above
   vBusRef = atverter.mV2raw(VBUSDEFAULT);
@@ -165,21 +193,25 @@ void setup() {
   // once all is said and done, set the proper duty cycle and start the PWM
   setupMode(batteryMode);
 
+  // dither the duty cycle between timer counts, for finer output voltage steps than the 160 counts per period
+  atverter.setDutyDither(true);
+
   // finally let the periodic control algorithm begin
   atverter.initializeInterruptTimer(1000, &controlUpdate); // control update every 1ms
 }
 
-// during loop(), analog read the voltage and current sensors and update their moving averages
-// for reference, loop() usually takes 112-148 microseconds
+// during loop(), handle communications. The ADC scan engine updates the sensor moving averages by itself
 void loop() {
-  atverter.updateVISensors(); // read voltage and current sensors and update moving average
+  atverter.processUART(); // parse complete UART lines outside of the control interrupt
+  atverter.processCommandQueue(); // run I2C commands queued by the I2C interrupt
 }
 
 // main controller update function, which runs on every timer interrupt
 void controlUpdate(void)
 {
   // periodic update functions for normal operation
-  atverter.readUART(); // if using UART, check every cycle if there are new characters in the UART buffer
+  atverter.receiveUART(); // if using UART, move new characters into the ring buffer (parsed in loop())
+  atverter.updateStream(); // if the master subscribed to a telemetry stream, latch a frame at a fixed rate
   atverter.checkCurrentShutdown(); // checks average current and shut down gates if necessary
   atverter.checkBootstrapRefresh(); // refresh bootstrap capacitors on a timer
 
@@ -190,10 +222,11 @@ void controlUpdate(void)
   int iBus = -1*(atverter.getRawI1()); // current into bus (positive)
 
   int error;
+  int vError, iError; // battery voltage and current limit errors of the grid following modes, see atverter.regulate()
   bool isCharging; // state variable for FORM mode to designate if the battery is currently charging
 
-  // update the sub-second raw coulomb counter accumulator
-  ccntAccumulator += iBat;
+  // update the sub-second raw coulomb counter accumulator, oversampled to resolve currents below one 10-bit LSB
+  ccntAccumulator -= atverter.getWideRawI2();
 
   // Battery Converter mode finite state machine, can switch Battery Converter Modes or Output Modes for appropriate error
 
@@ -219,20 +252,9 @@ void controlUpdate(void)
       setupMode(FORM);
       return;
     }
-    // Output Mode: FSM state change
-    if (outputMode == CC2 && vBat > vBatMax) { // switch to CV if battery voltage exceeds max battery voltage
-      outputMode = CV2;
-      atverter.resetComp(); // reset compensator past inputs and outputs switching between CV and CC
-    } else if (outputMode == CV2 && iBat > iBatChgRef) { // switch back to CC if charge current exceeds reference limit
-      outputMode = CC2;
-      atverter.resetComp();
-    }
-    // Output Mode: determine error based on output mode state
-    if (outputMode == CC2) { // constant current operation
-      error = iBatChgRef - iBat; // error is difference between reference charge current limit and battery current
-    } else { // constant voltage operation
-      error = vBatMax - vBat; // error is difference between max battery voltage and measured battery voltage
-    }
+    // Output Mode: CV2 and CC2 both cap the duty cycle, the lower one is applied (MINSELECT, see setupMode())
+    vError = vBatMax - vBat; // difference between max battery voltage and measured battery voltage
+    iError = iBatChgRef - iBat; // difference between reference charge current limit and battery current
   }
 // Battery Converter Mode: FOLLOWDISCHARGE: discharge the battery in grid following mode
   else if (batteryMode == FOLLOWDISCHARGE) {
@@ -251,21 +273,10 @@ void controlUpdate(void)
       setIRefsCounter = 0;
     } else
       setIRefsCounter++;
-    // Output Mode: FSM state change
-    if (outputMode == CC2 && vBat < vBatMin) { // switch to CV if battery voltage goes below min battery voltage
-      outputMode = CV2;
-      atverter.resetComp();
-    } else if (outputMode == CV2 && iBat < -iBatDisRef) { // switch back to CC if discharge current exceeds reference limit
-      outputMode = CC2;
-      atverter.resetComp();
-    }
-    // Output Mode: determine error based on output mode state
-    if (outputMode == CC2) {
-      error = (-iBatDisRef - iBat); // error is difference between reference discharge current limit and battery current
-        // e.g.: -iBatDisRef=-1, iBat=-0.6, error=-0.4, duty down, vBus up or vBat down, => |iBat| up
-    } else {
-      error = vBatMin - vBat; // error is difference between min battery voltage and measured battery voltage
-    }
+    // Output Mode: CV2 and CC2 both hold up the duty cycle, the higher one is applied (MAXSELECT, see setupMode())
+    vError = vBatMin - vBat; // difference between min battery voltage and measured battery voltage
+    iError = (-iBatDisRef - iBat); // difference between reference discharge current limit and battery current
+      // e.g.: -iBatDisRef=-1, iBat=-0.6, error=-0.4, duty down, vBus up or vBat down, => |iBat| up
   }
 // Battery Converter Mode: FORM: have the battery grid from, i.e. attempt to regulate a DC bus
   else if (batteryMode == FORM) {
@@ -401,37 +412,50 @@ void controlUpdate(void)
     }
   }
 
-  // update array of past compensator inputs
-  atverter.updateCompPast(error);
+  // feed the battery voltage forward while regulating the bus, so that battery sags under load move the duty cycle
+  //  at once. Every other mode goes without it: in grid following, the battery voltage is the output the duty cycle
+  //  moves, and feeding it forward would feed the output back into the duty cycle
+  if (batteryMode == FORM && outputMode == CV1) {
+    if (!atverter.isFeedForwardEnabled())
+      atverter.setFeedForward(1, vBusRef);
+  } else if (atverter.isFeedForwardEnabled()) {
+    atverter.disableFeedForward();
+  }
 
-  // We can use classical feedback for rapid bus regulation in FORM CV1 mode
+  // grid following: the battery voltage and current limits run together, and hand over to each other without a reset
   // Note: the compensation.py calculator only works for CR or CC loads, not for CV like batteries
   // TODO: update compensation.py for batteries, then we can use classical feedback in grid-following modes
-  bool isClassicalFB = false;
-  if (batteryMode == FORM && outputMode == CV1) { // only use for bus regulation in grid forming
-    // 0.5A-5A output: classical feedback voltage mode discrete compensation
-    // 0A-0.5A output: slow gradient descent mode
-    isClassicalFB = atverter.getRawI1() < -51 || atverter.getRawI1() > + 51;
-  }
+  if (batteryMode == FOLLOWCHARGE || batteryMode == FOLLOWDISCHARGE) {
+    outputMode = atverter.regulate(vError, iError, false); // slow gradient descent on the loop in control
+  } else {
+    // update array of past compensator inputs
+    atverter.updateCompPast(error);
+
+    // We can use classical feedback for rapid bus regulation in FORM CV1 mode
+    bool isClassicalFB = false;
+    if (batteryMode == FORM && outputMode == CV1) { // only use for bus regulation in grid forming
+      // 0.5A-5A output: classical feedback voltage mode discrete compensation
+      // 0A-0.5A output: slow gradient descent mode
+      isClassicalFB = atverter.getRawI1() < -51 || atverter.getRawI1() > + 51;
+    }
 
-  if(isClassicalFB) { // classical feedback voltage mode discrete compensation
-    // calculate the compensator output based on past values and the numerator and demoninator
-    int duty = (atverter.calculateCompOut()*100)/1024;
-    atverter.setDutyCycle(duty);
-  } else { // slow gradient descent mode, avoids light-load instability
-    atverter.gradDescStep(error); // steps duty cycle up or down depending on the sign of the error
+    if(isClassicalFB) { // classical feedback voltage mode discrete compensation
+      // calculate the compensator output based on past values and the numerator and demoninator
+      atverter.setDutyCycleRaw(atverter.calculateCompOut());
+    } else { // slow gradient descent mode, avoids light-load instability
+      atverter.gradDescStep(error); // steps duty cycle up or down depending on the sign of the error
+    }
   }
 
   // slow interrupt processes
   slowInterruptCounter++;
   if (slowInterruptCounter > 1000) { // timer set such that each count is 1 ms
     slowInterruptCounter = 0;
-    atverter.updateVCC(); // read on-board VCC voltage, update stored average (shouldn't change)
-    atverter.updateTSensors(); // occasionally read thermistors and update temperature moving average
+    atverter.updateVCCAsync(); // measure on-board VCC in the background, update stored average (shouldn't change)
     atverter.checkThermalShutdown(); // checks average temperature and shut down gates if necessary
     
     // average the sub-second raw coulomb count accumulator, and convert it to a mA-sec value to accumulate
-    coulombCounter += atverter.raw2mA(ccntAccumulator/1000);
+    coulombCounter += atverter.raw2mA(ccntAccumulator/1000, SENSOR_I_OVERSAMPLE_BITS);
     ccntAccumulator = 0;
 
     Serial.print("BMo:");
@@ -497,6 +521,7 @@ void setupMode(int desiredMode) {
         disconnectCondition = CLEAR;
         outputMode = CC2;
         iBatChgRef = 0;
+        atverter.setRegulation(2, MINSELECT); // the max battery voltage and the charge current limit cap the duty
         atverter.startPWM((long)100*vBat/vBus);
       } else {
         disconnect(STARTBUSLOW);
@@ -508,6 +533,7 @@ void setupMode(int desiredMode) {
         disconnectCondition = CLEAR;
         outputMode = CC2;
         iBatDisRef = 0;
+        atverter.setRegulation(2, MAXSELECT); // the min battery voltage and the discharge current limit hold up the duty
         atverter.startPWM((long)100*vBat/vBus);
       } else {
         disconnect(STARTBUSLOW);
@@ -581,33 +607,6 @@ void setIRefs(int vBat) {
 
 
 
-// serial command interpretation function
-void interpretRXCommand(char* command, char* value, int receiveProtocol) {
-  if (strcmp(command, "RFN") == 0) {
-    readFileName(value, receiveProtocol);
-  } else if (strcmp(command, "WMODE") == 0) {
-    writeMODE(value, receiveProtocol);
-  } else if (strcmp(command, "RMODE") == 0) {
-    readMODE(value, receiveProtocol);
-  } else if (strcmp(command, "WICHG") == 0) {
-    writeICHG(value, receiveProtocol);
-  } else if (strcmp(command, "RICHG") == 0) {
-    readICHG(value, receiveProtocol);
-  } else if (strcmp(command, "WIDIS") == 0) {
-    writeIDIS(value, receiveProtocol);
-  } else if (strcmp(command, "RIDIS") == 0) {
-    readIDIS(value, receiveProtocol);
-  } else if (strcmp(command, "WVBUS") == 0) {
-    writeVBUS(value, receiveProtocol);
-  } else if (strcmp(command, "RVBUS") == 0) {
-    readVBUS(value, receiveProtocol);
-  } else if (strcmp(command, "RCCNT") == 0) {
-    readCCNT(value, receiveProtocol);
-  } else if (strcmp(command, "WRCNT") == 0) {
-    resetRCNT(value, receiveProtocol);
-  }
-}
-
 // outputs the file name to serial
 void readFileName(const char* valueStr, int receiveProtocol) {
   sprintf(atverter.getTXBuffer(receiveProtocol), "WFN:%s", "BatteryConverter.ino");
@@ -689,6 +688,8 @@ void writeVBUS(const char* valueStr, int receiveProtocol) {
   if (temp > VBUSMAX-1000)
     temp = VBUSMAX-1000;
   vBusRef = atverter.mV2raw(temp);
+  if (atverter.isFeedForwardEnabled())
+    atverter.setFeedForward(1, vBusRef);
   sprintf(atverter.getTXBuffer(receiveProtocol), "WVBUS:=%d", temp);
   atverter.respondToMaster(receiveProtocol);
 }
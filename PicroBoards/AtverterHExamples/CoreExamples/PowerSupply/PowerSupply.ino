@@ -31,7 +31,8 @@
   collapsing the supply lower than the input voltage in boost mode is not yet supported.
 
   Finally, this example also adds support for adjusting the voltage limit (WVLIM, RVLIM), current limit (WILIM, RILIM),
-  and the droop resistance (WDRP, RDRP) via serial commands of the form <REG:VALUE>.
+  and the droop resistance (WDRP, RDRP) via serial commands of the form <REG:VALUE>. The compensator coefficients
+  can be uploaded as a whole with a chunked block transfer (block COMPBLOCK) in binary mode, and take effect at once.
 
   Created 8/29/23 by Daniel Gerber
 */
@@ -55,6 +56,11 @@ const int UVLODEFAULT = 22000; // default under-voltage lockout limit (disable c
 int compNum [] = {2, 0};
 int compDen [] = {8, -8};
 
+// staging copy of the compensator coefficients for chunked uploads: {compNum..., compDen...}
+//  chunks land here, and are only copied into compNum and compDen once the last chunk has arrived
+const uint8_t COMPBLOCK = 1; // transfer block ID of the compensator coefficients
+int compUpload [sizeof(compNum)/sizeof(compNum[0]) + sizeof(compDen)/sizeof(compDen[0])];
+
 int vLim = 0; // reference output voltage setpoint and voltage limit (raw 0-1023)
 int uvloRaw = 0; // undervoltage lockout limit (raw 0-1023)
 
@@ -63,44 +69,72 @@ int iRef = 0; // reference output current setpoint (raw -512 to 512). slews from
 unsigned int iSlewCountMax = 20; // slew rate at which iRef increases up to iLim (counter maximum)
 unsigned int iSlewCount = 0; // iRef slew counter
 
-int outputMode = CV2; // constant voltage (CV2) or constant current (CC2) mode finite state machine (on port 2)
+int outputMode = CV2; // constant voltage (CV2) or constant current (CC2) loop in control (on port 2), for book keeping
 long slowInterruptCounter = 0;
 
+// serial command table, sorted by command name (in strcmp order) so that commands are found by binary search
+void readFileName(const char* valueStr, int receiveProtocol);
+void readILIM(const char* valueStr, int receiveProtocol);
+void readVLIM(const char* valueStr, int receiveProtocol);
+void writeILIM(const char* valueStr, int receiveProtocol);
+void writeVLIM(const char* valueStr, int receiveProtocol);
+const CommandEntry COMMANDS[] PROGMEM = {
+  {"RFN", readFileName},
+  {"RILIM", readILIM},
+  {"RVLIM", readVLIM},
+  {"WILIM", writeILIM},
+  {"WVLIM", writeVLIM}
+};
+
 // the setup function runs once when you press reset or power the board
 void setup() {
   // run default initialization routine:
   // setupPinMode();shutdownGates();initializeSensors();setCurrentShutdown1/2(6500);setThermalShutdown(80);
   atverter.initialize();
+  atverter.startADCScan(); // from now on, sample every sensor from the ADC interrupt instead of loop()
+  // optionally, sample in the middle of the on-time, free of switching ripple (allows a shorter SENSOR_I_WINDOW_BS)
+  // at 100 kHz this needs a fast ADC clock, with about 2 bits less resolution; 62.5 kHz switching keeps 10 bits
+  // atverter.setADCScanSync(true, true);
 
   // set discrete compensator coefficients for use in classical feedback compensation
   atverter.setComp(compNum, compDen, sizeof(compNum)/sizeof(compNum[0]), sizeof(compDen)/sizeof(compDen[0]));
+  atverter.setRegulation(2, MINSELECT); // regulate port 2, the voltage and current limits both cap the duty cycle
 
   // set up UART and I2C command support
-  atverter.addCommandCallback(&interpretRXCommand);
+  atverter.setCommandTable(COMMANDS, sizeof(COMMANDS)/sizeof(COMMANDS[0]));
   atverter.startUART();
   ReceiveEventI2C receiveEvent = [] (int howMany) {atverter.receiveEventI2C(howMany);};
   RequestEventI2C requestEvent = [] () {atverter.requestEventI2C();};
   atverter.startI2C(3, receiveEvent, requestEvent); // first argument is the slave device address (max 127)
+  atverter.enableCommandQueue(); // run I2C commands from loop(), not inside the I2C interrupt
+  memcpy(compUpload, compNum, sizeof(compNum));
+  memcpy(&compUpload[sizeof(compNum)/sizeof(compNum[0])], compDen, sizeof(compDen));
+  atverter.addTransferBlock(COMPBLOCK, (uint8_t*)compUpload, sizeof(compUpload), true, applyCompUpload);
 
   // initialize voltage and current limits to default values above
   vLim = atverter.mV2raw(VLIMDEFAULT); // based on VCC; make sure Atverter is powered from side 1 input when this line runs
   iLim = atverter.mA2raw(ILIMDEFAULT);
   uvloRaw = atverter.mV2raw(UVLODEFAULT);
+  atverter.setFeedForward(2, vLim); // step the duty cycle with input voltage steps, the compensator trims the rest
+
+  // optionally, switch in bursts below 100 mA output current, keeping the output 100-300 mV below the voltage limit
+  // atverter.setBurstMode(2, 100, VLIMDEFAULT - 300, VLIMDEFAULT - 100);
 
   startDutyPWM();
   atverter.initializeInterruptTimer(1000, &controlUpdate); // control update every 1ms
 }
 
-// during loop(), analog read the voltage and current sensors and update their moving averages
-// for reference, loop() usually takes 112-148 microseconds
+// during loop(), handle communications. The ADC scan engine updates the sensor moving averages by itself
 void loop() {
-  atverter.updateVISensors(); // read voltage and current sensors and update moving average
+  atverter.processUART(); // parse complete UART lines outside of the control interrupt
+  atverter.processCommandQueue(); // run I2C commands queued by the I2C interrupt
 }
 
 // main controller update function, which runs on every timer interrupt
 void controlUpdate(void)
 {
-  atverter.readUART(); // if using UART, check every cycle if there are new characters in the UART buffer
+  atverter.receiveUART(); // if using UART, move new characters into the ring buffer (parsed in loop())
+  atverter.updateStream(); // if the master subscribed to a telemetry stream, latch a frame at a fixed rate
   atverter.checkCurrentShutdown(); // checks average current and shut down gates if necessary
   atverter.checkBootstrapRefresh(); // refresh bootstrap capacitors on a timer
 
@@ -126,46 +160,29 @@ void controlUpdate(void)
     iSlewCount = 0;
   }
 
-  // check conditions to switch between constant voltage and constant current states
-  if (outputMode == CV2 && iOut > iRef) { // switch to constant current if output current exceeds current limit
-    outputMode = CC2;
-    atverter.resetComp(); // reset compensator past inputs and outputs since not relevant to CC mode
-  } else if (outputMode == CC2 && vOut > vLim) { // switch to constant voltage if output voltage exceeds voltage limit
-    outputMode = CV2;
-    atverter.resetComp(); // reset compensator past inputs and outputs since not relevant to CV mode
-  }
-
-  int error;
-  if (outputMode == CC2) { // constant current operation
-    error = iRef - iOut; // error is difference between current limit and output current
-  } else { // constant voltage operation
-    // if using droop control, we droop the reference voltage by a term proportional to the output current.
-    // error = (reference voltage - droop voltage) - output voltage
-    error = (vLim - atverter.getVDroopRaw(iOut)) - vOut;
-  }
-
-  // update array of past compensator inputs
-  atverter.updateCompPast(error); // argument is the compensator input right now
+  // constant voltage and constant current run together, and the lower duty cycle of the two is applied (MINSELECT),
+  // so the current limit takes over from the voltage loop, and hands back, without resetting either compensator
+  // if using droop control, we droop the reference voltage by a term proportional to the output current.
+  // voltage error = (reference voltage - droop voltage) - output voltage
+  int vError = (vLim - atverter.getVDroopRaw(iOut)) - vOut;
+  int iError = iRef - iOut; // current error is difference between current limit and output current
 
   // 0.5A-5A output: classical feedback voltage mode discrete compensation
   // 0A-0.5A output: slow gradient descent mode
   bool isClassicalFB = atverter.getRawI2() < -51 || atverter.getRawI2() > 51;
-  // bool isClassicalFB = atverter.getRawI2() < -51 || atverter.getRawI2() > 51;
-
-  if(isClassicalFB) { // classical feedback voltage mode discrete compensation
-    // calculate the compensator output based on past values and the numerator and demoninator
-    // duty cycle (0-100) = compensator output * 100% / 2^10
-    int duty = (atverter.calculateCompOut()*100)/1024;
-    atverter.setDutyCycle(duty);
-  } else { // slow gradient descent mode, avoids light-load instability
-    atverter.gradDescStep(error); // steps duty cycle up or down depending on the sign of the error
-  }
+
+  // the compensator output is the duty cycle in Q10 (1024 = 100%)
+  outputMode = atverter.regulate(vError, iError, isClassicalFB); // CV2 or CC2, whichever loop is in control
+
+  // optionally, ride through input sags (and swells) that cross the output voltage, by switching between buck,
+  // buck-boost and boost on the fly with the duty cycle re-seeded (see MultiModeSupply). DCDCMODE is then only the
+  // starting mode, and the first mode change seeds the duty cycle for vLim
+  // atverter.updateDCDCMode(vLim);
 
   slowInterruptCounter++;
   if (slowInterruptCounter > 3000) { // timer set such that each count is 1 ms
     slowInterruptCounter = 0;
-    atverter.updateVCC(); // read on-board VCC voltage, update stored average (shouldn't change)
-    atverter.updateTSensors(); // occasionally read thermistors and update temperature moving average
+    atverter.updateVCCAsync(); // measure on-board VCC in the background, update stored average (shouldn't change)
     atverter.checkThermalShutdown(); // checks average temperature and shut down gates if necessary
   }
 }
@@ -190,19 +207,15 @@ void startDutyPWM() {
   atverter.startPWM(startDuty); // once all is said and done, start the PWM
 }
 
-// serial command interpretation function
-void interpretRXCommand(char* command, char* value, int receiveProtocol) {
-  if (strcmp(command, "RFN") == 0) {
-    readFileName(value, receiveProtocol);
-  } else if (strcmp(command, "WVLIM") == 0) {
-    writeVLIM(value, receiveProtocol);
-  } else if (strcmp(command, "RVLIM") == 0) {
-    readVLIM(value, receiveProtocol);
-  } else if (strcmp(command, "WILIM") == 0) {
-    writeILIM(value, receiveProtocol);
-  } else if (strcmp(command, "RILIM") == 0) {
-    readILIM(value, receiveProtocol);
-  }
+// applies a complete compensator coefficient upload, called after the last chunk of block COMPBLOCK
+void applyCompUpload(uint8_t block, int length) {
+  uint8_t oldSREG = SREG; // may be called from the I2C interrupt, so restore rather than enable interrupts
+  cli(); // the control interrupt must never run with half of the new coefficients
+  memcpy(compNum, compUpload, sizeof(compNum));
+  memcpy(compDen, &compUpload[sizeof(compNum)/sizeof(compNum[0])], sizeof(compDen));
+  atverter.setComp(compNum, compDen, sizeof(compNum)/sizeof(compNum[0]), sizeof(compDen)/sizeof(compDen[0]));
+  atverter.resetComp();
+  SREG = oldSREG;
 }
 
 // outputs the file name to serial
@@ -215,6 +228,7 @@ void readFileName(const char* valueStr, int receiveProtocol) {
 void writeVLIM(const char* valueStr, int receiveProtocol) {
   unsigned int temp = atoi(valueStr);
   vLim = atverter.mV2raw(temp);
+  atverter.setFeedForward(2, vLim);
   sprintf(atverter.getTXBuffer(receiveProtocol), "WVLIM:=%d", temp);
   atverter.respondToMaster(receiveProtocol);
 }
@@ -12,9 +12,9 @@
   DC Bus: Electronic load attached to terminal 2, is set to CR mode between 15 and 100 ohms
 
   Grid Following Mode (MPPT):
-  During grid following operation, the solar controller uses a gradient-based perturb and observe method to find the
-  maximum power point in realtime for any level of irradiation or shading. Users can curtail the solar power by
-  specifying a maximum power limit. The controller will also curtail the power if the bus voltage exceeds a specified
+  During grid following operation, the solar controller uses a perturb and observe method with an adaptive step size
+  (MaxPowerTracker.h, optionally incremental conductance) to find the maximum power point in realtime for any level of
+  irradiation or shading. Users can curtail the solar power by specifying a maximum power limit. The controller will also curtail the power if the bus voltage exceeds a specified
   maximum. This mode requires something else such as a battery or power supply to form and maintain the DC bus.
 
   Grid Forming Mode:
@@ -35,7 +35,9 @@
 */
 
 #include <AtverterH.h>
+#include <MaxPowerTracker.h>
 AtverterH atverter;
+MaxPowerTracker mppt; // steps the duty cycle toward the maximum power point in FOLLOW mode
 
 enum SolarModes
 {   FOLLOW = 0, // perform MPPT grid following mode, with the option to curtail power
@@ -72,19 +74,14 @@ unsigned int vBusSwitch = 0; // max bus voltage in FORM mode before automaticall
 unsigned int vBusLim = 0; // reference terminal 1 voltage setpoint (raw 0-1023); nominal bus voltage
 
 // FOLLOW variables
-const int PAVGLENGTH = 128; // averaging length for power measurements
-int avgCounter = 0; // counts up to PAVGLENGTH, and then computes power average
-long powerAcc = 0; // accumulator for measured power values before they are averaged
-long powerVal [] = {0, 0, 0}; // several past power averages for comparison
-long pRef = 0; // reference power setting (always less than pLim) for controls and error
-int stepDirection = 1; // 1 or -1 for direction of stepping voltage
-bool skip = false; // used to skip power calculation every other cycle to allow proper settling
+long pRef = 0; // reference power setting (always less than pLim), the tracker curtails the power to it
 bool vBusInRange = false; // latches to true once the bus voltage is in the appropriate FOLLOW range
 
 // FORM and DISCONNECT variables
 int vSolarMin = 0; // in FORM mode, if solar panel voltage drops below vSolarMin, then disconnect
 unsigned int disconnectTimer = 0; // remain disconnected for this many milliseconds
 unsigned int switchTimer = 0; // count how long bus voltage must be above vBusSwitch until switch to FOLLOW
+int avgCounter = 0; // slows down the duty cycle steps while the bus voltage is low (e.g. startup)
 
 // discrete compensator coefficients for classical feedback
 int compNum [] = {8, 0};
@@ -92,18 +89,34 @@ int compDen [] = {8, -8};
 
 long slowInterruptCounter = 0;
 
+// serial command table, sorted by command name (in strcmp order) so that commands are found by binary search
+void readFileName(const char* valueStr, int receiveProtocol);
+void readMODE(const char* valueStr, int receiveProtocol);
+void readPLIM(const char* valueStr, int receiveProtocol);
+void writeMODE(const char* valueStr, int receiveProtocol);
+void writePLIM(const char* valueStr, int receiveProtocol);
+const CommandEntry COMMANDS[] PROGMEM = {
+  {"RFN", readFileName},
+  {"RMODE", readMODE},
+  {"RPLIM", readPLIM},
+  {"WMODE", writeMODE},
+  {"WPLIM", writePLIM}
+};
+
 // the setup function runs once when you press reset or power the board
 void setup() {
   atverter.initialize();
+  atverter.startADCScan(); // from now on, sample every sensor from the ADC interrupt instead of loop()
   atverter.setComp(compNum, compDen, sizeof(compNum)/sizeof(compNum[0]), sizeof(compDen)/sizeof(compDen[0]));
   atverter.setRDroop(RDROOP);
 
   // set up UART and I2C command support
-  atverter.addCommandCallback(&interpretRXCommand);
+  atverter.setCommandTable(COMMANDS, sizeof(COMMANDS)/sizeof(COMMANDS[0]));
   atverter.startUART();
   ReceiveEventI2C receiveEvent = [] (int howMany) {atverter.receiveEventI2C(howMany);};
   RequestEventI2C requestEvent = [] () {atverter.requestEventI2C();};
   atverter.startI2C(1, receiveEvent, requestEvent); // first argument is the slave device address (max 127)
+  atverter.enableCommandQueue(); // run I2C commands from loop(), not inside the I2C interrupt
 
   // initialize raw (0-1023) voltage limits to default mV values above
   vBusLim = atverter.mV2raw(VBUSDEFAULT);
@@ -116,6 +129,17 @@ void setup() {
   pLim = (long) atverter.mV2raw(PLIMDEFAULT) * atverter.mA2raw(1000);
   pRef = pLim;
 
+  // maximum power point tracking: a decision every 64 ms (settle 32 ms, then average 32 samples), 0.2% to 6% steps
+  mppt.setDutyLimits(DUTYRAWMIN, DUTYRAWMAX);
+  mppt.setTiming(32, 5);
+  mppt.setStepLimits(2, 64);
+  mppt.setPowerReference(pRef);
+  // optionally, use incremental conductance, which holds the duty cycle still at the maximum power point
+  // mppt.setMode(MPPTINCCOND);
+  // optionally, sweep the whole duty cycle range every ~10 minutes (9375 decisions), in ~3% steps, to escape a local
+  // maximum under partial shading
+  // mppt.setSweep(9375, 32);
+
   // hold side 1 for boost mode with port 1 input and port 2 output
   atverter.applyHoldHigh1();
 
@@ -129,17 +153,18 @@ void setup() {
   atverter.initializeInterruptTimer(1000, &controlUpdate); // control update every 1ms
 }
 
-// during loop(), analog read the voltage and current sensors and update their moving averages
-// for reference, loop() usually takes 112-148 microseconds
+// during loop(), handle communications. The ADC scan engine updates the sensor moving averages by itself
 void loop() {
-  atverter.updateVISensors(); // read voltage and current sensors and update moving average
+  atverter.processUART(); // parse complete UART lines outside of the control interrupt
+  atverter.processCommandQueue(); // run I2C commands queued by the I2C interrupt
 }
 
 // main controller update function, which runs on every timer interrupt
 void controlUpdate(void)
 {
   // periodic update functions for normal operation
-  atverter.readUART(); // if using UART, check every cycle if there are new characters in the UART buffer
+  atverter.receiveUART(); // if using UART, move new characters into the ring buffer (parsed in loop())
+  atverter.updateStream(); // if the master subscribed to a telemetry stream, latch a frame at a fixed rate
   atverter.checkCurrentShutdown(); // checks average current and shut down gates if necessary
   atverter.checkBootstrapRefresh(); // refresh bootstrap capacitors on a timer
 
@@ -164,55 +189,26 @@ void controlUpdate(void)
         pRef = pRef - 10;
       if (pRef < 10) // make sure pRef doesn't go negative
         pRef = 10;
-      error = 1; // increase duty cycle so as to decrease solar voltage
-      atverter.triggerGradDescStep(); // make sure to immediately curtail
+      mppt.setPowerReference(pRef); // the tracker keeps curtailing toward higher solar voltage once back in range
+      // step the duty cycle up at once so as to decrease solar voltage, without waiting for a tracker decision
+      //  (an error of 1 averages to 0 in the gradient descent, so it would never move the duty cycle)
+      atverter.setDutyCycleRaw(min(atverter.getDutyCycleRaw() + DUTYRAWMIN, DUTYRAWMAX));
     } else if (vBus < vBusSwitch && vBusInRange) { // switch to FORM mode if bus voltage falls below minimum threshold
       solarMode = FORM;
       vBusInRange = false;
       return;
     } else if (iSolar < 0) { // make sure no current going into solar panel, if so perform corrective action
       error = 1;
-    } else { // MPPT algorithm (gradient descent)
+    } else { // MPPT algorithm
       vBusInRange = true; // latch vBusInRange to indicate bus voltage has reached appropriate range
-      if (avgCounter >= PAVGLENGTH) {
-        // first latch in the average power and reset the averaging counter
-        powerVal[0] = powerAcc/PAVGLENGTH;
-        powerAcc = 0;
-        avgCounter = 0;
-        // check average power and step duty cycle appropriately (do it every other averaging cycle)
-        if (!skip) { // doing every other cycle allows power measurement to settle, improving accurately
-          // determine the step direction based on previous power and reference power
-          if (powerVal[0] < pRef) { // we are below the reference power: try to increase power
-            if (powerVal[0] < powerVal[2]) { // measured power is less than previous measured power
-              stepDirection = -1*stepDirection; // reverse step direction
-            } // and if measured power > previous measured power, continue stepping in same direction
-          } else { // (powerVal[0] > pRef) we are above the reference power: decrease the power
-            if (powerVal[0] > powerVal[2]) { // measured power is greater than previous measured power
-              stepDirection = -1*stepDirection; // reverse step direction
-            } // and if measured power > previous measured power, continue stepping in same direction
-          }
-          // set error
-          if (atverter.getDutyCycle() >= 99)
-            error = -1; // bounce back duty cycle to avoid getting stuck at high end
-          else if (atverter.getDutyCycle() <= 1)
-            error = 1; // bounce back duty cycle to avoid getting stuck at low end
-          else
-            error = stepDirection; // gradient descent algorithm below only cares about the sign of the error
-          atverter.triggerGradDescStep(); // immediately step duty cycle
-        }
-        // update previous power values
-        powerVal[2] = powerVal[1];
-        powerVal[1] = powerVal[0];
-        skip = !skip;
-      } else { // averaging is not yet complete, update counter and accumulator
-        avgCounter++;
-        powerAcc += pSolar;
-      }
+      // the tracker averages the solar power, and steps the duty cycle at each decision (every 64 ms)
+      atverter.setDutyCycleRaw(mppt.update(vSolar, iSolar, atverter.getDutyCycleRaw()));
       // slowly bring reference power back toward power limit if it had previously been curtailed
       if (pRef < pLim - 10 && vBus < vBusMax)
         pRef = pRef + 10;
       if (pRef > pLim)
         pRef = pLim;
+      mppt.setPowerReference(pRef);
     }
   }
   // Solar Mode: FORM: adjust duty cycle so as to maintain bus voltage
@@ -275,8 +271,7 @@ void controlUpdate(void)
 
   if(isClassicalFB) { // classical feedback voltage mode discrete compensation
     // calculate the compensator output based on past values and the numerator and demoninator
-    int duty = (atverter.calculateCompOut()*100)/1024;
-    atverter.setDutyCycle(duty);
+    atverter.setDutyCycleRaw(atverter.calculateCompOut());
   } else { // slow gradient descent mode
     atverter.gradDescStep(error); // steps duty cycle up or down depending on the sign of the error
   }
@@ -285,8 +280,7 @@ void controlUpdate(void)
   slowInterruptCounter++;
   if (slowInterruptCounter > 1000) { // if each count is 1 ms, triggers every 1 second
     slowInterruptCounter = 0;
-    atverter.updateVCC(); // read on-board VCC voltage, update stored average (shouldn't change)
-    atverter.updateTSensors(); // occasionally read thermistors and update temperature moving average
+    atverter.updateVCCAsync(); // measure on-board VCC in the background, update stored average (shouldn't change)
     atverter.checkThermalShutdown(); // checks average temperature and shut down gates if necessary
 
   // long pSolar1 = 1024*1024; // power (raw) out of solar panel (positive)
@@ -314,17 +308,15 @@ void controlUpdate(void)
     Serial.print(", psol:");
     Serial.print(pSolar);
     Serial.print(", ");
-    Serial.print(powerVal[1]);
-    Serial.print(", ");
-    Serial.print(powerVal[2]);
+    Serial.print(mppt.getPower());
     Serial.print(", pRef:");
     Serial.print(pRef);
     Serial.print(", ");
     Serial.print(pLim);
-    Serial.print(", diff:");
-    Serial.print(stepDirection);
+    Serial.print(", step:");
+    Serial.print(mppt.getStep());
     Serial.print(", ");
-    Serial.println(powerVal[1] - powerVal[2]);
+    Serial.println(mppt.isSweeping());
   }
 }
 
@@ -347,24 +339,10 @@ void connectFollow() {
   atverter.setDutyCycle((long)100*VSOLARMIN/VBUSMAX);
   if(atverter.isGateShutdown())
     atverter.enableGateDrivers();
+  mppt.reset(); // restart tracking from the new duty cycle
   solarMode = FOLLOW;
 }
 
-// serial command interpretation function
-void interpretRXCommand(char* command, char* value, int receiveProtocol) {
-  if (strcmp(command, "RFN") == 0) {
-    readFileName(value, receiveProtocol);
-  } else if (strcmp(command, "WMODE") == 0) {
-    writeMODE(value, receiveProtocol);
-  } else if (strcmp(command, "RMODE") == 0) {
-    readMODE(value, receiveProtocol);
-  } else if (strcmp(command, "WPLIM") == 0) {
-    writePLIM(value, receiveProtocol);
-  } else if (strcmp(command, "RPLIM") == 0) {
-    readPLIM(value, receiveProtocol);
-  }
-}
-
 // outputs the file name to serial
 void readFileName(const char* valueStr, int receiveProtocol) {
   sprintf(atverter.getTXBuffer(receiveProtocol), "WFN:%s", "SolarConverter.ino");
@@ -404,6 +382,7 @@ void writePLIM(const char* valueStr, int receiveProtocol) {
   pLim = (long) atverter.mV2raw(temp) * atverter.mA2raw(1000);
   if (pRef > pLim)
     pRef = pLim;
+  mppt.setPowerReference(pRef);
   sprintf(atverter.getTXBuffer(receiveProtocol), "WPLIM:=%d", temp);
   atverter.respondToMaster(receiveProtocol);
 }
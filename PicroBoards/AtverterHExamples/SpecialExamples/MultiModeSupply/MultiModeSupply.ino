@@ -13,7 +13,8 @@
   buck-boost, or buck mode when the output voltage is below, in proximity, or above the input voltage, respectively.
   The reason for doing this is that buck and boost modes are nearly twice as efficient as buck-boost mode. We also
   constrain the duty cycle somewhat to assist start-up in boost and buck-boost modes and prevent input supply collapse
-  under output load.
+  under output load. The mode switching itself is done by the AtverterH DC-DC topology manager (setDCDCMode(),
+  updateDCDCMode()), with the duty limits of each mode set by setDCDCDutyLimits().
 
   Note that realtime multi-mode operation poses a very difficult controls problem, as detailed in:
   https://www.ti.com/lit/an/slyt765/slyt765.pdf
@@ -28,20 +29,9 @@
 
 #include <AtverterH.h>
 
-enum DCDCMode // multimode support is done through a finite state machine
-{   BUCK = 0,
-    BOOST, 
-    BUCKBOOST,
-    NUM_DCDCMODES
-};
-int dcdcMode = BOOST;
-
-AtverterH atverter;
+AtverterH atverter; // multimode support is done by the AtverterH DC-DC topology manager (updateDCDCMode())
 long slowInterruptCounter = 0;
 
-int compIn [] = {0, 0, 0}; // must be equal or longer than compNum
-int compOut [] = {0, 0, 0}; // must be equal or longer than compDen
-
 // discrete compensator coefficients
 // these values seem to work well enough for buck, boost, and buck-boost
 // but you may want to have different compensators for each mode, depending on operating voltages
@@ -49,10 +39,6 @@ int compOut [] = {0, 0, 0}; // must be equal or longer than compDen
 int compNum [] = {8, 0};
 int compDen [] = {8, -8};
 
-int gradDescCount = 0;
-
-const int INSIZE = sizeof(compIn) / sizeof(compIn[0]);
-const int OUTSIZE = sizeof(compOut) / sizeof(compOut[0]);
 const int NUMSIZE = sizeof(compNum) / sizeof(compNum[0]);
 const int DENSIZE = sizeof(compDen) / sizeof(compDen[0]);
 
@@ -61,15 +47,18 @@ int iLimR = 0;
 
 int VREF = 0; // reference output voltage setpoint
 unsigned int RDroop32 = 0; // 32 times the raw droop resistance, used this way to avoid a division
-// vin/vref thresholds for transitioning between DCDC Modes, multiplied by 10
-// {buck-boost to boost, boost to buck-boost, buck to buck-boost, buck-boost to buck}
-// thresholds are designed to give some hysteresis between transitions
-int threshold10 [] = {8, 9, 11, 12};
 
 // the setup function runs once when you press reset or power the board
 void setup() {
   atverter.setupPinMode(); // set pins to input or output
   atverter.initializeSensors(); // set filtered sensor values to initial reading
+  atverter.startADCScan(); // from now on, sample every sensor from the ADC interrupt instead of loop()
+  atverter.setComp(compNum, compDen, NUMSIZE, DENSIZE); // set discrete compensator coefficients
+  atverter.setGradDescCountMax(0, 4); // at light load, step the duty cycle every 5 ms
+  // vin/vref thresholds (%) for transitioning between DCDC Modes
+  // {buck-boost to boost, boost to buck-boost, buck to buck-boost, buck-boost to buck}
+  // thresholds are designed to give some hysteresis between transitions
+  atverter.setDCDCThresholds(80, 90, 110, 120);
   atverter.setCurrentShutdown(6000); // set gate shutdown at 6A peak current 
   atverter.setThermalShutdown(60); // set gate shutdown at 60°C temperature
   atverter.initializeInterruptTimer(1000, &controlUpdate); // control update every 1ms
@@ -83,13 +72,16 @@ void setup() {
   atverter.startPWM();
 }
 
-void loop() { } // we don't use loop() because it does not loop at a fixed period
+// we don't use loop() for control because it does not loop at a fixed period
+void loop() {
+  atverter.processUART(); // parse complete UART lines outside of the control interrupt
+}
 
 // main controller update function, which runs on every timer interrupt
 void controlUpdate(void)
 {
-  atverter.readUART(); // if using UART, check every cycle if there are new characters in the UART buffer
-  atverter.updateVISensors(); // read voltage and current sensors and update moving average
+  atverter.receiveUART(); // if using UART, move new characters into the ring buffer (parsed in loop())
+  atverter.updateStream(); // if the master subscribed to a telemetry stream, latch a frame at a fixed rate
   atverter.checkCurrentShutdown(); // checks average current and shut down gates if necessary
   atverter.checkBootstrapRefresh(); // refresh bootstrap capacitors on a timer
 
@@ -111,142 +103,42 @@ void controlUpdate(void)
   // error = drooped reference - output voltage
   int error = droopVREF - vOut;
 
-  // update array of past compensator inputs
-  for (int n = INSIZE - 1; n > 0; n--) {
-    compIn[n] = compIn[n-1];
-  }
-  compIn[0] = error;
-  // update array of past compensator outputs
-  for (int n = OUTSIZE - 1; n > 0; n--) {
-    compOut[n] = compOut[n-1];
-  }
+  atverter.updateCompPast(error); // argument is the compensator input right now
 
   // 0.5A-5A output: classical feedback voltage mode discrete compensation
   // 0A-0.5A output: slow gradient descent mode
   bool isClassicalFB = atverter.getRawI2() < 512 - 51 || atverter.getRawI2() > 512 + 51;
 
   if(isClassicalFB) { // classical feedback voltage mode discrete compensation
-    // accumulate compensator weighted input terms
-    long compAcc = 0;
-    for (int n = 0; n < NUMSIZE; n++) {
-      compAcc = compAcc + compIn[n]*compNum[n];
-    }
-    // accumulate compensator weighted past output terms
-    for (int n = 1; n < DENSIZE; n++) {
-      compAcc = compAcc - compOut[n]*compDen[n];
-    }
-    compAcc = compAcc/compDen[0];
-    compOut[0] = compAcc;
-    // duty cycle (0-100) = compensator output * 100% / 2^10
-    int duty = (compAcc*100)/1024;
-    duty = constrainDuty(duty);
-    atverter.setDutyCycle(duty);
+    // the compensator output is the duty cycle in Q10, clamped to the duty limits of the DC-DC mode
+    atverter.setDutyCycleRaw(atverter.calculateCompOut());
   } else { // slow gradient descent mode, avoids light-load instability
-    gradDescCount++; // use a counter to control the rate of gradient descent
-    if (gradDescCount > 4) {
-      long duty = atverter.getDutyCycle();
-      duty = constrainDuty(duty);
-      compOut[0] = duty*1024/100;
-      if (error > 0) { // ascend or descend by 1% duty cycle depending on error
-        atverter.setDutyCycle(duty + 1);
-      } else {
-        atverter.setDutyCycle(duty - 1);
-      }
-      gradDescCount = 0;
-    }
+    atverter.gradDescStep(error); // steps within the mode duty limits, and tracks the compensator for the way back
   }
 
-  // dc-dc mode finite state machine (switch between buck, boost, and buck-boost)
-  int vIn = atverter.getRawV1();
-  int vIn10 = 10*vIn; // multiply by 10 before comparing so as to avoid floating point calcs
-  switch(dcdcMode) {
-    case BOOST:
-      if (vIn10 > threshold10[1]*VREF)
-        changeDCDCMode(BUCKBOOST, vIn, VREF);
-      break;
-    case BUCKBOOST:
-      if (vIn10 > threshold10[3]*VREF)
-        changeDCDCMode(BUCK, vIn, VREF);
-      else if (vIn10 < threshold10[0]*VREF)
-        changeDCDCMode(BOOST, vIn, VREF);
-      break;
-    case BUCK:
-      if (vIn10 < threshold10[2]*VREF)
-        changeDCDCMode(BUCKBOOST, vIn, VREF);
-      break;
-  }
+  // dc-dc mode finite state machine (switch between buck, boost, and buck-boost), with hysteresis between modes
+  // on a change, the duty cycle is re-seeded for the same output voltage, and the compensator reset to it
+  atverter.updateDCDCMode(VREF);
 
   slowInterruptCounter++;
   if (slowInterruptCounter > 3000) { // timer set such that each count is 1 ms
     slowInterruptCounter = 0;
-    atverter.updateVCC(); // read on-board VCC voltage, update stored average (shouldn't change)
-    atverter.updateTSensors(); // occasionally read thermistors and update temperature moving average
+    atverter.updateVCCAsync(); // measure on-board VCC in the background, update stored average (shouldn't change)
     atverter.checkThermalShutdown(); // checks average temperature and shut down gates if necessary
   }
 }
 
-// switches the FSM state, changes converter mode,
-// updates the duty cycle to an appropriate estimate, and resets compensator past values
-void changeDCDCMode(int mode, int vin, int vOut) {
-  int duty;
-  switch(mode) { // duty cycle on page 3 of: https://www.ti.com/lit/an/slyt765/slyt765.pdf
-    case BUCK:
-      dcdcMode = BUCK;
-      atverter.applyHoldHigh2(); // hold side 2 high for a buck converter with side 1 input
-      duty = 100*(long)vOut/vin;
-      atverter.setDutyCycle(duty);
-      break;
-    case BOOST:
-      dcdcMode = BOOST;
-      atverter.applyHoldHigh1(); // hold side 1 high for a boost converter with side 1 input
-      duty = 100*(long)(vOut - vin)/vOut;
-      atverter.setDutyCycle(duty);
-      break;
-    case BUCKBOOST:
-      dcdcMode = BUCKBOOST;
-      atverter.removeHold();
-      duty = 100*(long)vOut/(vin + vOut);
-      atverter.setDutyCycle(duty);
-      break;
-  }
-  // reset array of past compensator inputs
-  for (int n = 0; n < INSIZE; n++) {
-    compIn[n] = 0;
-  }
-  // reset array of past compensator outputs
-  for (int n = 0; n < OUTSIZE; n++) {
-    compOut[n] = duty*10; // duty*1024/100
-  }
-}
-
 // sets the reference output voltage and updates to the appropriate DCDC converter mode
 void setVREF(unsigned int vRefMv) {
   VREF = atverter.mV2raw(vRefMv);
   int vIn = atverter.getRawV1();
-  int vIn10 = 10*vIn;
-  if (vIn10 < threshold10[1]*VREF)
-    changeDCDCMode(BOOST, vIn, VREF);
-  else if (vIn10 < threshold10[2]*VREF)
-    changeDCDCMode(BUCKBOOST, vIn, VREF);
+  if (100L*vIn < 90L*VREF) // start in the middle of each hysteresis band
+    atverter.setDCDCMode(BOOST, VREF);
+  else if (100L*vIn < 110L*VREF)
+    atverter.setDCDCMode(BUCKBOOST, VREF);
   else
-    changeDCDCMode(BUCK, vIn, VREF);
-}
-
-// constrains the duty cycle to reasonable values, which can sometimes help prevent the input
-// supply from collapsing when it starts up 
-int constrainDuty(int duty) {
-  switch (dcdcMode) {
-    case BOOST:
-      duty = constrain(duty, 1, 90);
-      break;
-    case BUCKBOOST:
-      duty = constrain(duty, 10, 90);
-      break;
-    case BUCK:
-      duty = constrain(duty, 10, 99);
-      break;
-  }
-  return duty;
+    atverter.setDCDCMode(BUCK, VREF);
+  atverter.setFeedForward(2, VREF); // the mode duty cycle follows input voltage steps between mode changes
 }
 
 // serial command interpretation function
@@ -6,7 +6,56 @@
 
 #include "AtverterH.h"
 
+// ASCII command table, sorted by mnemonic for binary search
+// Atverter readable registers: RV1, RV2, RI1, RI2, RT1, RT2, RVCC, RDUT, RDRP, RBST, RALL (snapshot)
+// Atverter writable registers: WIS1, WIS2, WTSD, WDRP
+const RegisterCommandEntry ATVERTER_COMMANDS[] PROGMEM = {
+  {"RBST", BINREG_BST, REGCMD_READ}, // read whether the gates are idle between bursts
+  {"RDRP", BINREG_DRP, REGCMD_READ}, // read the stored droop resistance
+  {"RDUT", BINREG_DUT, REGCMD_READ}, // read the duty cycle
+  {"RI1", BINREG_I1, REGCMD_READ}, // read current at terminal 1
+  {"RI2", BINREG_I2, REGCMD_READ}, // read current at terminal 2
+  {"RT1", BINREG_T1, REGCMD_READ}, // read FET temperature of side 1
+  {"RT2", BINREG_T2, REGCMD_READ}, // read FET temperature of side 2
+  {"RV1", BINREG_V1, REGCMD_READ | REGCMD_UNSIGNED}, // read voltage at terminal 1
+  {"RV2", BINREG_V2, REGCMD_READ | REGCMD_UNSIGNED}, // read voltage at terminal 2
+  {"RVCC", BINREG_VCC, REGCMD_READ}, // read the ~5V VCC bus voltage
+  {"WDRP", BINREG_DRP, REGCMD_WRITE}, // set the stored droop resistance
+  {"WIS1", BINREG_IS1, REGCMD_WRITE}, // write the terminal 1 current shutdown limit (mA)
+  {"WIS2", BINREG_IS2, REGCMD_WRITE}, // write the terminal 2 current shutdown limit (mA)
+  {"WTSD", BINREG_TSD, REGCMD_WRITE} // write the thermal shutdown limit (°C)
+};
+
+// registers returned together by the bulk snapshot (BINREG_SNAPSHOT or "RALL"), in frame order
+const SnapshotEntry ATVERTER_SNAPSHOT[] PROGMEM = {
+  {BINREG_V1, REGCMD_UNSIGNED}, // terminal 1 voltage (mV)
+  {BINREG_V2, REGCMD_UNSIGNED}, // terminal 2 voltage (mV)
+  {BINREG_I1, 0}, // terminal 1 current (mA)
+  {BINREG_I2, 0}, // terminal 2 current (mA)
+  {BINREG_T1, 0}, // side 1 FET temperature (°C)
+  {BINREG_T2, 0}, // side 2 FET temperature (°C)
+  {BINREG_VCC, 0}, // VCC voltage (mV)
+  {BINREG_DUT, 0}, // duty cycle (%)
+  {BINREG_SDC, 0} // shutdown code
+};
+
+// channels sampled by the ADC scan engine (startADCScan), in scan order
+const ADCScanChannel ATVERTER_ADCSCAN[] PROGMEM = {
+  {V1_PIN, V1_INDEX, 0}, // terminal 1 voltage
+  {V2_PIN, V2_INDEX, 0}, // terminal 2 voltage
+  {I1_PIN, I1_INDEX, 512}, // terminal 1 current, centered on zero
+  {I2_PIN, I2_INDEX, 512}, // terminal 2 current, centered on zero
+  {T1_PIN, T1_INDEX, 0}, // thermistor 1
+  {T2_PIN, T2_INDEX, 0} // thermistor 2
+};
+
 AtverterH::AtverterH() {
+  _comp.setLimits(DUTYRAWMIN, DUTYRAWMAX);
+  _compCurrent.setLimits(DUTYRAWMIN, DUTYRAWMAX);
+  _boardCommands = ATVERTER_COMMANDS;
+  _boardCommandsLength = sizeof(ATVERTER_COMMANDS)/sizeof(ATVERTER_COMMANDS[0]);
+  _snapshotRegisters = ATVERTER_SNAPSHOT;
+  _snapshotLength = sizeof(ATVERTER_SNAPSHOT)/sizeof(ATVERTER_SNAPSHOT[0]);
 }
 
 // default initialization routine
@@ -55,7 +104,8 @@ void AtverterH::initializeSensors() {
 // example usage: atverterH.initializeInterruptTimer(1, &controlUpdate);
 void AtverterH::initializeInterruptTimer(long periodus, void (*interruptFunction)(void)) {
   Timer1.initialize(periodus); // arg: period in microseconds
-  Timer1.attachInterrupt(interruptFunction); // arg: interrupt function to call
+  setControlFunction(interruptFunction); // arg: interrupt function to call, after the pin pulse update
+  Timer1.attachInterrupt(&PicroBoard::controlInterrupt);
   _bootstrapCounterMax = 10000/periodus; // refresh bootstrap capacitors every 10ms
   // _bootstrapCounterMax = 1000/periodus; // refresh bootstrap capacitors every 1ms
   if (_bootstrapCounterMax < 1)
@@ -64,16 +114,16 @@ void AtverterH::initializeInterruptTimer(long periodus, void (*interruptFunction
 }
 
 // resets protection latch, enabling the gate drivers
+//  the reset pin is held high for holdProtectMicroseconds, then pulled low by the control timer tick
 void AtverterH::enableGateDrivers(int holdProtectMicroseconds) {
-  digitalWrite(PRORESET_PIN, HIGH);
-  delayMicroseconds(holdProtectMicroseconds);
-  digitalWrite(PRORESET_PIN, LOW);
+  releasePinPulse(GATESD_PIN); // end a shutdown still in progress, or the latch trips again
   _shutdownCode = 0; // reset shutdown code (i.e. set to "hardware" shutdown)
+  startPinPulse(PRORESET_PIN, HIGH, false, holdProtectMicroseconds);
 }
 
 // resets protection latch, enabling the gate drivers
 void AtverterH::enableGateDrivers() {
-  enableGateDrivers(3000);
+  enableGateDrivers(PROTECTRESETMICROS);
 }
 
 
@@ -84,18 +134,102 @@ void AtverterH::startPWM(int initialDuty) {
   enableGateDrivers();
 }
 
-// legacy; not needed with FastPWM library
+// sets up Timer2 once for the PWM pin (OC2B): fast PWM mode 7 with TOP = OCR2A, non-inverting
+//  afterwards a duty cycle update only writes OCR2B
 void AtverterH::initializePWMTimer() {
+  pinMode(PWM_PIN, OUTPUT);
+  uint8_t oldSREG = SREG;
+  cli();
+  TCCR2B = 0; // stop the timer while it is set up
+  TCCR2A = 1<<COM2B1 | 1<<WGM21 | 1<<WGM20; // clear OC2B on compare match, set at BOTTOM
+  OCR2A = _pwmPeriodCounts - 1; // TOP
+  OCR2B = counts2Compare(((unsigned long)_dutyCycleRaw*_pwmPeriodCounts + (1 << (DUTYQ - 1))) >> DUTYQ);
+  TCNT2 = 0;
+  TCCR2B = 1<<WGM22 | (_pwmPrescalerIndex + 1)<<CS20; // fast PWM mode 7, prescaler of setSwitchingFrequency()
+  _isPWMTimerInitialized = true;
+  SREG = oldSREG;
 }
 
 // Duty Cycle --------------------------------------------------------------
 
 // sets the duty cycle, integer argument (0-100)
 void AtverterH::setDutyCycle(int dutyCycle) {
-  _dutyCycle = dutyCycle;
-  _dutyCycle = constrain(_dutyCycle, 1, 99);
-  // FastPwmPin::enablePwmPin(pin number, frequency, duty cycle 0-100);
-  FastPwmPin::enablePwmPin(PWM_PIN, 100000L, _dutyCycle);
+  setDutyCycleRaw(((long)dutyCycle*2621 + 128) >> 8); // duty*1024/100, 2621/256 = 10.24
+}
+
+// sets the duty cycle in Q10 (0-1024), constrained to 1-99%
+//  after the first call this is a single write of the Timer2 compare register, which loads at the end of the period
+//  the duty cycle is rounded to the nearest timer count, until the next control tick dithers it
+void AtverterH::setDutyCycleRaw(long dutyCycleRaw) {
+  int dutyRaw = constrain(dutyCycleRaw, DUTYRAWMIN, DUTYRAWMAX);
+  uint8_t oldSREG = SREG;
+  cli(); // the control tick dither may read the duty cycle
+  _dutyCycleRaw = dutyRaw;
+  SREG = oldSREG;
+  if (!_isPWMTimerInitialized)
+    initializePWMTimer();
+  OCR2B = counts2Compare(((unsigned long)_dutyCycleRaw*_pwmPeriodCounts + (1 << (DUTYQ - 1))) >> DUTYQ);
+}
+
+// enables or disables duty cycle dithering across control ticks
+void AtverterH::setDutyDither(bool isEnabled) {
+  _isDutyDitherEnabled = isEnabled;
+  _dutyDitherError = 0;
+}
+
+// returns true if duty cycle dithering is enabled
+bool AtverterH::isDutyDitherEnabled() {
+  return _isDutyDitherEnabled;
+}
+
+// steps burst mode and the duty cycle dither, called at the end of every control tick
+//  the dither writes the duty cycle truncated to timer counts, after adding the truncation error left over from the
+//  last tick (first-order sigma-delta)
+void AtverterH::updateControlTick() {
+  if (_burstState != BURSTDISABLED)
+    updateBurst();
+  if (!_isDutyDitherEnabled || !_isPWMTimerInitialized)
+    return;
+  unsigned long countsQ = (unsigned long)_dutyCycleRaw*_pwmPeriodCounts + _dutyDitherError;
+  _dutyDitherError = countsQ & ((1 << DUTYQ) - 1);
+  OCR2B = counts2Compare(countsQ >> DUTYQ);
+}
+
+// sets the switching frequency (Hz), constrained to PWMFREQUENCYMIN-PWMFREQUENCYMAX
+//  picks the smallest Timer2 prescaler that fits a period in 8 bits, so that the duty cycle keeps the most resolution
+//  e.g. 100 kHz: 160 counts, no prescaler. 40 kHz: 50 counts, prescaler 8
+void AtverterH::setSwitchingFrequency(long frequency) {
+  frequency = constrain(frequency, PWMFREQUENCYMIN, PWMFREQUENCYMAX);
+  unsigned long counts = F_CPU/frequency;
+  uint8_t n = 0;
+  while (n < sizeof(PWMPRESCALERSHIFTS) - 1 && (counts >> PWMPRESCALERSHIFTS[n]) > 256)
+    n++;
+  counts = counts >> PWMPRESCALERSHIFTS[n];
+  uint8_t oldSREG = SREG;
+  cli(); // the control tick dither reads the period
+  _pwmPeriodCounts = counts;
+  _pwmPrescalerIndex = n;
+  _dutyDitherError = 0;
+  SREG = oldSREG;
+  if (_isPWMTimerInitialized)
+    initializePWMTimer(); // restarts the period with the new TOP, prescaler and compare value
+  if (_isADCScanSynchronized)
+    setADCScanSync(true, _isADCSyncFastClockAllowed); // match the ADC clock to the new period
+}
+
+// gets the switching frequency (Hz), rounded to the timer resolution
+long AtverterH::getSwitchingFrequency() {
+  return (F_CPU >> PWMPRESCALERSHIFTS[_pwmPrescalerIndex])/_pwmPeriodCounts;
+}
+
+// converts timer counts of high output to the OCR2B compare value, the output is high for OCR2B + 1 counts
+//  the counts are kept within the period, so that the switches always turn both on and off
+uint8_t AtverterH::counts2Compare(uint16_t counts) {
+  if (counts < 1)
+    counts = 1;
+  else if (counts > _pwmPeriodCounts - 1)
+    counts = _pwmPeriodCounts - 1;
+  return counts - 1;
 }
 
 // sets the duty cycle, float argument (0.0-1.0)
@@ -106,7 +240,12 @@ void AtverterH::setDutyCycleFloat(float dutyCycleFloat) {
 // get the duty cycle as a int percentage (0-100)
 // note that the duty cycle is referenced to side 1; side 2 duty = 100 - getDutyCycle()
 int AtverterH::getDutyCycle() {
-  return _dutyCycle;
+  return ((long)_dutyCycleRaw*100 + (1 << (DUTYQ - 1))) >> DUTYQ;
+}
+
+// get the duty cycle in Q10 (0-1024), referenced to side 1
+int AtverterH::getDutyCycleRaw() {
+  return _dutyCycleRaw;
 }
 
 // get the duty cycle as a float (0.0-1.0)
@@ -114,6 +253,169 @@ float AtverterH::getDutyCycleFloat() {
   return ((float)getDutyCycle()/100.0);
 }
 
+// Switching-Synchronized ADC Scan -------------------------------------------
+
+volatile uint16_t AtverterH::_adcSyncDelayCounts = 0;
+volatile uint8_t AtverterH::_adcSyncWaitMaxCounts = 0;
+
+// the Timer2 interrupts only run while a synchronized scan conversion is armed (OCIE2B and TOIE2 are otherwise clear)
+ISR(TIMER2_COMPB_vect) {
+  AtverterH::pwmSyncEvent(true);
+}
+
+ISR(TIMER2_OVF_vect) {
+  AtverterH::pwmSyncEvent(false);
+}
+
+// synchronizes the scan conversions to the switching period, so that each samples the middle of an on-time
+//  the ADC clock is the slowest (up to the default) that divides the switching period in whole clocks. Returns false,
+//  and stays asynchronous, if that clock would exceed 200 kHz (ADCSYNCPRESCALERBSMIN), where the ADC loses accuracy,
+//  e.g. at 100 kHz switching. isFastClockAllowed accepts clocks up to 1 MHz instead (500 kHz at 100 kHz switching),
+//  trading about 2 bits of resolution for the synchronized sample
+//  takes effect on a running scan at once, and on the next startADCScan() otherwise
+bool AtverterH::setADCScanSync(bool isSynchronized, bool isFastClockAllowed) {
+  uint8_t prescalerBS = ADCSCAN_PRESCALER_BS;
+  if (isSynchronized) {
+    unsigned long periodCycles = (unsigned long)_pwmPeriodCounts << PWMPRESCALERSHIFTS[_pwmPrescalerIndex];
+    prescalerBS = 0;
+    while (prescalerBS < ADCSCAN_PRESCALER_BS && !(periodCycles & (1UL << prescalerBS)))
+      prescalerBS++;
+    if (prescalerBS < (isFastClockAllowed ? ADCSYNCFASTPRESCALERBSMIN : ADCSYNCPRESCALERBSMIN))
+      isSynchronized = false;
+  }
+  if (!isSynchronized)
+    prescalerBS = ADCSCAN_PRESCALER_BS;
+  bool isScanning = pauseADCScan();
+  TIMSK2 &= ~(_BV(OCIE2B) | _BV(TOIE2));
+  _isADCScanSynchronized = isSynchronized;
+  _isADCSyncFastClockAllowed = isFastClockAllowed;
+  _adcScanPrescalerBS = prescalerBS;
+  // a conversion starts on the next ADC clock (0 to 1 clocks), and samples 1.5 clocks later: 2 clocks on average
+  //  the ADC clock divides the period, so 2 clocks can be a whole period or more (e.g. 256 counts at 62.5 kHz):
+  //  only the phase within a period matters, so the delay is reduced modulo the period
+  _adcSyncDelayCounts = ((2U << prescalerBS) >> PWMPRESCALERSHIFTS[_pwmPrescalerIndex]) % _pwmPeriodCounts;
+  // the start only has to fall within the right ADC clock, so the interrupt never waits for longer than one
+  _adcSyncWaitMaxCounts = max((1U << prescalerBS) >> PWMPRESCALERSHIFTS[_pwmPrescalerIndex], 1U);
+  if (isScanning)
+    resumeADCScan();
+  return isSynchronized;
+}
+
+// returns true if scan conversions are synchronized to the switching period
+bool AtverterH::isADCScanSynchronized() {
+  return _isADCScanSynchronized;
+}
+
+// starts the selected scan conversion: at once, or armed for the Timer2 event just before its start count if
+//  synchronized, the start of the on-time (overflow) or, for short on-times, the end of the one before (compare B)
+void AtverterH::armADCScanTrigger() {
+  if (!_isADCScanSynchronized || !_isPWMTimerInitialized) {
+    ADCSRA |= _BV(ADSC);
+    return;
+  }
+  if ((OCR2B >> 1) >= _adcSyncDelayCounts) {
+    TIFR2 = _BV(TOV2); // an old event would start the conversion at the wrong phase
+    TIMSK2 |= _BV(TOIE2);
+  } else {
+    TIFR2 = _BV(OCF2B);
+    TIMSK2 |= _BV(OCIE2B);
+  }
+}
+
+// starts an armed scan conversion, timed to sample the middle of the on-time: from the overflow, the start count is
+//  in the on-time that begins, and from compare B, for short on-times, it is before the period wraps
+//  waits in the interrupt for at most one ADC clock (_adcSyncWaitMaxCounts). A longer wait, e.g. at a low switching
+//  frequency, is skipped: the conversion starts at once and samples earlier in the period, still at a fixed phase
+//  an interrupt delayed past the start count, e.g. by the control tick, also starts the conversion at once
+void AtverterH::pwmSyncEvent(bool isCompareEvent) {
+  TIMSK2 &= ~(_BV(OCIE2B) | _BV(TOIE2)); // one conversion per arming
+  if (!(ADCSRA & _BV(ADIE))) // the scan paused since
+    return;
+  uint8_t compare = OCR2B;
+  int start = (compare >> 1) - (int)_adcSyncDelayCounts; // start count in the next period
+  if (isCompareEvent) {
+    start += OCR2A + 1; // start count in this period, after the compare
+    if (start - compare <= _adcSyncWaitMaxCounts)
+      while (TCNT2 >= compare && TCNT2 < start);
+  } else if (start <= _adcSyncWaitMaxCounts) {
+    uint8_t top = OCR2A;
+    while (TCNT2 == top); // the overflow flag rises at TOP, wait for the period to wrap
+    while (TCNT2 < start); // exits at once if the interrupt ran late, past the start count
+  }
+  ADCSRA |= _BV(ADSC);
+}
+
+// Burst Mode --------------------------------------------------------------
+
+// enables light-load burst mode on the output terminal (1 or 2)
+//  below currentThreshold (mA) of output current, the gates shut down once the output reaches vHigh (mV), and switch
+//  again once it falls to vLow (mV). Set vLow < vHigh <= the output voltage setpoint
+void AtverterH::setBurstMode(int terminal, int currentThreshold, unsigned int vLow, unsigned int vHigh) {
+  uint8_t oldSREG = SREG;
+  cli(); // the control tick reads the thresholds
+  _isBurstOnTerminal2 = (terminal != 1);
+  _burstCurrentThreshold_mA = currentThreshold;
+  _burstVLow_mV = vLow;
+  _burstVHigh_mV = vHigh;
+  updateBurstThresholds();
+  if (_burstState == BURSTDISABLED)
+    _burstState = BURSTSWITCHING;
+  SREG = oldSREG;
+}
+
+// disables burst mode, and resumes switching if the gates are shut down for a burst
+void AtverterH::disableBurstMode() {
+  uint8_t oldSREG = SREG;
+  cli();
+  if (_burstState == BURSTIDLE && _shutdownCode == BURSTSHUTDOWN)
+    startBurst();
+  _burstState = BURSTDISABLED;
+  SREG = oldSREG;
+}
+
+// returns true while the gates are shut down between bursts
+bool AtverterH::isBurstIdle() {
+  return _burstState == BURSTIDLE;
+}
+
+// converts the burst thresholds to raw form, so that the control tick only compares raw sensor averages
+void AtverterH::updateBurstThresholds() {
+  _burstCurrentRaw = mA2raw(_burstCurrentThreshold_mA);
+  _burstVLowRaw = mV2raw(_burstVLow_mV);
+  _burstVHighRaw = mV2raw(_burstVHigh_mV);
+}
+
+// steps burst mode, called at the end of every control tick
+//  takes a few microseconds unless a burst starts or ends
+void AtverterH::updateBurst() {
+  int vOut = _isBurstOnTerminal2 ? _sensors.average<V2_INDEX>() : _sensors.average<V1_INDEX>();
+  if (_burstState == BURSTSWITCHING) {
+    if (isGateShutdown()) // shut down by a fault or by the sketch, leave it be
+      return;
+    int iOut = _isBurstOnTerminal2 ? _sensors.average<I2_INDEX>() : _sensors.average<I1_INDEX>();
+    if (vOut >= _burstVHighRaw && iOut < _burstCurrentRaw && iOut > -_burstCurrentRaw) {
+      _burstDutyCycleRaw = _dutyCycleRaw;
+      _burstState = BURSTIDLE;
+      shutdownGates(BURSTSHUTDOWN);
+    }
+  } else if (_burstState == BURSTIDLE) {
+    if (_shutdownCode != BURSTSHUTDOWN) // shut down for another reason since, keep the gates off
+      _burstState = BURSTSWITCHING;
+    else if (vOut <= _burstVLowRaw) {
+      startBurst();
+      _burstState = BURSTSWITCHING;
+    }
+  }
+}
+
+// enables the gate drivers at the duty cycle the last burst ended with, with the compensator history reset to it
+//  the compensator keeps running between bursts, so its output is discarded rather than winding up the next burst
+void AtverterH::startBurst() {
+  setDutyCycleRaw(_burstDutyCycleRaw);
+  resetComp();
+  enableGateDrivers();
+}
+
 // Alternate Drive Signal --------------------------------------------------
 
 // check bootstrap counter to see if need to refresh caps
@@ -133,6 +435,7 @@ void AtverterH::refreshBootstrap() {
 
 // set gate driver 1 to use an always-high alternate signal
 void AtverterH::applyHoldHigh1() {
+  _dcdcMode = BOOST;
   digitalWrite(VCTRL1_PIN, HIGH);
   digitalWrite(VCTRL2_PIN, LOW);
   digitalWrite(ALT_PIN, HIGH);
@@ -141,6 +444,7 @@ void AtverterH::applyHoldHigh1() {
 
 // set gate driver 2 to use an always-high alternate signal
 void AtverterH::applyHoldHigh2() {
+  _dcdcMode = BUCK;
   digitalWrite(VCTRL2_PIN, HIGH);
   digitalWrite(VCTRL1_PIN, LOW);
   digitalWrite(ALT_PIN, HIGH);
@@ -149,11 +453,161 @@ void AtverterH::applyHoldHigh2() {
 
 // sets both gate drivers to use the primary pwm signal
 void AtverterH::removeHold() {
+  _dcdcMode = BUCKBOOST;
   digitalWrite(VCTRL1_PIN, LOW);
   digitalWrite(VCTRL2_PIN, LOW);
   digitalWrite(ALT_PIN, LOW);
 }
 
+// DC-DC Topology Manager -----------------------------------------------------
+
+// applies the holds of a DCDCModes, and seeds the duty cycle that converts the measured V1 to v2Raw
+//  the compensators are clamped to the duty limits of the mode and reset to the seeded duty cycle, so that the next
+//  control tick continues from the same V2 (duty cycles on page 3 of https://www.ti.com/lit/an/slyt765/slyt765.pdf)
+void AtverterH::setDCDCMode(int mode, int v2Raw) {
+  if (mode < 0 || mode >= NUM_DCDCMODES)
+    return;
+  long duty = idealDutyRaw(mode, getRawV1(), v2Raw);
+  uint8_t oldSREG = SREG;
+  cli(); // the control tick must not run between the hold change and the duty cycle seed
+  switch (mode) {
+    case BUCK:
+      applyHoldHigh2(); // hold side 2 high for a buck converter with side 1 input
+      break;
+    case BOOST:
+      applyHoldHigh1(); // hold side 1 high for a boost converter with side 1 input
+      break;
+    default: // BUCKBOOST
+      removeHold();
+      break;
+  }
+  setCompLimits(_dcdcDutyMin[mode], _dcdcDutyMax[mode]);
+  setDutyCycleRaw(constrain(duty, _dcdcDutyMin[mode], _dcdcDutyMax[mode]));
+  resetComp();
+  SREG = oldSREG;
+}
+
+// changes the DCDCModes as the measured V1 crosses v2Raw (e.g. the voltage setpoint), with hysteresis, call once per
+//  control tick. Picks the mode from the thresholds if none was set yet. Returns the DCDCModes
+int AtverterH::updateDCDCMode(int v2Raw) {
+  long v1Percent = 100L*getRawV1(); // compare 100*V1 with threshold*V2, so as to avoid a division
+  long v2 = v2Raw;
+  int mode;
+  switch (_dcdcMode) {
+    case BOOST:
+      mode = (v1Percent > _dcdcThresholds[1]*v2) ? BUCKBOOST : BOOST;
+      break;
+    case BUCKBOOST:
+      if (v1Percent > _dcdcThresholds[3]*v2)
+        mode = BUCK;
+      else if (v1Percent < _dcdcThresholds[0]*v2)
+        mode = BOOST;
+      else
+        mode = BUCKBOOST;
+      break;
+    case BUCK:
+      mode = (v1Percent < _dcdcThresholds[2]*v2) ? BUCKBOOST : BUCK;
+      break;
+    default: // no mode yet, start in the middle of each hysteresis band
+      if (v1Percent < _dcdcThresholds[1]*v2)
+        mode = BOOST;
+      else if (v1Percent < _dcdcThresholds[2]*v2)
+        mode = BUCKBOOST;
+      else
+        mode = BUCK;
+      break;
+  }
+  if (mode != _dcdcMode)
+    setDCDCMode(mode, v2Raw);
+  return _dcdcMode;
+}
+
+// returns the DCDCModes of the applied holds (setDCDCMode(), updateDCDCMode() or applyHoldHigh1/2() and removeHold()),
+//  or -1 before any hold was applied
+int AtverterH::getDCDCMode() {
+  return _dcdcMode;
+}
+
+// sets the V1/V2 thresholds (%) of updateDCDCMode(), buck-boost to boost < boost to buck-boost < buck to buck-boost
+//  < buck-boost to buck, e.g. 80, 90, 110, 120 (default)
+void AtverterH::setDCDCThresholds(uint8_t toBoost, uint8_t fromBoost, uint8_t fromBuck, uint8_t toBuck) {
+  _dcdcThresholds[0] = toBoost;
+  _dcdcThresholds[1] = fromBoost;
+  _dcdcThresholds[2] = fromBuck;
+  _dcdcThresholds[3] = toBuck;
+}
+
+// sets the duty cycle limits (Q10) of a DCDCModes, applied to the compensators right away if it is the current mode
+void AtverterH::setDCDCDutyLimits(int mode, int dutyMinRaw, int dutyMaxRaw) {
+  if (mode < 0 || mode >= NUM_DCDCMODES)
+    return;
+  _dcdcDutyMin[mode] = dutyMinRaw;
+  _dcdcDutyMax[mode] = dutyMaxRaw;
+  if (mode == _dcdcMode)
+    setCompLimits(dutyMinRaw, dutyMaxRaw);
+}
+
+// returns the Q10 duty cycle of a DCDCModes that converts v1 to v2, unconstrained
+//  duty cycles on page 3 of https://www.ti.com/lit/an/slyt765/slyt765.pdf
+long AtverterH::idealDutyRaw(int mode, long v1, long v2) {
+  v1 = max(v1, 1);
+  v2 = max(v2, 1);
+  switch (mode) {
+    case BUCK:
+      return v2*(1 << DUTYQ)/v1; // D = V2/V1
+    case BOOST:
+      return (v2 - v1)*(1 << DUTYQ)/v2; // D = 1 - V1/V2
+    default: // BUCKBOOST
+      return v2*(1 << DUTYQ)/(v1 + v2); // D = V2/(V1 + V2)
+  }
+}
+
+// Input-Voltage Feed-Forward -----------------------------------------------
+
+// turns on the feed-forward of the source terminal voltage, for the regulated terminal (1 or 2) at vRefRaw
+//  call again when the setpoint changes; the feed-forward starts over from the duty cycle at the next tick, and the
+//  compensator moves the output to the new setpoint as before
+void AtverterH::setFeedForward(int terminal, int vRefRaw) {
+  uint8_t oldSREG = SREG;
+  cli(); // the control tick reads these
+  _feedForwardTerminal = (terminal == 1) ? 1 : 2;
+  _feedForwardVRefRaw = vRefRaw;
+  _feedForwardVSourceRaw = -1;
+  SREG = oldSREG;
+}
+
+// turns the feed-forward off
+void AtverterH::disableFeedForward() {
+  _feedForwardTerminal = 0;
+}
+
+// returns true if the feed-forward is on
+bool AtverterH::isFeedForwardEnabled() {
+  return _feedForwardTerminal != 0;
+}
+
+// computes the ideal duty cycle for the measured source voltage, and moves the duty cycle and the compensator output
+//  history by its change since the last tick. Needs the DC-DC mode (the holds) to be set
+void AtverterH::updateFeedForward() {
+  if (_feedForwardTerminal == 0 || _dcdcMode < 0)
+    return;
+  int vSource = (_feedForwardTerminal == 1) ? getRawV2() : getRawV1();
+  if (vSource == _feedForwardVSourceRaw && _dcdcMode == _feedForwardMode)
+    return; // no change, skips the division
+  long duty = (_feedForwardTerminal == 1) ? idealDutyRaw(_dcdcMode, _feedForwardVRefRaw, vSource) :
+    idealDutyRaw(_dcdcMode, vSource, _feedForwardVRefRaw);
+  duty = constrain(duty, DUTYRAWMIN, DUTYRAWMAX);
+  if (_feedForwardVSourceRaw >= 0 && _dcdcMode == _feedForwardMode) { // else start over, e.g. after a mode change
+    int delta = duty - _feedForwardDutyRaw;
+    _comp.shiftOutput(delta);
+    _compCurrent.shiftOutput(delta);
+    setDutyCycleRaw(constrain((long)getDutyCycleRaw() + delta, _dutyLimitMin, _dutyLimitMax));
+  }
+  _feedForwardDutyRaw = duty;
+  _feedForwardVSourceRaw = vSource;
+  _feedForwardMode = _dcdcMode;
+}
+
 // Sensor Average Updating -------------------------------------------------
 
 // updates stored VCC value based on an average
@@ -162,94 +616,97 @@ void AtverterH::updateVCC() {
   int avgLength = 4; // should be less than 10 to avoid overflow
   for (int n = 0; n < avgLength; n++)
     accumulator = accumulator + readVCC();
-  _vcc = accumulator/avgLength;
+  applyVCC(accumulator/avgLength);
+}
+
+// stores a measured VCC (mV), from updateVCC() or a non-blocking updateVCCAsync()
+void AtverterH::applyVCC(int vcc) {
+  _vcc = vcc;
   if (_vcc < 4950) { // readVCC() might measure ~4500 mV if connected via USB
     _vcc = 5000; // to avoid incorrect USB VCC, set to approximate supply output voltage 
   }
+  updateConversionScales();
+  updateBurstThresholds();
 }
 
 void AtverterH::updateTSensors() {
-  updateSensorRaw(T1_INDEX, analogReadFast(T1_PIN));
-  updateSensorRaw(T2_INDEX, analogReadFast(T2_PIN));
+  if (isADCBusy()) // the scan engine already feeds the averages, or a VCC measurement owns the ADC
+    return;
+  _sensors.update<T1_INDEX>(analogReadFast(T1_PIN));
+  _sensors.update<T2_INDEX>(analogReadFast(T2_PIN));
 }
 
 void AtverterH::updateVISensors() {
-  // analogRead() measured at 116 microseconds, updateSensorRaw adds negligable time
+  if (isADCBusy()) // the scan engine already feeds the averages, or a VCC measurement owns the ADC
+    return;
+  // analogRead() measured at 116 microseconds, the moving average update adds negligable time
   // total updateVISensors time is measured at 456 microseconds
-  updateSensorRaw(V1_INDEX, analogReadFast(V1_PIN));
-  updateSensorRaw(V2_INDEX, analogReadFast(V2_PIN));
-  updateSensorRaw(I1_INDEX, analogReadFast(I1_PIN) - 512);
-  updateSensorRaw(I2_INDEX, analogReadFast(I2_PIN) - 512);
-}
-
-void AtverterH::updateSensorRaw(int index, int sample) {
-  // find correct sensorPast array
-  int * sensorPast;
-  switch (index) {
-    case V1_INDEX:
-      sensorPast = _sensorPastV1;
-      break;
-    case V2_INDEX:
-      sensorPast = _sensorPastV2;
-      break;
-    case I1_INDEX:
-      sensorPast = _sensorPastI1;
-      break;
-    case I2_INDEX:
-      sensorPast = _sensorPastI2;
-      break;
-    case T1_INDEX:
-      sensorPast = _sensorPastT1;
-      break;
-    case T2_INDEX:
-      sensorPast = _sensorPastT2;
-      break;
-    default:
-      return;
-  }
-  // subtract oldest value from accumulator, set new value in array, add new value to accumulator
-  _sensorAccumulators[index] -= sensorPast[_sensorIterators[index]];
-  sensorPast[_sensorIterators[index]] = sample;
-  _sensorAccumulators[index] += sensorPast[_sensorIterators[index]];
-  // update sensor average
-  _sensorAverages[index] = (int)(_sensorAccumulators[index]>>AVERAGE_WINDOW_BS[index]);
-  // _sensorAverages[index] = (int)(_sensorAccumulators[index]/AVERAGE_WINDOW_MAX[index]);
-  // increment iterator (or return it to zero)
-  _sensorIterators[index] ++;
-  if (_sensorIterators[index] >= AVERAGE_WINDOW_MAX[index])
-    _sensorIterators[index] = 0;
+  _sensors.update<V1_INDEX>(analogReadFast(V1_PIN));
+  _sensors.update<V2_INDEX>(analogReadFast(V2_PIN));
+  _sensors.update<I1_INDEX>(analogReadFast(I1_PIN) - 512);
+  _sensors.update<I2_INDEX>(analogReadFast(I2_PIN) - 512);
+}
+
+// starts the ADC scan engine on every board sensor, so that the averages update without blocking reads
+void AtverterH::startADCScan() {
+  PicroBoard::startADCScan(ATVERTER_ADCSCAN, sizeof(ATVERTER_ADCSCAN)/sizeof(ATVERTER_ADCSCAN[0]));
+}
+
+// feeds one sample from the ADC scan engine into the sensor moving averages
+void AtverterH::updateScanSample(uint8_t sensorIndex, int sample) {
+  _sensors.update(sensorIndex, sample);
 }
 
 // Raw Sensor Accessor Functions --------------------------------------
 
 // terminal 1 voltage (0 to 1023)
 int AtverterH::getRawV1() {
-  return _sensorAverages[V1_INDEX];
+  return _sensors.average<V1_INDEX>();
 }
 
 // terminal 2 voltage (0 to 1023)
 int AtverterH::getRawV2() {
-  return _sensorAverages[V2_INDEX];
+  return _sensors.average<V2_INDEX>();
 }
 
 // terminal 1 current (0 to 1023)
 int AtverterH::getRawI1() {
-  return _sensorAverages[I1_INDEX];
+  return _sensors.average<I1_INDEX>();
 }
 
 // terminal 2 current (0 to 1023)
 int AtverterH::getRawI2() {
-  return _sensorAverages[I2_INDEX];
+  return _sensors.average<I2_INDEX>();
 }
 
 // thermistor 1 (0 to 1023)
 int AtverterH::getRawT1() {
-  return _sensorAverages[T1_INDEX];
+  return _sensors.average<T1_INDEX>();
 }
 
 // thermistor 2 (0 to 1023)
 int AtverterH::getRawT2() {
-  return _sensorAverages[T2_INDEX];
+  return _sensors.average<T2_INDEX>();
+}
+
+// terminal 1 voltage, oversampled (0 to 1023 << SENSOR_V_OVERSAMPLE_BITS)
+int AtverterH::getWideRawV1() {
+  return _sensors.average<V1_INDEX, SENSOR_V_OVERSAMPLE_BITS>();
+}
+
+// terminal 2 voltage, oversampled (0 to 1023 << SENSOR_V_OVERSAMPLE_BITS)
+int AtverterH::getWideRawV2() {
+  return _sensors.average<V2_INDEX, SENSOR_V_OVERSAMPLE_BITS>();
+}
+
+// terminal 1 current, oversampled (-512 to 512 << SENSOR_I_OVERSAMPLE_BITS)
+int AtverterH::getWideRawI1() {
+  return _sensors.average<I1_INDEX, SENSOR_I_OVERSAMPLE_BITS>();
+}
+
+// terminal 2 current, oversampled (-512 to 512 << SENSOR_I_OVERSAMPLE_BITS)
+int AtverterH::getWideRawI2() {
+  return _sensors.average<I2_INDEX, SENSOR_I_OVERSAMPLE_BITS>();
 }
 
 // Fully-Formatted Sensor Accessor Functions --------------------------------------
@@ -261,22 +718,22 @@ int AtverterH::getVCC() {
 
 // returns the averaged V1 value in mV
 unsigned int AtverterH::getV1() {
-  return raw2mV(getRawV1());
+  return raw2mV(getWideRawV1(), SENSOR_V_OVERSAMPLE_BITS);
 }
 
 // returns the averaged V2 value in mV
 unsigned int AtverterH::getV2() {
-  return raw2mV(getRawV2());
+  return raw2mV(getWideRawV2(), SENSOR_V_OVERSAMPLE_BITS);
 }
 
 // returns the averaged I1 value in mA
 int AtverterH::getI1() {
-  return raw2mA(getRawI1());
+  return raw2mA(getWideRawI1(), SENSOR_I_OVERSAMPLE_BITS);
 }
 
 // returns the averaged I2 value in mA
 int AtverterH::getI2() {
-  return raw2mA(getRawI2());
+  return raw2mA(getWideRawI2(), SENSOR_I_OVERSAMPLE_BITS);
 }
 
 // returns the averaged T1 value in °C
@@ -292,57 +749,54 @@ int AtverterH::getT2() {
 // Conversion Utility Functions ---------------------------------------
 
 // converts a raw 10-bit analog reading (0-1023) to the actual mV (0-65000)
-unsigned int AtverterH::raw2mV(int raw) {
-  long numerator = (long)raw*getVCC()*13;
-  return (unsigned int)(numerator/1024); // analogRead*VCC/1024 * (120k+10k)/10k
+//  oversampled readings (0 to 1023 << extraBits) are scaled by the extra bits
+unsigned int AtverterH::raw2mV(int raw, uint8_t extraBits) {
+  long numerator = (long)raw*_raw2mVScale;
+  return (unsigned int)(numerator >> (10 + extraBits)); // analogRead*VCC/1024 * (120k+10k)/10k
 }
 
 // converts a raw 10-bit analog reading (0-1023) to ADC mV reading (0-5000)
-int AtverterH::raw2mVADC(int raw) {
+int AtverterH::raw2mVADC(int raw, uint8_t extraBits) {
   long rawL = (long)raw;
-  return (int)(rawL*getVCC()/1024); // analogRead*VCC/1024
+  return (int)((rawL*getVCC()) >> (10 + extraBits)); // analogRead*VCC/1024
 }
 
 // converts a raw 10-bit analog reading centered on zero (-512 to 512) to a mA reading (-5000 to 5000)
 //  for MT9221CT-06BR5 current sensor with VCC=5V, sensitivity is 333mV/A, 0A at 2.5V
 //  with variable VCC, sensitivity (mV/mA) is VCC/5000*333/1000, 0A at VCC/2
-int AtverterH::raw2mA(int raw) {
+int AtverterH::raw2mA(int raw, uint8_t extraBits) {
   long rawL = (long)raw;
   // (analogRead-512) * VCC/1024 * 1/sensitivity = (analogRead-512) * VCC/1024 * 1000/333
-  return rawL*getVCC()*3/1024;
+  return (rawL*_raw2mAScale) >> (10 + extraBits);
 }
 
-// converts a raw 10-bit analog reading (0-1023) to a °C reading (0-100)
+// converts a raw 10-bit analog reading (0-1023) to a °C reading (10-100)
+//  readings outside the table saturate at 10 °C and 100 °C
 int AtverterH::raw2degC(int raw) {
-  int x0 = 0;
-  int x1 = 0;
-  int y0 = 0;
-  int y1 = 0;
-  for (int n = 1; n < sizeof(TTABLE)/sizeof(TTABLE[0]); n++) {
-    if (raw < TTABLE[n][0]) {
-      x0 = TTABLE[n-1][0];
-      x1 = TTABLE[n][0];
-      y0 = TTABLE[n-1][1];
-      y1 = TTABLE[n][1];
-      break;
-    }
-  }
-  return y0 + (raw - x0)*(y1 - y0)/(x1 - x0);
+  return LookupTable<int>(TTABLE, sizeof(TTABLE)/sizeof(TTABLE[0])).lookup(raw);
 }
 
-// converts a mV value (0-65000) to raw 10-bit form (0-1023)
-int AtverterH::mV2raw(unsigned int mV) { // mV * 10k/(10k+120k) * 1024/VCC
-  long temp = (long)mV * 79 / getVCC();
+// converts a mV value (0-65000) to raw 10-bit form (0-1023), or oversampled form (0 to 1023 << extraBits)
+int AtverterH::mV2raw(unsigned int mV, uint8_t extraBits) { // mV * 10k/(10k+120k) * 1024/VCC
+  long temp = ((long)mV*_mV2rawScale) >> (MV2RAW_Q - extraBits);
   return (int)(temp);
 }
 
 // converts a mA value (-5000 to 5000) to raw 10-bit form centered around 0 (-512 to 512)
-int AtverterH::mA2raw(int mA) {
+int AtverterH::mA2raw(int mA, uint8_t extraBits) {
   // mA * sensitivity * 1024/VCC = mA * 333/1000 * 1024/VCC
-  long temp = (long)mA*341/getVCC();
+  long temp = ((long)mA*_mA2rawScale) >> (MA2RAW_Q - extraBits);
   return (int)temp;
 }
 
+// caches the VCC-dependent conversion factors, so that conversions need no division
+void AtverterH::updateConversionScales() {
+  _raw2mVScale = (long)_vcc*13;
+  _raw2mAScale = (long)_vcc*3;
+  _mV2rawScale = (1L << (10 + MV2RAW_Q))/(13L*_vcc);
+  _mA2rawScale = (341L << MA2RAW_Q)/_vcc;
+}
+
 // Droop Resistance Conversions -------------------------------------------
 
 // sets the stored droop resistance
@@ -373,6 +827,7 @@ int AtverterH::getVDroopRaw(int iOut) {
 
 // returns the official VCC voltage in milliVolts
 int AtverterH::readVCC() {
+  bool isScanning = pauseADCScan(); // the scan engine must not switch channels during this reading
   // reads 1.1V reference against AVcc
   // set the reference to Vcc and the measurement to the internal 1.1V reference
   #if defined(__AVR_ATmega32U4__) || defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
@@ -392,7 +847,9 @@ int AtverterH::readVCC() {
  
   long result = (high<<8) | low;
  
-  result = 1125300L / result; // Calculate Vcc (in mV); 1125300 = 1.1*1023*1000
+  result = _bandgapScale / result; // Calculate Vcc (in mV), see _bandgapScale
+  if (isScanning)
+    resumeADCScan();
   return (int)result; // Vcc in millivolts
 }
 
@@ -421,13 +878,12 @@ void AtverterH::shutdownGates() {
 }
 
 // immediately triggers the gate shutdown
+//  the shutdown pin is pulled low at once and released to an input by the control timer tick, so a shutdown from
+//  the control interrupt returns right away
 void AtverterH::shutdownGates(int shutdownCode) {
+  releasePinPulse(PRORESET_PIN); // stop resetting the latch, so that it can trip
   _shutdownCode = shutdownCode;
-  pinMode(GATESD_PIN, OUTPUT);
-  digitalWrite(GATESD_PIN, LOW);
-  delayMicroseconds(10000);
-  // digitalWrite(GATESD_PIN, HIGH);
-  pinMode(GATESD_PIN, INPUT);
+  startPinPulse(GATESD_PIN, LOW, true, GATESHUTDOWNMICROS);
 }
 
 // returns true if the gate shutdown signal is currently latched
@@ -436,8 +892,9 @@ bool AtverterH::isGateShutdown() {
 }
 
 // returns the appropriate shutdown code, or -1 if gates not shutdown
+//  the gates idling between burst mode bursts is normal operation, so it also reads -1 (see isBurstIdle())
 int AtverterH::getShutdownCode() {
-  if (!isGateShutdown())
+  if (!isGateShutdown() || _shutdownCode == BURSTSHUTDOWN)
     return -1;
   else
     return _shutdownCode;
@@ -460,10 +917,10 @@ void AtverterH::setCurrentShutdown2(int current_mA) {
 // checks if last sensed current is greater than current limit
 void AtverterH::checkCurrentShutdown() {
   // this function takes negligable microseconds unless actually shutting down
-  if (_sensorAverages[I1_INDEX] > _currentLimitAmplitudeRaw1
-    || _sensorAverages[I1_INDEX] < -_currentLimitAmplitudeRaw1
-    || _sensorAverages[I2_INDEX] > _currentLimitAmplitudeRaw2
-    || _sensorAverages[I2_INDEX] < -_currentLimitAmplitudeRaw2)
+  if (_sensors.average<I1_INDEX>() > _currentLimitAmplitudeRaw1
+    || _sensors.average<I1_INDEX>() < -_currentLimitAmplitudeRaw1
+    || _sensors.average<I2_INDEX>() > _currentLimitAmplitudeRaw2
+    || _sensors.average<I2_INDEX>() < -_currentLimitAmplitudeRaw2)
     shutdownGates(OVERCURRENT);
 }
 
@@ -482,56 +939,93 @@ void AtverterH::checkThermalShutdown() {
 
 // set discrete compensator coefficients
 // must specify size of numerator and denominator due to how array pointers are passed to functions
+// compDen[0] should be a power of 2, so that the compensator divides with a shift; call again after changing the arrays
+// sets the current loop of regulate() too, unless followed by setCompCurrent()
 void AtverterH::setComp(int num[], int den[], int numSize, int denSize) {
-  _compNum = num;
-  _compDen = den;
-  _compNumSize = numSize;
-  _compDenSize = denSize;
+  _comp.setCoefficients(num, den, numSize, denSize);
+  _compCurrent.setCoefficients(num, den, numSize, denSize);
+}
+
+// set a cascade of second-order sections instead of the difference equation, e.g. from compensation.py
+void AtverterH::setCompSections(const CompSection* sections, int length, uint8_t shift) {
+  _comp.setSections(sections, length, shift);
+  _compCurrent.setSections(sections, length, shift);
+}
+
+// set the current loop coefficients of regulate(), if they differ from the voltage loop (call after setComp())
+void AtverterH::setCompCurrent(int num[], int den[], int numSize, int denSize) {
+  _compCurrent.setCoefficients(num, den, numSize, denSize);
+}
+
+// clamps the compensator output, and with it the output history, so that the compensator cannot wind up
+//  the limits default to the duty cycle limits, DUTYRAWMIN to DUTYRAWMAX
+void AtverterH::setCompLimits(int outputMin, int outputMax) {
+  _comp.setLimits(outputMin, outputMax);
+  _compCurrent.setLimits(outputMin, outputMax);
+  _dutyLimitMin = outputMin;
+  _dutyLimitMax = outputMax;
 }
 
 // update past compensator inputs and outputs
 // must do this even if using gradient descent for smooth transition to classical feedback
 void AtverterH::updateCompPast(int inputNow) {
-// update array of past compensator inputs
-  for (int n = _compNumSize - 1; n > 0; n--) {
-    _compIn[n] = _compIn[n-1];
-  }
-  _compIn[0] = inputNow; // set the current compensator input
-  // update array of past compensator outputs
-  for (int n = _compDenSize - 1; n > 0; n--) {
-    _compOut[n] = _compOut[n-1];
-  }
+  updateFeedForward(); // moves the compensator output history first, if the feed-forward is on
+  _comp.update(inputNow);
 }
 
-// returns compensator output for classical feedback discrete compensation
+// returns compensator output for classical feedback discrete compensation, clamped to the compensator limits
 // usage: compNum = {A, B, C}, compDen = {D, E, F}, x = compIn, y = compOut
 //   D*y[n] + E*y[n-1] + F*y[n-2] = A*x[n] + B*x[n-1] + C*x[n-2]
 //   y[n] = (A*x[n] + B*x[n-1] + C*x[n-2] - E*y[n-1] - F*y[n-2])/D
 long AtverterH::calculateCompOut() {
-  // accumulate compensator weighted input terms via addition
-  long compAcc = 0;
-  for (int n = 0; n < _compNumSize; n++) {
-    compAcc = compAcc + _compIn[n]*_compNum[n];
-  }
-  // accumulate compensator weighted past output terms via subtraction
-  for (int n = 1; n < _compDenSize; n++) {
-    compAcc = compAcc - _compOut[n]*_compDen[n];
-  }
-  compAcc = compAcc/_compDen[0]; // divide by the first denominator coefficient
-  _compOut[0] = compAcc; // the compensator output, y[n]
-  return compAcc;
+  return _comp.calculate();
 }
 
-// resets the compensator past values when switching between CV and CC
+// resets the compensator past values when switching between CV and CC, or when the duty cycle was set directly
 void AtverterH::resetComp() {
-  // reset array of past compensator inputs
-  for (int n = 0; n < _compNumSize; n++) {
-    _compIn[n] = 0;
-  }
-  // reset array of past compensator outputs
-  for (int n = 0; n < _compDenSize; n++) {
-    _compOut[n] = getDutyCycle()*10; // backward convert dutyRaw = duty*1024/100 = duty*10
+  _comp.reset(getDutyCycleRaw());
+  _compCurrent.reset(getDutyCycleRaw());
+}
+
+// Controller Mode Manager ----------------------------------------------------
+
+// sets the terminal (1 or 2) that regulate() controls, for the returned OutputModes, and the ModeSelects
+void AtverterH::setRegulation(int terminal, int modeSelect) {
+  _isRegulationOnTerminal2 = (terminal != 1);
+  _modeSelect = modeSelect;
+}
+
+// runs the voltage and current loops together, applies the duty cycle picked by the min or max selection, and
+//  back-calculates both compensators to it. Replaces updateCompPast(), calculateCompOut() and gradDescStep()
+//  returns the OutputModes in control, e.g. CC2 while a charge current limit is met
+int AtverterH::regulate(int vError, int iError, bool isClassical) {
+  updateFeedForward(); // moves the duty cycle and the compensator output histories first, if the feed-forward is on
+  _comp.update(vError);
+  _compCurrent.update(iError);
+  if (isClassical) {
+    int vDuty = _comp.calculate();
+    int iDuty = _compCurrent.calculate();
+    _isCurrentControlled = (_modeSelect == MAXSELECT) ? (iDuty > vDuty) : (iDuty < vDuty);
+    setDutyCycleRaw(_isCurrentControlled ? iDuty : vDuty);
+  } else {
+    // gradient descent only steps by the sign of the error, so select by sign, keeping the last loop on a tie
+    int vSign = (vError > 0) - (vError < 0);
+    int iSign = (iError > 0) - (iError < 0);
+    if (vSign != iSign)
+      _isCurrentControlled = (_modeSelect == MAXSELECT) ? (iSign > vSign) : (iSign < vSign);
+    gradDescStep(_isCurrentControlled ? iError : vError);
   }
+  int duty = getDutyCycleRaw(); // back-calculate the output of each loop to the applied duty cycle
+  _comp.setOutput(duty);
+  _compCurrent.setOutput(duty);
+  return getOutputMode();
+}
+
+// returns the OutputModes in control at the last regulate()
+int AtverterH::getOutputMode() {
+  if (_isRegulationOnTerminal2)
+    return _isCurrentControlled ? CC2 : CV2;
+  return _isCurrentControlled ? CC1 : CV1;
 }
 
 // Gradient Descent ----------------------------------------------------------
@@ -556,78 +1050,53 @@ void AtverterH::gradDescStep(int error) {
     return;
   _gradDescErrorAcc = _gradDescErrorAcc + error;
   if (_gradDescCount > _gradDescSettleMax + _gradDescAverageMax) {
-    // store the duty cycle value to compensator output array in case we switch to classical feedback
-    long duty = getDutyCycle();
-    _compOut[0] = (int)(duty*1024/100);
     // reset counter, calculate and process average error
     _gradDescCount = 0;
     int avgError = _gradDescErrorAcc/_gradDescAverageMax;
     _gradDescErrorAcc = 0;
-    if (avgError > 0) { // ascend or descend by 1% duty cycle depending on the sign of the error
-      setDutyCycle((int)(duty + 1));
-    } else if (error < 0) {
-      setDutyCycle((int)(duty - 1));
+    // ascend or descend by ~1% duty cycle depending on the sign of the error, within the compensator limits (e.g. the
+    //  duty limits of the DC-DC mode), from the exact Q10 duty cycle, so that handing over from classical feedback
+    //  does not round the duty cycle to a whole percent
+    if (avgError > 0) {
+      setDutyCycleRaw(min(getDutyCycleRaw() + DUTYRAWMIN, _dutyLimitMax));
+    } else if (avgError < 0) {
+      setDutyCycleRaw(max(getDutyCycleRaw() - DUTYRAWMIN, _dutyLimitMin));
     }
+    // store the duty cycle value to compensator output array in case we switch to classical feedback
+    _comp.setOutput(getDutyCycleRaw());
+    _compCurrent.setOutput(getDutyCycleRaw());
   }
 }
 
 // Communications ------------------------------------------------------------
 
-// process the parsed RX command, overrides base class virtual function
-// Atverter readable registers: RV1, RV2, RI1, RI2, RT1, RT2, RVCC, RDUT
-// Atverter writable registers: WISD, WTSD
-void AtverterH::interpretRXCommand(char* command, char* value, int receiveProtocol) {
-  if (strcmp(command, "RV1") == 0) { // read voltage at terminal 1
-    sprintf(getTXBuffer(receiveProtocol), "WV1:%u", getV1());
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "RV2") == 0) { // read voltage at terminal 2
-    sprintf(getTXBuffer(receiveProtocol), "WV2:%u", getV2());
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "RI1") == 0) { // read current at terminal 1
-    sprintf(getTXBuffer(receiveProtocol), "WI1:%d", getI1());
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "RI2") == 0) { // read current at terminal 2
-    sprintf(getTXBuffer(receiveProtocol), "WI2:%d", getI2());
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "RT1") == 0) { // read FET temperature of side 1
-    sprintf(getTXBuffer(receiveProtocol), "WT1:%d", getT2());
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "RT2") == 0) { // read FET temperature of side 1
-    sprintf(getTXBuffer(receiveProtocol), "WT2:%d", getT2());
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "RVCC") == 0) { // read the ~5V VCC bus voltage
-    sprintf(getTXBuffer(receiveProtocol), "WVCC:%d", getVCC());
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "RDUT") == 0) { // read the duty cycle
-    sprintf(getTXBuffer(receiveProtocol), "WDUT:%d", getDutyCycle());
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "RDRP") == 0) { // read the stored droop resistance
-    sprintf(getTXBuffer(receiveProtocol), "WDRP:%d", getRDroop());
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "WIS1") == 0) { // write the terminal 1 current shutdown limit (mA)
-    int temp = atoi(value);
-    setCurrentShutdown1(temp);
-    sprintf(getTXBuffer(receiveProtocol), "WIS1:=%d", temp);
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "WIS2") == 0) { // write the terminal 2 current shutdown limit (mA)
-    int temp = atoi(value);
-    setCurrentShutdown2(temp);
-    sprintf(getTXBuffer(receiveProtocol), "WIS2:=%d", temp);
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "WTSD") == 0) { // write the thermal shutdown limit (°C)
-    int temp = atoi(value);
-    setThermalShutdown(temp);
-    sprintf(getTXBuffer(receiveProtocol), "WTSD:=%d", temp);
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "WDRP") == 0) { // set the stored droop resistance
-    int temp = atoi(value);
-    setRDroop(temp);
-    sprintf(getTXBuffer(receiveProtocol), "WDRP:=%d", temp);
-    respondToMaster(receiveProtocol);
-  } else { // send command data to the callback listener functions, registered from primary .ino file
-    for (int n = 0; n < _commandCallbacksEnd; n++) {
-      _commandCallbacks[n](command, value, receiveProtocol);
-    }
+// reads a binary protocol register, overrides base class virtual function
+bool AtverterH::readRegister(uint8_t reg, int* value) {
+  switch (reg) {
+    case BINREG_V1: *value = getV1(); return true;
+    case BINREG_V2: *value = getV2(); return true;
+    case BINREG_I1: *value = getI1(); return true;
+    case BINREG_I2: *value = getI2(); return true;
+    case BINREG_T1: *value = getT1(); return true;
+    case BINREG_T2: *value = getT2(); return true;
+    case BINREG_VCC: *value = getVCC(); return true;
+    case BINREG_DUT: *value = getDutyCycle(); return true;
+    case BINREG_SDC: *value = getShutdownCode(); return true;
+    case BINREG_DRP: *value = getRDroop(); return true;
+    case BINREG_TSD: *value = _thermalLimitC; return true;
+    case BINREG_BST: *value = isBurstIdle(); return true;
+    default: return PicroBoard::readRegister(reg, value);
+  }
+}
+
+// writes a binary protocol register, overrides base class virtual function
+bool AtverterH::writeRegister(uint8_t reg, int value) {
+  switch (reg) {
+    case BINREG_DRP: setRDroop(value); return true;
+    case BINREG_IS1: setCurrentShutdown1(value); return true;
+    case BINREG_IS2: setCurrentShutdown2(value); return true;
+    case BINREG_TSD: setThermalShutdown(value); return true;
+    default: return PicroBoard::writeRegister(reg, value);
   }
 }
 
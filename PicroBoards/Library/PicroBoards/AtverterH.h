@@ -11,9 +11,11 @@
 
 // #include "Arduino.h"
 #include "PicroBoard.h"
+#include "SensorBank.h"
+#include "LookupTable.h"
+#include "Compensator.h"
 
 // In Arduino IDE, go to Sketch -> Include Library -> Manage Libraries
-#include <FastPwmPin.h> // Add zip library from: https://github.com/maxint-rd/FastPwmPin
 #include <TimerOne.h> // In Library Manager, search for "TimerOne"
 #include <avdweb_AnalogReadFast.h> // In Library Manager, search for "AnalogReadFast"
 
@@ -21,12 +23,76 @@
 const int LED2_PIN = 2; // PD2
 const int LED1_PIN = 4; // PD4
 
-// primary gate signal pin, with FastPWM duty cycle
+// primary gate signal pin, driven by Timer2 (OC2B)
 const int PWM_PIN = 3; // PD3
 // From FastPWM Readme:
 //  Pins 10 and 9: 16-bit Timer 1, pin 9 only supports toggle mode (50% PWM)
 //  Pins 3 and 11: 8-bit Timer 2, pin 11 only supports toggle mode (50% PWM)
 
+// duty cycle resolution
+//  duty cycles are set in Q10 (1024 = 100%), the units of the compensator output, and written straight to the Timer2
+//  compare register OCR2B. Timer2 runs in fast PWM mode with no prescaler and TOP = F_CPU/PWMFREQUENCY - 1, so at
+//  16 MHz and 100 kHz a period is 160 timer counts (0.625% steps). OCR2B is double buffered and loads at the end of a
+//  period, so an update never produces a runt pulse
+const long PWMFREQUENCY = 100000L; // default switching frequency (Hz), setSwitchingFrequency() changes it at run time
+const int PWMPERIODCOUNTSMIN = 32; // fewest timer counts per period, limits the frequency to 500 kHz at 16 MHz
+const uint8_t PWMPRESCALERSHIFTS[4] = {0, 3, 5, 6}; // Timer2 prescalers 1, 8, 32 and 64 (CS2 bits 1 to 4)
+const long PWMFREQUENCYMIN = F_CPU/(256L << 6); // slowest frequency, at the largest prescaler (about 1 kHz at 16 MHz)
+const long PWMFREQUENCYMAX = F_CPU/PWMPERIODCOUNTSMIN; // fastest frequency
+const uint8_t DUTYQ = 10; // duty cycle fraction bits, 1 << DUTYQ is 100%
+const int DUTYRAWMIN = (1 << DUTYQ)/100; // 1% duty cycle, lowest duty the gate drivers are set to
+const int DUTYRAWMAX = (1 << DUTYQ) - DUTYRAWMIN; // 99% duty cycle, highest duty the gate drivers are set to
+static_assert(F_CPU/PWMFREQUENCY - 1 <= 255, "Timer2 is 8-bit, the switching frequency needs TOP <= 255");
+// duty cycle dithering
+//  a Q10 duty cycle falls between two timer counts (a count is 6.4 Q10 steps at 100 kHz). With dithering enabled, each
+//  control tick writes the lower or the upper count, carrying the rounding error to the next tick (first-order
+//  sigma-delta), so the duty cycle averaged over a few ticks has the full Q10 resolution. The dither needs the
+//  control timer (initializeInterruptTimer()), and costs a multiply and a register write per tick
+
+// switching-synchronized ADC scan
+//  the Atverter current sensors see the inductor current ripple, which asynchronous samples turn into noise that the
+//  moving averages have to filter out. With setADCScanSync(true), each scan conversion is started from a Timer2
+//  interrupt (the overflow at the start of an on-time, or compare B at the end of a short one), timed so that the ADC
+//  samples the middle of the on-time, where the inductor current equals its average. The ADC clock is set to divide the switching period exactly, so the
+//  sample lands at the same phase every period, and the averaging windows can shrink, e.g. #define SENSOR_I_WINDOW_BS 2
+//  the ADC is only accurate to 10 bits up to a 200 kHz clock, so by default the ADC clock must be 125 kHz (at 16 MHz),
+//  which needs a period of a multiple of 128 CPU cycles, e.g. 62.5 kHz or 31.25 kHz switching. setADCScanSync(true,
+//  true) accepts clocks up to 1 MHz, e.g. 500 kHz at 100 kHz switching, at the cost of about 2 bits of resolution,
+//  which also undoes the gain of oversampling (SENSOR_I_OVERSAMPLE_BITS)
+//  the interrupt waits for the start time only within one ADC clock (8 us at 125 kHz), and otherwise starts the
+//  conversion at once, earlier in the period but still at the same phase every period
+const uint8_t ADCSYNCPRESCALERBSMIN = 7; // fastest synchronized ADC clock, F_CPU >> 7 (125 kHz, within 200 kHz)
+const uint8_t ADCSYNCFASTPRESCALERBSMIN = 4; // fastest ADC clock if fast clocks are allowed, F_CPU >> 4 (1 MHz)
+
+// burst mode
+//  at light load, switching losses dominate, so the converter can switch in bursts with the gates shut down in between
+//  while the output current is below a threshold, the gates shut down once the output voltage reaches vHigh, and switch
+//  again once it falls to vLow. Set vLow < vHigh <= the voltage setpoint, so that the feedback loop keeps the output
+//  between the two. A burst resumes at the duty cycle it left off with, and with the compensator reset (resetComp()).
+//  The burst logic runs at the end of every control tick, and needs the control timer (initializeInterruptTimer())
+enum BurstStates
+{ BURSTDISABLED = 0, // burst mode off
+  BURSTSWITCHING = 1, // switching normally, ready to shut down at light load
+  BURSTIDLE = 2 // gates shut down between bursts
+};
+
+// controller mode manager
+//  a CC-CV converter regulates a voltage (CV) while limiting a current (CC). Rather than switching the error of one
+//  compensator between the two and resetting it, regulate() runs a voltage and a current compensator side by side
+//  and applies the lower of their duty cycles (MINSELECT, both loops limit the duty from above, e.g. charging a
+//  battery) or the higher (MAXSELECT, both limit it from below, e.g. discharging). The loop that loses the selection
+//  has its output back-calculated to the applied duty cycle every tick, so it takes over without a step in the duty
+//  cycle (bumpless transfer), and cannot wind up while the other loop is in control. When not using classical
+//  feedback (e.g. light load), regulate() steps the duty cycle with gradient descent on the error of the selected
+//  loop, and both compensators track the duty cycle for the return to classical feedback.
+//  both errors must ask for a higher duty cycle when positive, e.g. in the .ino file:
+//    atverter.setRegulation(2, MINSELECT); // CV2 and CC2
+//    outputMode = atverter.regulate(vRef - vOut, iRef - iOut, isClassicalFB);
+enum ModeSelects
+{ MINSELECT = 0, // apply the lower duty cycle of the voltage and current loops
+  MAXSELECT = 1 // apply the higher duty cycle of the voltage and current loops
+};
+
 // alternate gate signal pin, usually used for buck or boost modes
 const int ALT_PIN = 8; // PB0
 
@@ -38,6 +104,8 @@ const int VCTRL2_PIN = 7; // PD7
 const int PRORESET_PIN = 5; // PD5
 // gate shutdown diagnostic pin. If HIGH, gate shutdown is latched
 const int GATESD_PIN = 6; // PD6
+const unsigned long GATESHUTDOWNMICROS = 10000; // time the shutdown pin is held low to latch the gate shutdown
+const int PROTECTRESETMICROS = 3000; // default time the reset pin is held high to unlatch the gate shutdown
 
 // pins for voltage, current, and temperature sensing
 const int V1_PIN = A3; // PC3, Terminal 1 voltage
@@ -82,13 +150,27 @@ constexpr int AVERAGE_WINDOW_BS[NUM_SENSORS] = {
   SENSOR_T_WINDOW_BS
 };
 constexpr int AVERAGE_WINDOW_MAX[NUM_SENSORS] = {
-  SENSOR_V_WINDOW_BS*SENSOR_V_WINDOW_BS,
-  SENSOR_V_WINDOW_BS*SENSOR_V_WINDOW_BS,
-  SENSOR_I_WINDOW_BS*SENSOR_I_WINDOW_BS,
-  SENSOR_I_WINDOW_BS*SENSOR_I_WINDOW_BS,
-  SENSOR_T_WINDOW_BS*SENSOR_T_WINDOW_BS,
-  SENSOR_T_WINDOW_BS*SENSOR_T_WINDOW_BS
+  1 << SENSOR_V_WINDOW_BS,
+  1 << SENSOR_V_WINDOW_BS,
+  1 << SENSOR_I_WINDOW_BS,
+  1 << SENSOR_I_WINDOW_BS,
+  1 << SENSOR_T_WINDOW_BS,
+  1 << SENSOR_T_WINDOW_BS
 };
+// oversampling bits for the widened raw accessors, e.g. getWideRawV1(), added to the 10-bit ADC resolution
+//  the moving average sum of 4^n samples decimates to n extra bits, so n can be at most half the window bit-shift
+//    e.g. for 13-bit voltages (about 8 mV per LSB): #define SENSOR_V_WINDOW_BS 6 and #define SENSOR_V_OVERSAMPLE_BITS 3
+//  oversampling relies on the natural noise of the sensors, which must span at least one 10-bit LSB
+//  off (0) by default, so getV1(), RV1 and RALL keep their 10-bit readings unless the sketch opts in
+#ifndef SENSOR_V_OVERSAMPLE_BITS
+#define SENSOR_V_OVERSAMPLE_BITS 0
+#endif
+#ifndef SENSOR_I_OVERSAMPLE_BITS
+#define SENSOR_I_OVERSAMPLE_BITS 0
+#endif
+// sensor moving averages, one channel per SensorIndex
+typedef SensorBank<SENSOR_V_WINDOW_BS, SENSOR_V_WINDOW_BS, SENSOR_I_WINDOW_BS, SENSOR_I_WINDOW_BS,
+  SENSOR_T_WINDOW_BS, SENSOR_T_WINDOW_BS> AtverterSensorBank;
 // moving average sample window length for sensors. Best to use powers of 2 so as to optimize division
 //  use this before #include to override in the .ino file: #define XXX YY
 //  e.g. to set current averaging window to size 32: #define SENSOR_I_WINDOW_MAX 32
@@ -117,6 +199,29 @@ enum DCDCModes
     NUM_DCDCMODES
 };
 
+// DC-DC topology manager
+//  the Atverter converts between terminal 1 and terminal 2 in buck (applyHoldHigh2(), V2 = D*V1), boost
+//  (applyHoldHigh1(), V2 = V1/(1 - D)) or buck-boost (removeHold(), V2 = V1*D/(1 - D)) mode. Buck and boost are nearly
+//  twice as efficient as buck-boost, which is only needed while V1 is close to V2. setDCDCMode() applies the holds of
+//  a mode, seeds the duty cycle that gives the same V2 from the measured V1, clamps the compensators to the duty limits
+//  of the mode, and resets them to the seeded duty cycle, so that V2 does not step across a change (bumpless).
+//  Called every control tick, updateDCDCMode() changes modes as V1 crosses V2 (e.g. an input sag), with hysteresis
+//  bands in percent of V1/V2 (setDCDCThresholds()), see https://www.ti.com/lit/an/slyt765/slyt765.pdf
+//  the duty limits of each mode help the input supply start up, and keep it from collapsing under load
+//  applyHoldHigh1(), applyHoldHigh2() and removeHold() also set the mode, for sketches that pick the holds themselves
+
+// input-voltage feed-forward
+//  a CV loop alone rejects a step of the source voltage only as fast as the compensator, on averaged sensors. With
+//  setFeedForward(terminal, vRefRaw), every control tick computes the ideal duty cycle of the DC-DC mode for the
+//  regulated terminal at vRefRaw and the measured source terminal, and moves the duty cycle and the compensator
+//  output history by its change, so the compensator only trims the remaining error. The feed-forward acts on the
+//  source voltage only (not the measured output, which would feed load steps back with the wrong sign), and runs in
+//  updateCompPast() and regulate(). It is exact for integrating compensators (denominator coefficients summing to 0)
+const uint8_t DCDCTHRESHOLDSDEFAULT[4] = {80, 90, 110, 120}; // V1/V2 % for {buck-boost to boost, boost to buck-boost,
+                                                             //  buck to buck-boost, buck-boost to buck}
+const int DCDCDUTYMINDEFAULT[NUM_DCDCMODES] = {(1 << DUTYQ)/10, DUTYRAWMIN, (1 << DUTYQ)/10}; // 10%, 1%, 10%
+const int DCDCDUTYMAXDEFAULT[NUM_DCDCMODES] = {DUTYRAWMAX, (1 << DUTYQ)*9/10, (1 << DUTYQ)*9/10}; // 99%, 90%, 90%
+
 // output modes enumerator for convenience and bookkeeping
 enum OuputModes
 {   CV1 = 0, // constant voltage control at port 1
@@ -129,6 +234,7 @@ enum OuputModes
 // shutdown error codes for convenience and bookkeeping. user-defined codes start at 4
 enum ShutdownCodes
 {
+  BURSTSHUTDOWN = -2, // shut down between burst mode bursts, not an error; reported as -1, see isBurstIdle()
   // is not shut down = -1
   HARDWARE = 0,
   SOFTWAREUNLABELED = 1,
@@ -137,27 +243,45 @@ enum ShutdownCodes
   NUM_PRESETCODES
 };
 
-// NCP15WF104F03RC thermistor look up table (ADC value, temperature °C)
-const int TTABLE[14][2] = {
-  139, 10,
-  211, 20,
-  301, 30,
-  404, 40,
-  510, 50,
-  612, 60,
-  658, 65,
-  701, 70,
-  740, 75,
-  776, 80,
-  807, 85,
-  835, 90,
-  859, 95,
-  880, 100
+// NCP15WF104F03RC thermistor look up table (ADC value, temperature °C), in flash
+const LookupPoint<int> TTABLE[14] PROGMEM = {
+  {139, 10},
+  {211, 20},
+  {301, 30},
+  {404, 40},
+  {510, 50},
+  {612, 60},
+  {658, 65},
+  {701, 70},
+  {740, 75},
+  {776, 80},
+  {807, 85},
+  {835, 90},
+  {859, 95},
+  {880, 100}
 };
 
 // droop resistance multiplication factor to avoid floating point math (multiple of 2)
 const int RDROOPFACTOR = 1024;
 
+// binary protocol register IDs, each mirroring the ASCII command of the same name (R = readable, W = writable)
+enum AtverterRegisters
+{   BINREG_V1 = 0x01, // R: terminal 1 voltage (mV, unsigned)
+    BINREG_V2, // R: terminal 2 voltage (mV, unsigned)
+    BINREG_I1, // R: terminal 1 current (mA)
+    BINREG_I2, // R: terminal 2 current (mA)
+    BINREG_T1, // R: thermistor 1 temperature (°C)
+    BINREG_T2, // R: thermistor 2 temperature (°C)
+    BINREG_VCC, // R: VCC voltage (mV)
+    BINREG_DUT, // R: duty cycle (0 to 100)
+    BINREG_SDC, // R: gate shutdown code (-1 if gates are not shut down)
+    BINREG_DRP, // RW: droop resistance (mOhm)
+    BINREG_IS1, // W: terminal 1 current shutdown limit (mA)
+    BINREG_IS2, // W: terminal 2 current shutdown limit (mA)
+    BINREG_TSD, // RW: thermal shutdown limit (°C)
+    BINREG_BST // R: 1 while the gates are shut down between burst mode bursts, else 0
+};
+
 class AtverterH : public PicroBoard
 {
   public:
@@ -174,8 +298,26 @@ class AtverterH : public PicroBoard
     void startPWM(int initialDuty); // sets initial duty cycle and enables gate drivers
   // duty cycle
     void setDutyCycle(int dutyCycle); // sets duty cycle (0 to 100)
+    void setDutyCycleRaw(long dutyCycleRaw); // sets duty cycle in Q10 (0 to 1024), e.g. the compensator output
     void setDutyCycleFloat(float dutyCycleFloat); // sets duty cycle (0.0 to 1.0)
     int getDutyCycle(); // gets the current duty cycle (0 to 100)
+    int getDutyCycleRaw(); // gets the current duty cycle in Q10 (0 to 1024)
+    void setDutyDither(bool isEnabled); // spreads the Q10 duty cycle across control ticks
+    bool isDutyDitherEnabled(); // returns true if duty cycle dithering is enabled
+    void updateControlTick() override; // steps burst mode and the duty cycle dither, at the end of every control tick
+    void setSwitchingFrequency(long frequency); // sets the switching frequency (Hz), about 1 kHz to 500 kHz at 16 MHz
+    long getSwitchingFrequency(); // gets the switching frequency (Hz), rounded to the timer resolution
+  // switching-synchronized ADC scan
+    bool setADCScanSync(bool isSynchronized, // samples mid on-time, returns false if the period does not allow it
+      bool isFastClockAllowed = false); // true to accept ADC clocks above 200 kHz, with less resolution
+    bool isADCScanSynchronized(); // returns true if scan conversions are synchronized to the switching period
+    void armADCScanTrigger() override; // starts the selected scan conversion, on the next Timer2 event if synchronized
+    static void pwmSyncEvent(bool isCompareEvent); // called from the Timer2 compare B and overflow interrupts
+  // burst mode
+    void setBurstMode(int terminal, int currentThreshold, // enables light-load burst mode on the output terminal (1 or 2)
+      unsigned int vLow, unsigned int vHigh); // inputs: current threshold (mA), output voltage hysteresis band (mV)
+    void disableBurstMode(); // disables burst mode, and resumes switching if the gates are shut down for a burst
+    bool isBurstIdle(); // returns true while the gates are shut down between bursts
     float getDutyCycleFloat(); // gets the current duty cycle (0.0 to 1.0)
   // alternate drive signal
     void checkBootstrapRefresh(); // check bootstrap counter to see if need to refresh caps
@@ -183,10 +325,20 @@ class AtverterH : public PicroBoard
     void applyHoldHigh1(); // set gate driver 1 to use an always-high alternate signal
     void applyHoldHigh2(); // set gate driver 2 to use an always-high alternate signal
     void removeHold(); // sets both gate drivers to use the primary pwm signal
+  // DC-DC topology manager
+    void setDCDCMode(int mode, int v2Raw); // applies a DCDCModes, and seeds the duty cycle for V2 = v2Raw
+    int updateDCDCMode(int v2Raw); // changes the DCDCModes as V1 crosses v2Raw, returns the DCDCModes
+    int getDCDCMode(); // returns the DCDCModes, or -1 before any hold was applied
+    void setDCDCThresholds(uint8_t toBoost, uint8_t fromBoost, uint8_t fromBuck, uint8_t toBuck); // V1/V2 %
+    void setDCDCDutyLimits(int mode, int dutyMinRaw, int dutyMaxRaw); // sets the Q10 duty limits of a DCDCModes
   // raw sensor values
-    void updateVCC(); // updates stored VCC value based on an average
+    void updateVCC(); // updates stored VCC value based on an average, blocks for ~8 ms (see updateVCCAsync())
+    void applyVCC(int vcc) override; // stores a measured VCC (mV) and updates the conversion scales
     void updateVISensors(); // updates voltage and current sensor averages
     void updateTSensors(); // updates thermistor sensor averages
+    using PicroBoard::startADCScan;
+    void startADCScan(); // samples every sensor from the ADC interrupt instead of blocking reads
+    void updateScanSample(uint8_t sensorIndex, int sample) override; // feeds one scanned sample into the averages
     int readVCC(); // returns the sampled VCC voltage in milliVolts
     int getRawV1(); // gets Terminal 1 voltage ADC value (0 to 1023)
     int getRawV2(); // gets Terminal 2 voltage ADC value (0 to 1023)
@@ -194,6 +346,10 @@ class AtverterH : public PicroBoard
     int getRawI2(); // gets Terminal 2 current ADC value (0 to 1023)
     int getRawT1(); // gets Thermistor 1 ADC value (0 to 1023)
     int getRawT2(); // gets Thermistor 1 ADC value (0 to 1023)
+    int getWideRawV1(); // gets oversampled Terminal 1 voltage (0 to 1023 << SENSOR_V_OVERSAMPLE_BITS)
+    int getWideRawV2(); // gets oversampled Terminal 2 voltage (0 to 1023 << SENSOR_V_OVERSAMPLE_BITS)
+    int getWideRawI1(); // gets oversampled Terminal 1 current (-512 to 512 << SENSOR_I_OVERSAMPLE_BITS)
+    int getWideRawI2(); // gets oversampled Terminal 2 current (-512 to 512 << SENSOR_I_OVERSAMPLE_BITS)
   // fully-formatted sensors
     int getVCC(); // returns the averaged VCC value
     unsigned int getV1(); // returns the averaged V1 mV value
@@ -210,19 +366,19 @@ class AtverterH : public PicroBoard
     void shutdownGates(); // immediately triggers the gate shutdown
     void shutdownGates(int errorCode); // immediately triggers the gate shutdown
     bool isGateShutdown(); // returns true if the gate shutdown signal is currently latched
-    int getShutdownCode(); // returns the appropriate shutdown code, or -1 if gates not shutdown
+    int getShutdownCode(); // returns the appropriate shutdown code, or -1 if gates not shutdown (or burst idle)
     void setCurrentShutdown1(int current); // sets the terminal 1 current shutoff limit in mA, max 7500 mA
     void setCurrentShutdown2(int current); // sets the terminal 2 current shutoff limit in mA, max 7500 mA
     void checkCurrentShutdown(); // checks if last sensed current is greater than current limit
     void setThermalShutdown(int temperature); // sets the upper temperature shutoff in °C
     void checkThermalShutdown(); // checks if last sensed current is greater than thermal limit
   // conversion utility functions
-    unsigned int raw2mV(int raw); // converts ADC reading to mV voltage scaled by resistor divider
-    int raw2mVADC(int raw); // converts ADC reading to mV voltage at ADC
-    int raw2mA(int raw); // converts raw ADC current sense output to mA
+    unsigned int raw2mV(int raw, uint8_t extraBits = 0); // converts ADC reading (10 + extraBits wide) to mV voltage scaled by resistor divider
+    int raw2mVADC(int raw, uint8_t extraBits = 0); // converts ADC reading (10 + extraBits wide) to mV voltage at ADC
+    int raw2mA(int raw, uint8_t extraBits = 0); // converts raw ADC current sense output (10 + extraBits wide) to mA
     int raw2degC(int raw); // converts raw ADC current sense output to °C
-    int mV2raw(unsigned int mV); // converts a mV value to raw 10-bit form
-    int mA2raw(int mA); // converts a mA value to raw 10-bit form
+    int mV2raw(unsigned int mV, uint8_t extraBits = 0); // converts a mV value to raw (10 + extraBits)-bit form
+    int mA2raw(int mA, uint8_t extraBits = 0); // converts a mA value to raw (10 + extraBits)-bit form
   // droop resistance conversions
     void setRDroop(int mOhm); // sets the stored droop resistance
     int getRDroop(); // gets the stored droop resistance, reported as a mOhm value
@@ -230,52 +386,100 @@ class AtverterH : public PicroBoard
     int getVDroopRaw(int iOut); // get the droop voltage as (droop resistance)*(output current)
   // compensation for classical feedback
     void setComp(int num[], int den[], int numSize, int denSize); // set discrete compensator coefficients
+    void setCompSections(const CompSection* sections, int length, uint8_t shift); // set a cascade of biquads instead
+    void setCompCurrent(int num[], int den[], int numSize, int denSize); // set different current loop coefficients
+    void setCompLimits(int outputMin, int outputMax); // clamps the compensator output (Q10 duty, 1% to 99% by default)
     void updateCompPast(int inputNow); // update past compensator inputs and outputs
     long calculateCompOut(); // returns compensator output for classical feedback discrete compensation
     void resetComp(); // resets the compensator past values when switching between CV and CC
+  // controller mode manager
+    void setRegulation(int terminal, int modeSelect); // sets the regulated terminal and ModeSelects for regulate()
+    int regulate(int vError, int iError, bool isClassical); // runs CV and CC together, returns the OutputModes in control
+    int getOutputMode(); // returns the OutputModes in control at the last regulate()
+  // input-voltage feed-forward
+    void setFeedForward(int terminal, int vRefRaw); // feeds the other terminal's voltage forward, terminal at vRefRaw
+    void disableFeedForward(); // turns the feed-forward off
+    bool isFeedForwardEnabled(); // returns true if the feed-forward is on
   // gradient descent functions
     void setGradDescCountMax(int settlingCount, int averagingCount); // set the gd counter max, controls gd speed
     void triggerGradDescStep(); // set gradient descent to step next call to gradDescStep()
     void gradDescStep(int error); // steps duty cycle based on the sign of the error 
   // communications
-    void interpretRXCommand(char* command, char* value, int receiveProtocol) override; // process RX command
+    bool readRegister(uint8_t reg, int* value) override; // reads a binary protocol register
+    bool writeRegister(uint8_t reg, int value) override; // writes a binary protocol register
   // legacy functions
-    void initializePWMTimer(); // not needed with FastPWM library
+    void initializePWMTimer(); // sets up Timer2 for the PWM pin, called by the first duty cycle update
   private:
     // switch operation
-    int _dutyCycle = 50; // the most recently set duty cycle (0 to 100)
+    int _dutyCycleRaw = 1 << (DUTYQ - 1); // the most recently set duty cycle in Q10 (0 to 1024)
+    bool _isPWMTimerInitialized = false; // true once Timer2 drives the PWM pin
+    uint16_t _pwmPeriodCounts = F_CPU/PWMFREQUENCY; // Timer2 counts per switching period, TOP + 1
+    uint8_t _pwmPrescalerIndex = 0; // index into PWMPRESCALERSHIFTS of the Timer2 prescaler
+    uint8_t counts2Compare(uint16_t counts); // converts timer counts of high output to the OCR2B compare value
+    bool _isDutyDitherEnabled = false; // true to dither the duty cycle across control ticks
+    uint16_t _dutyDitherError = 0; // rounding error carried to the next tick, in Q10 timer counts
+    // switching-synchronized ADC scan
+    bool _isADCScanSynchronized = false; // if true, scan conversions start from the Timer2 interrupts
+    bool _isADCSyncFastClockAllowed = false; // if true, the synchronized ADC clock may exceed 200 kHz
+    static volatile uint16_t _adcSyncDelayCounts; // timer counts from a conversion start to its sample, within a period
+    static volatile uint8_t _adcSyncWaitMaxCounts; // longest wait for a start count in the interrupt, one ADC clock
+    // burst mode
+    volatile uint8_t _burstState = BURSTDISABLED; // BurstStates
+    bool _isBurstOnTerminal2 = true; // output terminal of burst mode, terminal 2 if true else terminal 1
+    int _burstCurrentThreshold_mA = 0; // output current below which the converter bursts
+    unsigned int _burstVLow_mV = 0; // output voltage at which a burst starts
+    unsigned int _burstVHigh_mV = 0; // output voltage at which a burst ends
+    int _burstCurrentRaw = 0; // _burstCurrentThreshold_mA in raw form, cached by updateBurstThresholds()
+    int _burstVLowRaw = 0; // _burstVLow_mV in raw form, cached by updateBurstThresholds()
+    int _burstVHighRaw = 0; // _burstVHigh_mV in raw form, cached by updateBurstThresholds()
+    int _burstDutyCycleRaw = 0; // duty cycle when the last burst ended, restored when the next one starts
+    void updateBurstThresholds(); // converts the burst thresholds to raw form, after a VCC update
+    void updateBurst(); // steps burst mode, once per control tick
+    void startBurst(); // enables the gate drivers at the duty cycle the last burst ended with
     long _bootstrapCounter = 0; // counter to refresh the gate driver bootstrap caps
     long _bootstrapCounterMax; // reset value for bootstrap counter
     // sensors and averaging
-    int _sensorAverages[NUM_SENSORS]; // array raw sensor moving averages
-    long _sensorAccumulators[NUM_SENSORS];
-    int _sensorIterators[NUM_SENSORS];
-    int _sensorPastV1[AVERAGE_WINDOW_MAX[V1_INDEX]]; // array raw sensor moving averages
-    int _sensorPastV2[AVERAGE_WINDOW_MAX[V2_INDEX]]; // array raw sensor moving averages
-    int _sensorPastI1[AVERAGE_WINDOW_MAX[I1_INDEX]]; // array raw sensor moving averages
-    int _sensorPastI2[AVERAGE_WINDOW_MAX[I2_INDEX]]; // array raw sensor moving averages
-    int _sensorPastT1[AVERAGE_WINDOW_MAX[T1_INDEX]]; // array raw sensor moving averages
-    int _sensorPastT2[AVERAGE_WINDOW_MAX[T2_INDEX]]; // array raw sensor moving averages
+    AtverterSensorBank _sensors; // raw sensor moving averages
     int _vcc; // stored value of vcc measured at start up and/or periodically
+    long _raw2mVScale; // VCC*13, cached by updateConversionScales()
+    long _raw2mAScale; // VCC*3, cached by updateConversionScales()
+    long _mV2rawScale; // 2^(10 + MV2RAW_Q)/(13*VCC), cached by updateConversionScales()
+    long _mA2rawScale; // 341*2^MA2RAW_Q/VCC, cached by updateConversionScales()
+    void updateConversionScales(); // caches the VCC-dependent conversion factors
     int _currentLimitAmplitudeRaw1 = 444; // the upper raw (0 to 1023) current limit before gate shutoff
     int _currentLimitAmplitudeRaw2 = 444; // the upper raw (0 to 1023) current limit before gate shutoff
     int _thermalLimitC = 80; // the upper °C thermal limit before gate shutoff
     // convenience variables for controls and compensation
     long _rDroop = 0; // stored droop resistance value
-    int _compIn[8] = {0,0,0,0,0,0,0,0}; // compensator input values (raw 0-1023), current to oldest 
-    int _compOut[8] = {0,0,0,0,0,0,0,0}; // compensator output values (raw 0-1023), current to oldest 
-    int *_compNum; // discrete compensation difference equation numerator
-    int *_compDen; // discrete compensation difference equation denominator
-    int _compNumSize; // length of compensator numerator
-    int _compDenSize; // length of compensator denominator
+    Compensator _comp; // classical feedback compensator, input in raw units and output in Q10 duty cycle
+    Compensator _compCurrent; // current loop compensator of regulate(), same coefficients as _comp unless set apart
+    bool _isRegulationOnTerminal2 = true; // regulated terminal of regulate(), terminal 2 if true else terminal 1
+    uint8_t _modeSelect = MINSELECT; // ModeSelects of regulate()
+    bool _isCurrentControlled = false; // true if the current loop won the last regulate() selection
+    int _dutyLimitMin = DUTYRAWMIN; // lowest compensator and gradient descent duty cycle, set by setCompLimits()
+    int _dutyLimitMax = DUTYRAWMAX; // highest compensator and gradient descent duty cycle, set by setCompLimits()
+    // DC-DC topology manager
+    int8_t _dcdcMode = -1; // DCDCModes of the applied holds, -1 if none
+    uint8_t _dcdcThresholds[4] = {DCDCTHRESHOLDSDEFAULT[0], DCDCTHRESHOLDSDEFAULT[1],
+      DCDCTHRESHOLDSDEFAULT[2], DCDCTHRESHOLDSDEFAULT[3]}; // V1/V2 % mode change thresholds, see DCDCTHRESHOLDSDEFAULT
+    int _dcdcDutyMin[NUM_DCDCMODES] = {DCDCDUTYMINDEFAULT[0], DCDCDUTYMINDEFAULT[1],
+      DCDCDUTYMINDEFAULT[2]}; // lowest duty cycle of each DCDCModes
+    int _dcdcDutyMax[NUM_DCDCMODES] = {DCDCDUTYMAXDEFAULT[0], DCDCDUTYMAXDEFAULT[1],
+      DCDCDUTYMAXDEFAULT[2]}; // highest duty cycle of each DCDCModes
+    long idealDutyRaw(int mode, long v1, long v2); // Q10 duty cycle of a DCDCModes that converts v1 to v2
+    // input-voltage feed-forward
+    int8_t _feedForwardTerminal = 0; // regulated terminal (1 or 2), 0 if the feed-forward is off
+    int _feedForwardVRefRaw = 0; // regulated terminal voltage the feed-forward duty cycle is computed for
+    int _feedForwardVSourceRaw = -1; // source terminal voltage of the last feed-forward duty cycle, -1 to start over
+    int8_t _feedForwardMode = -1; // DCDCModes of the last feed-forward duty cycle
+    int _feedForwardDutyRaw = 0; // last feed-forward duty cycle (Q10)
+    void updateFeedForward(); // moves the duty cycle and compensators by the feed-forward change, once per tick
     int _gradDescCount = 0; // counter for gradient descent contorllers to control step speed
-    int _gradDescSettleMax = SENSOR_V_WINDOW_BS*SENSOR_V_WINDOW_BS; // gd counter max, controls step speed, hold during 1st period
-    int _gradDescAverageMax = SENSOR_V_WINDOW_BS*SENSOR_V_WINDOW_BS; // gd counter max, controls step speed, average during 2nd period
+    int _gradDescSettleMax = AVERAGE_WINDOW_MAX[V1_INDEX]; // gd counter max, controls step speed, hold during 1st period
+    int _gradDescAverageMax = AVERAGE_WINDOW_MAX[V1_INDEX]; // gd counter max, controls step speed, average during 2nd period
     int _gradDescErrorAcc = 0; // error accumulator for gradient descent averaging
     // diagnostics
     int _shutdownCode = 0;
-    // functions
-    void updateSensorRaw(int index, int sample); // updates the raw averaged sensor value
 };
 
 #endif
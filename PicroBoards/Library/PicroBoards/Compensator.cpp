@@ -0,0 +1,133 @@
+/*
+  Compensator.cpp - Fixed-point discrete compensator for PicroBoard control loops
+  Released into the public domain.
+*/
+
+#include "Compensator.h"
+
+// sets the difference equation coefficients, see Compensator.h
+//  the arrays are used in place, so a sketch may change them later, followed by another setCoefficients()
+void Compensator::setCoefficients(const int* num, const int* den, uint8_t numSize, uint8_t denSize) {
+  _num = num;
+  _den = den;
+  _numSize = min(numSize, COMPHISTORYLENGTH);
+  _denSize = min(denSize, COMPHISTORYLENGTH);
+  _sections = NULL;
+  _sectionsLength = 0;
+  _denShift = 0;
+  while (_denShift < 14 && (1 << _denShift) < den[0])
+    _denShift++;
+  _isDenPowerOf2 = (den[0] == (1 << _denShift));
+}
+
+// sets a cascade of second-order sections, each normalized to a0 = 2^shift, replacing the difference equation
+void Compensator::setSections(const CompSection* sections, uint8_t length, uint8_t shift) {
+  _sections = sections;
+  _sectionsLength = min(length, COMPSECTIONSMAX);
+  _sectionsShift = shift;
+  memset(_sectionStates, 0, sizeof(_sectionStates));
+}
+
+// clamps the output, and the output history, to outputMin-outputMax
+void Compensator::setLimits(int outputMin, int outputMax) {
+  _outputMin = outputMin;
+  _outputMax = outputMax;
+}
+
+// pushes the input right now, x[n], moving the ring head so that the previous x[n] and y[n] become x[n-1] and y[n-1]
+//  call this every control tick, even while another control mode sets the output, so that the history stays current
+void Compensator::update(int input) {
+  _head = (_head - 1) & (COMPHISTORYLENGTH - 1);
+  _in[_head] = input;
+  _out[_head] = _out[(_head + 1) & (COMPHISTORYLENGTH - 1)]; // hold y[n-1] until calculate()
+}
+
+// returns the output y[n], clamped to the limits, and stores it as the newest output history
+int Compensator::calculate() {
+  long acc = 0;
+  if (_sections != NULL) {
+    int x = _in[_head];
+    for (uint8_t s = 0; s < _sectionsLength; s++) {
+      const CompSection* section = &_sections[s];
+      int* state = _sectionStates[s];
+      acc = (long)section->b0*x + (long)section->b1*state[0] + (long)section->b2*state[1]
+        - (long)section->a1*state[2] - (long)section->a2*state[3];
+      acc = acc >> _sectionsShift;
+      int y = (s == _sectionsLength - 1) ? clampOutput(acc) : (int)constrain(acc, -32767L, 32767L);
+      state[1] = state[0];
+      state[0] = x;
+      state[3] = state[2];
+      state[2] = y;
+      x = y;
+    }
+    _out[_head] = x;
+    return x;
+  }
+  if (_num == NULL || _den == NULL)
+    return _out[_head];
+  uint8_t index = _head;
+  for (uint8_t n = 0; n < _numSize; n++) { // weighted inputs, A*x[n] + B*x[n-1] + ...
+    acc += (long)_in[index]*_num[n];
+    index = (index + 1) & (COMPHISTORYLENGTH - 1);
+  }
+  index = _head;
+  for (uint8_t n = 1; n < _denSize; n++) { // weighted past outputs, - E*y[n-1] - F*y[n-2] - ...
+    index = (index + 1) & (COMPHISTORYLENGTH - 1);
+    acc -= (long)_out[index]*_den[n];
+  }
+  if (_isDenPowerOf2)
+    acc = acc >> _denShift;
+  else
+    acc = acc/_den[0];
+  _out[_head] = clampOutput(acc);
+  return _out[_head];
+}
+
+// clears the input history, and sets the output history to output, e.g. the duty cycle when switching control modes
+void Compensator::reset(int output) {
+  output = clampOutput(output);
+  for (uint8_t n = 0; n < COMPHISTORYLENGTH; n++) {
+    _in[n] = 0;
+    _out[n] = output;
+  }
+  memset(_sectionStates, 0, sizeof(_sectionStates));
+  if (_sectionsLength > 0) { // the integrator in the last section holds the output
+    _sectionStates[_sectionsLength - 1][2] = output;
+    _sectionStates[_sectionsLength - 1][3] = output;
+  }
+}
+
+// overrides y[n], e.g. with the duty cycle set by gradient descent, for a smooth return to the compensator
+void Compensator::setOutput(int output) {
+  output = clampOutput(output);
+  _out[_head] = output;
+  if (_sectionsLength > 0)
+    _sectionStates[_sectionsLength - 1][2] = output;
+}
+
+// adds delta to the whole output history (clamped), so that an integrating compensator continues from its output plus
+//  delta, e.g. when a feed-forward term moves the operating point. Exact if the denominator coefficients sum to 0
+//  (an integrator), or for sections, if the last section holds the integrator
+void Compensator::shiftOutput(int delta) {
+  for (uint8_t n = 0; n < COMPHISTORYLENGTH; n++)
+    _out[n] = clampOutput((long)_out[n] + delta);
+  if (_sectionsLength > 0) {
+    int* state = _sectionStates[_sectionsLength - 1];
+    state[2] = clampOutput((long)state[2] + delta);
+    state[3] = clampOutput((long)state[3] + delta);
+  }
+}
+
+// returns the latest output y[n]
+int Compensator::getOutput() {
+  return _out[_head];
+}
+
+// clamps an output to the limits
+int Compensator::clampOutput(long output) {
+  if (output < _outputMin)
+    return _outputMin;
+  if (output > _outputMax)
+    return _outputMax;
+  return (int)output;
+}
@@ -0,0 +1,67 @@
+/*
+  Compensator.h - Fixed-point discrete compensator for PicroBoard control loops
+  Released into the public domain.
+*/
+
+#ifndef Compensator_h
+#define Compensator_h
+
+#include "Arduino.h"
+
+// a Compensator runs a discrete transfer function once per control tick, in integer math
+//  difference equation form: num = {A, B, C}, den = {D, E, F}, x = input, y = output
+//    D*y[n] + E*y[n-1] + F*y[n-2] = A*x[n] + B*x[n-1] + C*x[n-2]
+//  D must be a power of 2 (e.g. compensation.py scales the coefficients by 8), so that the division is a shift
+//  the past inputs and outputs live in ring buffers with a moving head, so update() writes one value instead of
+//  shifting the whole history
+//  the output is clamped to setLimits(), and the clamped value is what enters the output history. An integrating
+//  compensator therefore cannot wind up past the limits (e.g. while the duty cycle is saturated), and resumes
+//  regulating as soon as the error changes sign
+//  higher-order designs can run as a cascade of second-order sections instead (setSections()), which keeps the
+//  coefficients small; put the integrator (pole at z = 1) in the last section, whose output is clamped
+//  e.g. in the .ino file:
+//    int compNum [] = {12, -10, 0};
+//    int compDen [] = {8, -12, 4};
+//    atverter.setComp(compNum, compDen, 3, 3);
+const uint8_t COMPHISTORYLENGTH = 8; // history ring length, the most coefficients per polynomial, a power of 2
+const uint8_t COMPSECTIONSMAX = 4; // the most second-order sections in a cascade
+
+// one second-order section of a cascade, y[n] = (b0*x[n] + b1*x[n-1] + b2*x[n-2] - a1*y[n-1] - a2*y[n-2]) >> shift
+//  i.e. a0 = 2^shift, shared by all sections of a cascade
+struct CompSection
+{   int b0, b1, b2; // numerator coefficients
+    int a1, a2; // denominator coefficients
+};
+
+class Compensator
+{
+  public:
+    void setCoefficients(const int* num, const int* den, uint8_t numSize, uint8_t denSize); // difference equation
+    void setSections(const CompSection* sections, uint8_t length, uint8_t shift); // cascade of second-order sections
+    void setLimits(int outputMin, int outputMax); // clamps the output, and the output history
+    void update(int input); // pushes the input right now, x[n], call once per control tick
+    int calculate(); // returns the clamped output y[n]
+    void reset(int output); // clears the input history, and sets the output history to output
+    void setOutput(int output); // overrides y[n], e.g. with the duty cycle of another control mode
+    void shiftOutput(int delta); // adds delta to the output history, e.g. a feed-forward step
+    int getOutput(); // returns the latest output y[n]
+  private:
+    const int* _num = NULL; // difference equation numerator
+    const int* _den = NULL; // difference equation denominator
+    uint8_t _numSize = 0; // length of _num
+    uint8_t _denSize = 0; // length of _den
+    uint8_t _denShift = 0; // log2(_den[0])
+    bool _isDenPowerOf2 = true; // if false, divides by _den[0], for coefficients that predate the shift
+    const CompSection* _sections = NULL; // cascade of second-order sections, used instead of _num and _den if set
+    uint8_t _sectionsLength = 0; // number of sections in _sections
+    uint8_t _sectionsShift = 0; // log2(a0) of every section
+    int _sectionStates [COMPSECTIONSMAX][4]; // x[n-1], x[n-2], y[n-1], y[n-2] of each section
+    int _in [COMPHISTORYLENGTH]; // past inputs, _in[_head] is x[n]
+    int _out [COMPHISTORYLENGTH]; // past outputs, _out[_head] is y[n]
+    uint8_t _head = 0; // ring index of x[n] and y[n]
+    int _outputMin = -32767; // lowest output
+    int _outputMax = 32767; // highest output
+    int clampOutput(long output); // clamps an output to the limits
+};
+
+#endif
@@ -0,0 +1,103 @@
+/*
+  LookupTable.h - Piecewise-linear curves stored in flash, shared by all PicroBoards
+  Released into the public domain.
+*/
+
+#ifndef LookupTable_h
+#define LookupTable_h
+
+#include "Arduino.h"
+#include <avr/pgmspace.h>
+
+// a lookup table interpolates a curve between breakpoints stored in flash (PROGMEM), so the curve costs no RAM
+//  queries outside the table saturate at the first or last y value
+//  x values are 16-bit, either int or unsigned int (e.g. mV up to 65535), and y values are int
+//  LookupTable takes breakpoints at any spacing and finds the segment with a binary search (log2(N) steps)
+//  UniformLookupTable takes y values spaced 2^stepShift apart in x, and finds the segment in O(1) with no division
+//  e.g. in the .ino file:
+//    const LookupPoint<unsigned int> CURVE[3] PROGMEM = {{10000, 0}, {12000, 50}, {12600, 100}};
+//    LookupTable<unsigned int> curve(CURVE, 3);
+//    int y = curve.lookup(11000); // 25
+
+// breakpoint of a LookupTable, sorted by increasing x
+template <typename X> struct LookupPoint
+{   X x;
+    int y;
+};
+
+template <typename X = int>
+class LookupTable
+{
+  public:
+    static_assert(sizeof(X) == sizeof(int), "lookup table x values must be int or unsigned int");
+
+    constexpr LookupTable(const LookupPoint<X>* points, uint8_t length) : _points(points), _length(length) {}
+
+    // interpolates the curve at x
+    int lookup(X x) const {
+      if (x <= getX(0))
+        return getY(0);
+      if (x >= getX(_length - 1))
+        return getY(_length - 1);
+      uint8_t low = 0; // invariant: getX(low) < x < getX(high)
+      uint8_t high = _length - 1;
+      while (high - low > 1) {
+        uint8_t middle = (low + high) >> 1;
+        X xMiddle = getX(middle);
+        if (x < xMiddle)
+          high = middle;
+        else if (x > xMiddle)
+          low = middle;
+        else
+          return getY(middle);
+      }
+      X x0 = getX(low);
+      int y0 = getY(low);
+      return y0 + (int)((long)(getY(high) - y0)*(long)(x - x0)/(long)(getX(high) - x0));
+    }
+
+    uint8_t getLength() const { return _length; }
+
+  private:
+    X getX(uint8_t n) const { return (X)pgm_read_word(&_points[n].x); }
+    int getY(uint8_t n) const { return (int)pgm_read_word(&_points[n].y); }
+
+    const LookupPoint<X>* _points; // breakpoints in flash
+    uint8_t _length; // number of breakpoints, at least 2
+};
+
+template <typename X = int>
+class UniformLookupTable
+{
+  public:
+    static_assert(sizeof(X) == sizeof(int), "lookup table x values must be int or unsigned int");
+
+    // ys holds the curve at x0, x0 + 2^stepShift, x0 + 2*2^stepShift, ...
+    constexpr UniformLookupTable(const int* ys, uint8_t length, X x0, uint8_t stepShift) :
+      _ys(ys), _length(length), _x0(x0), _stepShift(stepShift) {}
+
+    // interpolates the curve at x
+    int lookup(X x) const {
+      if (x <= _x0)
+        return getY(0);
+      unsigned int offset = (unsigned int)x - (unsigned int)_x0;
+      unsigned int n = offset >> _stepShift;
+      if (n >= _length - 1)
+        return getY(_length - 1);
+      int y0 = getY(n);
+      unsigned int fraction = offset & ((1U << _stepShift) - 1);
+      return y0 + (int)(((long)(getY(n + 1) - y0)*fraction) >> _stepShift);
+    }
+
+    uint8_t getLength() const { return _length; }
+
+  private:
+    int getY(unsigned int n) const { return (int)pgm_read_word(&_ys[n]); }
+
+    const int* _ys; // y values in flash
+    uint8_t _length; // number of y values, at least 2
+    X _x0; // x of the first y value
+    uint8_t _stepShift; // x spacing between y values, as a bit-shift
+};
+
+#endif
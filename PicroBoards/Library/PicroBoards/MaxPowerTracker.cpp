@@ -0,0 +1,202 @@
+/*
+  MaxPowerTracker.cpp - Maximum power point tracking for PicroBoard solar converters
+  Released into the public domain.
+*/
+
+#include "MaxPowerTracker.h"
+
+// sets the tracking method, MPPTPERTURBOBSERVE or MPPTINCCOND
+void MaxPowerTracker::setMode(uint8_t mode) {
+  _mode = mode;
+  _hasPrevious = false;
+}
+
+// sets the ticks to wait after each step, for the converter and the sensor averages to settle, and the number of
+//  samples (2^windowBS) to average per decision
+void MaxPowerTracker::setTiming(unsigned int settleTicks, uint8_t windowBS) {
+  _settleTicks = settleTicks;
+  _windowBS = min(windowBS, MPPTWINDOWBSMAX);
+  reset();
+}
+
+// sets the smallest and largest duty cycle step of the adaptive step size
+void MaxPowerTracker::setStepLimits(int stepMin, int stepMax) {
+  _stepMin = max(stepMin, 1);
+  _stepMax = max(stepMax, _stepMin);
+  _step = constrain(_step, _stepMin, _stepMax);
+}
+
+// sets the range of the returned duty cycle, which is also the range of a global sweep
+void MaxPowerTracker::setDutyLimits(int dutyMin, int dutyMax) {
+  _dutyMin = dutyMin;
+  _dutyMax = dutyMax;
+}
+
+// sets whether a higher duty cycle raises the source voltage (true) or lowers it (false)
+//  e.g. false for a solar panel at the input of a boost or a buck converter, which draw more current at higher duty
+void MaxPowerTracker::setDutyDirection(bool isDutyRaisingVoltage) {
+  _voltageDutySign = isDutyRaisingVoltage ? 1 : -1;
+}
+
+// curtails the power to powerRef (raw V*I), e.g. for a power limit or a bus over-voltage
+void MaxPowerTracker::setPowerReference(long powerRef) {
+  _powerRef = powerRef;
+}
+
+// sweeps the duty cycle limits in steps of sweepStep every sweepPeriod decisions, or never if sweepPeriod is 0
+void MaxPowerTracker::setSweep(unsigned int sweepPeriod, int sweepStep) {
+  _sweepPeriod = sweepPeriod;
+  _sweepStep = max(sweepStep, 1);
+  _decisionCount = 0;
+}
+
+// sweeps the duty cycle from the next decision on, e.g. from a sketch timer, or after a large drop in power
+void MaxPowerTracker::startSweep() {
+  _isSweepPending = true;
+}
+
+// takes a voltage and current sample of the source, and returns the duty cycle to apply
+//  duty is the duty cycle applied right now, returned unchanged except at a decision
+int MaxPowerTracker::update(int v, int i, int duty) {
+  if (_tickCount < _settleTicks) { // let the converter and the sensor averages settle after the last step
+    _tickCount++;
+    return duty;
+  }
+  _powerAcc += (long)v*i;
+  _vAcc += v;
+  _iAcc += i;
+  _sampleCount++;
+  if (_sampleCount < (1U << _windowBS))
+    return duty;
+  long power = _powerAcc >> _windowBS;
+  int vAverage = _vAcc >> _windowBS;
+  int iAverage = _iAcc >> _windowBS;
+  _powerAcc = 0;
+  _vAcc = 0;
+  _iAcc = 0;
+  _sampleCount = 0;
+  _tickCount = 0;
+
+  if (_isSweepPending) { // start the sweep at the low duty limit
+    _isSweepPending = false;
+    _isSweeping = true;
+    _sweepBestPower = -1;
+    _power = power;
+    return _dutyMin;
+  }
+  if (_isSweeping)
+    duty = sweep(power, duty);
+  else {
+    duty = track(power, vAverage, iAverage, duty);
+    _decisionCount++;
+    if (_sweepPeriod > 0 && _decisionCount >= _sweepPeriod) {
+      _decisionCount = 0;
+      _isSweepPending = true;
+    }
+  }
+  _power = power;
+  _v = vAverage;
+  _i = iAverage;
+
+  if (duty <= _dutyMin) { // bounce off the duty cycle limits, rather than pushing against them
+    duty = _dutyMin;
+    _direction = 1;
+  } else if (duty >= _dutyMax) {
+    duty = _dutyMax;
+    _direction = -1;
+  }
+  return duty;
+}
+
+// one tracking decision on the averaged power, voltage and current, returns the new duty cycle
+int MaxPowerTracker::track(long power, int v, int i, int duty) {
+  int8_t direction; // duty cycle step direction, 0 to hold
+  _isCurtailing = power > _powerRef;
+  if (_isCurtailing) { // step toward higher source voltage until the power falls to the reference
+    direction = _voltageDutySign;
+  } else if (!_hasPrevious) { // nothing to compare with yet, take a first step
+    _hasPrevious = true;
+    direction = _direction;
+  } else if (_mode == MPPTINCCOND) {
+    int dV = v - _v;
+    int dI = i - _i;
+    long dP = (long)i*dV + (long)v*dI; // V*I - V'*I', to first order
+    int8_t voltageDirection; // 1 to raise the source voltage, -1 to lower it, 0 to hold
+    if (abs(dP) <= ((long)abs(dV)*abs(i) >> MPPTINCCONDTOLERANCEBS))
+      voltageDirection = 0; // at the maximum power point, |dP/dV| is within I/2^MPPTINCCONDTOLERANCEBS of 0
+    else if (dV == 0)
+      voltageDirection = (dI > 0) ? 1 : -1; // the irradiance changed, and the maximum power voltage with it
+    else
+      voltageDirection = ((dP > 0) == (dV > 0)) ? 1 : -1; // climb dP/dV
+    direction = voltageDirection*_voltageDutySign;
+  } else { // perturb and observe
+    direction = (power >= _power) ? _direction : -_direction;
+  }
+
+  // shrink the step on a reversal or a hold, near the maximum power point. Grow it only after MPPTSTEPSTREAK steps in
+  //  the same direction, far from the maximum, so that the oscillation around the maximum never grows it
+  if (direction == 0 || direction != _direction) {
+    _step = max(_step >> 1, _stepMin);
+    _stepStreak = 0;
+  } else if (_stepStreak < MPPTSTEPSTREAK) {
+    _stepStreak++;
+  } else {
+    _step = min(_step << 1, _stepMax);
+  }
+  if (direction == 0)
+    return duty;
+  _direction = direction;
+  return duty + direction*_step;
+}
+
+// one sweep decision, records the power at the duty cycle applied during the average, and steps up to the next one
+//  ends at the duty cycle with the most power, or early if the power exceeds the power reference
+int MaxPowerTracker::sweep(long power, int duty) {
+  if (power > _sweepBestPower) {
+    _sweepBestPower = power;
+    _sweepBestDuty = duty;
+  }
+  if (power > _powerRef || duty >= _dutyMax) {
+    _isSweeping = false;
+    _hasPrevious = false;
+    _step = _stepMin;
+    return (power > _powerRef) ? duty : _sweepBestDuty;
+  }
+  return min(duty + _sweepStep, _dutyMax);
+}
+
+// restarts tracking and averaging, e.g. after reconnecting the source or changing the timing
+void MaxPowerTracker::reset() {
+  _tickCount = 0;
+  _sampleCount = 0;
+  _powerAcc = 0;
+  _vAcc = 0;
+  _iAcc = 0;
+  _hasPrevious = false;
+  _step = _stepMin;
+  _stepStreak = 0;
+  _isCurtailing = false;
+  _isSweeping = false;
+  _isSweepPending = false;
+  _decisionCount = 0;
+}
+
+// returns the averaged power (raw V*I) of the last decision
+long MaxPowerTracker::getPower() {
+  return _power;
+}
+
+// returns the current step size of the adaptive step
+int MaxPowerTracker::getStep() {
+  return _step;
+}
+
+// returns true during a global sweep
+bool MaxPowerTracker::isSweeping() {
+  return _isSweeping;
+}
+
+// returns true if the last decision curtailed the power to the power reference
+bool MaxPowerTracker::isCurtailing() {
+  return _isCurtailing;
+}
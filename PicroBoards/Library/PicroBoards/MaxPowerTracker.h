@@ -0,0 +1,95 @@
+/*
+  MaxPowerTracker.h - Maximum power point tracking for PicroBoard solar converters
+  Released into the public domain.
+*/
+
+#ifndef MaxPowerTracker_h
+#define MaxPowerTracker_h
+
+#include "Arduino.h"
+
+// a MaxPowerTracker steps a duty cycle toward the maximum power point of a source such as a solar panel
+//  call update() once per control tick with the source voltage and current (raw). After settleTicks ticks, it
+//  averages 2^windowBS samples, and then makes one decision: it returns the duty cycle to apply, stepped by its
+//  adaptive step size. Between decisions, update() returns the duty cycle it is given
+//  two tracking methods (MPPTModes):
+//    perturb and observe: keep stepping in the same direction while the power rises, reverse when it falls
+//    incremental conductance: step toward the voltage where dP/dV = I + V*dI/dV = 0, and hold once |dP/dV| is within
+//    I/2^MPPTINCCONDTOLERANCEBS of 0, so that the duty cycle sits still at steady state
+//  adaptive step size: the step doubles (up to stepMax) while the steps keep going in the same direction (after
+//  MPPTSTEPSTREAK steps), and halves
+//  (down to stepMin) on a reversal or a hold, so tracking after a step change (e.g. a cloud edge) is fast, while the
+//  steady-state oscillation around the maximum power point is only a stepMin wide
+//  curtailment: while the averaged power exceeds the power reference (setPowerReference()), the tracker steps toward
+//  higher source voltage, the stable side of the power curve, until the power falls to the reference
+//  global sweep: partial shading can give the power curve several local maxima. A sweep (startSweep(), or every
+//  sweepPeriod decisions) steps the duty cycle across its limits, and then resumes tracking from the duty cycle with
+//  the most power. A sweep ends early if the power exceeds the power reference
+//  the duty cycle is in the units of the board, e.g. Q10 on the AtverterH (1024 = 100%)
+//  e.g. in the .ino file:
+//    MaxPowerTracker mppt;
+//    mppt.setDutyLimits(DUTYRAWMIN, DUTYRAWMAX);
+//    atverter.setDutyCycleRaw(mppt.update(atverter.getRawV1(), atverter.getRawI1(), atverter.getDutyCycleRaw()));
+enum MPPTModes
+{ MPPTPERTURBOBSERVE = 0, // perturb and observe
+  MPPTINCCOND = 1 // incremental conductance
+};
+const uint8_t MPPTWINDOWBSMAX = 8; // most samples per decision, as a bit-shift
+const uint8_t MPPTSTEPSTREAK = 3; // steps in the same direction before the step size grows
+const uint8_t MPPTINCCONDTOLERANCEBS = 3; // incremental conductance holds while |dP/dV| <= I/8
+
+class MaxPowerTracker
+{
+  public:
+    void setMode(uint8_t mode); // sets the MPPTModes
+    void setTiming(unsigned int settleTicks, uint8_t windowBS); // ticks to settle, and samples to average, per decision
+    void setStepLimits(int stepMin, int stepMax); // smallest and largest duty cycle step
+    void setDutyLimits(int dutyMin, int dutyMax); // range of the returned duty cycle, and of a sweep
+    void setDutyDirection(bool isDutyRaisingVoltage); // false (default) if a higher duty lowers the source voltage
+    void setPowerReference(long powerRef); // curtails the power to powerRef (raw V*I)
+    void setSweep(unsigned int sweepPeriod, int sweepStep); // sweeps every sweepPeriod decisions (0 = never)
+    void startSweep(); // sweeps the duty cycle from the next decision on
+    int update(int v, int i, int duty); // takes a sample, returns the duty cycle to apply
+    void reset(); // restarts tracking, e.g. after reconnecting the source
+    long getPower(); // returns the averaged power (raw V*I) of the last decision
+    int getStep(); // returns the current step size
+    bool isSweeping(); // returns true during a global sweep
+    bool isCurtailing(); // returns true if the last decision curtailed the power
+  private:
+    uint8_t _mode = MPPTPERTURBOBSERVE; // MPPTModes
+    unsigned int _settleTicks = 32; // ticks to wait after a step before sampling
+    uint8_t _windowBS = 5; // samples averaged per decision, as a bit-shift
+    int _stepMin = 2; // smallest step, 0.2% in Q10
+    int _stepMax = 64; // largest step, 6.25% in Q10
+    int _dutyMin = 1024/100; // lowest duty cycle, 1% in Q10
+    int _dutyMax = 1024 - 1024/100; // highest duty cycle, 99% in Q10
+    int8_t _voltageDutySign = -1; // sign of the duty cycle step that raises the source voltage
+    long _powerRef = 0x7FFFFFFFL; // curtailment power reference, no curtailment by default
+    unsigned int _sweepPeriod = 0; // decisions between sweeps, 0 for none
+    int _sweepStep = 32; // duty cycle step of a sweep, 3.1% in Q10
+    // averaging
+    unsigned int _tickCount = 0; // ticks since the last decision
+    unsigned int _sampleCount = 0; // samples in the accumulators
+    long _powerAcc = 0; // sum of V*I samples
+    long _vAcc = 0; // sum of V samples
+    long _iAcc = 0; // sum of I samples
+    // tracking
+    bool _hasPrevious = false; // true once a decision has a previous average to compare with
+    long _power = 0; // averaged power of the last decision
+    int _v = 0; // averaged voltage of the last decision
+    int _i = 0; // averaged current of the last decision
+    int _step = 2; // current step size
+    int8_t _direction = 1; // sign of the last duty cycle step
+    uint8_t _stepStreak = 0; // steps in the same direction since the last reversal, up to MPPTSTEPSTREAK
+    bool _isCurtailing = false; // true if the last decision curtailed the power
+    unsigned int _decisionCount = 0; // decisions since the last sweep
+    // global sweep
+    bool _isSweeping = false; // true during a sweep
+    bool _isSweepPending = false; // true to start a sweep at the next decision
+    int _sweepBestDuty = 0; // duty cycle with the most power so far in the sweep
+    long _sweepBestPower = 0; // most power so far in the sweep
+    int track(long power, int v, int i, int duty); // one tracking decision, returns the new duty cycle
+    int sweep(long power, int duty); // one sweep decision, returns the new duty cycle
+};
+
+#endif
@@ -6,7 +6,61 @@
 
 #include "MicroPanelH.h"
 
+// ASCII command table, sorted by mnemonic for binary search
+// MicroPanel readable registers: RVB, RI1, RI2, RI3, RI4, RIT, RVCC, RCH1, RCH2, RCH3, RCH4, RALL (snapshot)
+// MicroPanel writable registers: WCH1, WCH2, WCH3, WCH4, WIL1, WIL2, WIL3, WIL4, WILT
+const RegisterCommandEntry MICROPANEL_COMMANDS[] PROGMEM = {
+  {"RCH1", BINREG_CH1, REGCMD_READ}, // read state of terminal 1
+  {"RCH2", BINREG_CH2, REGCMD_READ}, // read state of terminal 2
+  {"RCH3", BINREG_CH3, REGCMD_READ}, // read state of terminal 3
+  {"RCH4", BINREG_CH4, REGCMD_READ}, // read state of terminal 4
+  {"RI1", BINREG_I1, REGCMD_READ}, // read current at terminal 1
+  {"RI2", BINREG_I2, REGCMD_READ}, // read current at terminal 2
+  {"RI3", BINREG_I3, REGCMD_READ}, // read current at terminal 3
+  {"RI4", BINREG_I4, REGCMD_READ}, // read current at terminal 4
+  {"RIT", BINREG_IT, REGCMD_READ}, // read total current
+  {"RVB", BINREG_VB, REGCMD_READ | REGCMD_UNSIGNED}, // read bus voltage
+  {"RVCC", BINREG_VCC, REGCMD_READ}, // read the ~5V VCC bus voltage
+  {"WCH1", BINREG_CH1, REGCMD_WRITE | REGCMD_READBACK}, // write the desired terminal 1 state
+  {"WCH2", BINREG_CH2, REGCMD_WRITE | REGCMD_READBACK}, // write the desired terminal 2 state
+  {"WCH3", BINREG_CH3, REGCMD_WRITE | REGCMD_READBACK}, // write the desired terminal 3 state
+  {"WCH4", BINREG_CH4, REGCMD_WRITE | REGCMD_READBACK}, // write the desired terminal 4 state
+  {"WIL1", BINREG_IL1, REGCMD_WRITE}, // write the terminal 1 current shutdown limit (mA)
+  {"WIL2", BINREG_IL2, REGCMD_WRITE}, // write the terminal 2 current shutdown limit (mA)
+  {"WIL3", BINREG_IL3, REGCMD_WRITE}, // write the terminal 3 current shutdown limit (mA)
+  {"WIL4", BINREG_IL4, REGCMD_WRITE}, // write the terminal 4 current shutdown limit (mA)
+  {"WILT", BINREG_ILT, REGCMD_WRITE} // write the total terminal current shutdown limit (mA)
+};
+
+// registers returned together by the bulk snapshot (BINREG_SNAPSHOT or "RALL"), in frame order
+const SnapshotEntry MICROPANEL_SNAPSHOT[] PROGMEM = {
+  {BINREG_VB, REGCMD_UNSIGNED}, // bus voltage (mV)
+  {BINREG_I1, 0}, // terminal 1 current (mA)
+  {BINREG_I2, 0}, // terminal 2 current (mA)
+  {BINREG_I3, 0}, // terminal 3 current (mA)
+  {BINREG_I4, 0}, // terminal 4 current (mA)
+  {BINREG_IT, 0}, // total current (mA)
+  {BINREG_VCC, 0}, // VCC voltage (mV)
+  {BINREG_CH1, 0}, // channel 1 state
+  {BINREG_CH2, 0}, // channel 2 state
+  {BINREG_CH3, 0}, // channel 3 state
+  {BINREG_CH4, 0} // channel 4 state
+};
+
+// channels sampled by the ADC scan engine (startADCScan), in scan order
+const ADCScanChannel MICROPANEL_ADCSCAN[] PROGMEM = {
+  {VBUS_PIN, VBUS_INDEX, 0}, // bus voltage
+  {I1_PIN, I1_INDEX, 512}, // terminal 1 current, centered on zero
+  {I2_PIN, I2_INDEX, 512}, // terminal 2 current, centered on zero
+  {I3_PIN, I3_INDEX, 512}, // terminal 3 current, centered on zero
+  {I4_PIN, I4_INDEX, 512} // terminal 4 current, centered on zero
+};
+
 MicroPanelH::MicroPanelH() {
+  _boardCommands = MICROPANEL_COMMANDS;
+  _boardCommandsLength = sizeof(MICROPANEL_COMMANDS)/sizeof(MICROPANEL_COMMANDS[0]);
+  _snapshotRegisters = MICROPANEL_SNAPSHOT;
+  _snapshotLength = sizeof(MICROPANEL_SNAPSHOT)/sizeof(MICROPANEL_SNAPSHOT[0]);
 }
 
 // default initialization routine
@@ -53,7 +107,8 @@ void MicroPanelH::initializeSensors() {
 // example usage: MicroPanelH.initializeInterruptTimer(1, &controlUpdate);
 void MicroPanelH::initializeInterruptTimer(long periodus, void (*interruptFunction)(void)) {
   Timer1.initialize(periodus); // arg: period in microseconds
-  Timer1.attachInterrupt(interruptFunction); // arg: interrupt function to call
+  setControlFunction(interruptFunction); // arg: interrupt function to call, after the pin pulse update
+  Timer1.attachInterrupt(&PicroBoard::controlInterrupt);
 }
 
 // Channel State Set and Get -----------------------------------------------
@@ -108,6 +163,7 @@ void MicroPanelH::setChannel(int chNumber, int state) {
 // hardwareShutoffEnabled - when setting the channel, should we keep the hardware shutoff enabled?
 // holdProtectMicroseconds - microsecond duration during which we disable hardware shutoff before re-enabling
 void MicroPanelH::setChannel(int chPin, int state, bool hardwareShutoffEnabled, int holdProtectMicroseconds) {
+  cancelPinPulse(chPin); // the new state replaces a shutdown in progress
   pinMode(chPin, OUTPUT);
   digitalWrite(chPin, state);
   if(hardwareShutoffEnabled) {
@@ -197,81 +253,65 @@ void MicroPanelH::updateVCC() {
   int avgLength = 4; // should be less than 10 to avoid overflow
   for (int n = 0; n < avgLength; n++)
     accumulator = accumulator + readVCC();
-  _vcc = accumulator/avgLength;
+  applyVCC(accumulator/avgLength);
+}
+
+// stores a measured VCC (mV), from updateVCC() or a non-blocking updateVCCAsync()
+void MicroPanelH::applyVCC(int vcc) {
+  _vcc = vcc;
   if (_vcc < 4950) { // readVCC() might measure ~4500 mV if connected via USB
     _vcc = 5000; // to avoid incorrect USB VCC, set to approximate supply output voltage 
   }
+  updateConversionScales();
 }
 
 void MicroPanelH::updateVISensors() {
-  // analogRead() measured at 116 microseconds, updateSensorRaw adds negligable time
+  if (isADCBusy()) // the scan engine already feeds the averages, or a VCC measurement owns the ADC
+    return;
+  // analogRead() measured at 116 microseconds, the moving average update adds negligable time
   // total updateVISensors time is measured at 456 microseconds
-  updateSensorRaw(VBUS_INDEX, analogReadFast(VBUS_PIN));
-  updateSensorRaw(I1_INDEX, analogReadFast(I1_PIN) - 512);
-  updateSensorRaw(I2_INDEX, analogReadFast(I2_PIN) - 512);
-  updateSensorRaw(I3_INDEX, analogReadFast(I3_PIN) - 512);
-  updateSensorRaw(I4_INDEX, analogReadFast(I4_PIN) - 512);
-}
-
-void MicroPanelH::updateSensorRaw(int index, int sample) {
-  // find correct sensorPast array
-  int * sensorPast;
-  switch (index) {
-    case VBUS_INDEX:
-      sensorPast = _sensorPastVBus;
-      break;
-    case I1_INDEX:
-      sensorPast = _sensorPastI1;
-      break;
-    case I2_INDEX:
-      sensorPast = _sensorPastI2;
-      break;
-    case I3_INDEX:
-      sensorPast = _sensorPastI3;
-      break;
-    case I4_INDEX:
-      sensorPast = _sensorPastI4;
-      break;
-    default:
-      return;
-  }
-  // subtract oldest value from accumulator, set new value in array, add new value to accumulator
-  _sensorAccumulators[index] -= sensorPast[_sensorIterators[index]];
-  sensorPast[_sensorIterators[index]] = sample;
-  _sensorAccumulators[index] += sensorPast[_sensorIterators[index]];
-  // update sensor average
-  _sensorAverages[index] = (int)(_sensorAccumulators[index]/AVERAGE_WINDOW_MAX[index]);
-  // increment iterator (or return it to zero)
-  _sensorIterators[index] ++;
-  if (_sensorIterators[index] >= AVERAGE_WINDOW_MAX[index])
-    _sensorIterators[index] = 0;
+  _sensors.update<VBUS_INDEX>(analogReadFast(VBUS_PIN));
+  _sensors.update<I1_INDEX>(analogReadFast(I1_PIN) - 512);
+  _sensors.update<I2_INDEX>(analogReadFast(I2_PIN) - 512);
+  _sensors.update<I3_INDEX>(analogReadFast(I3_PIN) - 512);
+  _sensors.update<I4_INDEX>(analogReadFast(I4_PIN) - 512);
+}
+
+// starts the ADC scan engine on every board sensor, so that the averages update without blocking reads
+void MicroPanelH::startADCScan() {
+  PicroBoard::startADCScan(MICROPANEL_ADCSCAN, sizeof(MICROPANEL_ADCSCAN)/sizeof(MICROPANEL_ADCSCAN[0]));
+}
+
+// feeds one sample from the ADC scan engine into the sensor moving averages
+void MicroPanelH::updateScanSample(uint8_t sensorIndex, int sample) {
+  _sensors.update(sensorIndex, sample);
 }
 
 // Raw Sensor Accessor Functions --------------------------------------
 
 // bus voltage (0 to 1023)
 int MicroPanelH::getRawVBus() {
-  return _sensorAverages[VBUS_INDEX];
+  return _sensors.average<VBUS_INDEX>();
 }
 
 // terminal 1 current (0 to 1023)
 int MicroPanelH::getRawI1() {
-  return _sensorAverages[I1_INDEX];
+  return _sensors.average<I1_INDEX>();
 }
 
 // terminal 2 current (0 to 1023)
 int MicroPanelH::getRawI2() {
-  return _sensorAverages[I2_INDEX];
+  return _sensors.average<I2_INDEX>();
 }
 
 // terminal 3 current (0 to 1023)
 int MicroPanelH::getRawI3() {
-  return _sensorAverages[I3_INDEX];
+  return _sensors.average<I3_INDEX>();
 }
 
 // terminal 4 current (0 to 1023)
 int MicroPanelH::getRawI4() {
-  return _sensorAverages[I4_INDEX];
+  return _sensors.average<I4_INDEX>();
 }
 
 // total current
@@ -279,6 +319,36 @@ int MicroPanelH::getRawITotal() {
   return getRawI1() + getRawI2() + getRawI3() + getRawI4();
 }
 
+// bus voltage, oversampled (0 to 1023 << SENSOR_V_OVERSAMPLE_BITS)
+int MicroPanelH::getWideRawVBus() {
+  return _sensors.average<VBUS_INDEX, SENSOR_V_OVERSAMPLE_BITS>();
+}
+
+// terminal 1 current, oversampled (-512 to 512 << SENSOR_I_OVERSAMPLE_BITS)
+int MicroPanelH::getWideRawI1() {
+  return _sensors.average<I1_INDEX, SENSOR_I_OVERSAMPLE_BITS>();
+}
+
+// terminal 2 current, oversampled (-512 to 512 << SENSOR_I_OVERSAMPLE_BITS)
+int MicroPanelH::getWideRawI2() {
+  return _sensors.average<I2_INDEX, SENSOR_I_OVERSAMPLE_BITS>();
+}
+
+// terminal 3 current, oversampled (-512 to 512 << SENSOR_I_OVERSAMPLE_BITS)
+int MicroPanelH::getWideRawI3() {
+  return _sensors.average<I3_INDEX, SENSOR_I_OVERSAMPLE_BITS>();
+}
+
+// terminal 4 current, oversampled (-512 to 512 << SENSOR_I_OVERSAMPLE_BITS)
+int MicroPanelH::getWideRawI4() {
+  return _sensors.average<I4_INDEX, SENSOR_I_OVERSAMPLE_BITS>();
+}
+
+// total current, oversampled
+int MicroPanelH::getWideRawITotal() {
+  return getWideRawI1() + getWideRawI2() + getWideRawI3() + getWideRawI4();
+}
+
 // Fully-Formatted Sensor Accessor Functions --------------------------------------
 
 // returns the averaged VCC value
@@ -288,27 +358,27 @@ int MicroPanelH::getVCC() {
 
 // returns the averaged VBus value in mV
 unsigned int MicroPanelH::getVBus() {
-  return raw2mV(getRawVBus());
+  return raw2mV(getWideRawVBus(), SENSOR_V_OVERSAMPLE_BITS);
 }
 
 // returns the averaged I1 value in mA
 int MicroPanelH::getI1() {
-  return raw2mA(getRawI1());
+  return raw2mA(getWideRawI1(), SENSOR_I_OVERSAMPLE_BITS);
 }
 
 // returns the averaged I2 value in mA
 int MicroPanelH::getI2() {
-  return raw2mA(getRawI2());
+  return raw2mA(getWideRawI2(), SENSOR_I_OVERSAMPLE_BITS);
 }
 
 // returns the averaged I3 value in mA
 int MicroPanelH::getI3() {
-  return raw2mA(getRawI3());
+  return raw2mA(getWideRawI3(), SENSOR_I_OVERSAMPLE_BITS);
 }
 
 // returns the averaged I4 value in mA
 int MicroPanelH::getI4() {
-  return raw2mA(getRawI4());
+  return raw2mA(getWideRawI4(), SENSOR_I_OVERSAMPLE_BITS);
 }
 
 // returns the averaged total current value in mA
@@ -319,39 +389,48 @@ int MicroPanelH::getITotal() {
 // Conversion Utility Functions ---------------------------------------
 
 // converts a raw 10-bit analog reading (0-1023) to the actual mV (0-65000)
-unsigned int MicroPanelH::raw2mV(int raw) {
-  long numerator = (long)raw*getVCC()*13;
-  return (unsigned int)(numerator/1024); // analogRead*VCC/1024 * (120k+10k)/10k
+//  oversampled readings (0 to 1023 << extraBits) are scaled by the extra bits
+unsigned int MicroPanelH::raw2mV(int raw, uint8_t extraBits) {
+  long numerator = (long)raw*_raw2mVScale;
+  return (unsigned int)(numerator >> (10 + extraBits)); // analogRead*VCC/1024 * (120k+10k)/10k
 }
 
 // converts a raw 10-bit analog reading (0-1023) to ADC mV reading (0-5000)
-int MicroPanelH::raw2mVADC(int raw) {
+int MicroPanelH::raw2mVADC(int raw, uint8_t extraBits) {
   long rawL = (long)raw;
-  return (int)(rawL*getVCC()/1024); // analogRead*VCC/1024
+  return (int)((rawL*getVCC()) >> (10 + extraBits)); // analogRead*VCC/1024
 }
 
 // converts a raw 10-bit analog reading centered on zero (-512 to 512) to a mA reading (-5000 to 5000)
 //  for MT9221CT-06BR5 current sensor with VCC=5V, sensitivity is 333mV/A, 0A at 2.5V
 //  with variable VCC, sensitivity (mV/mA) is VCC/5000*333/1000, 0A at VCC/2
-int MicroPanelH::raw2mA(int raw) {
+int MicroPanelH::raw2mA(int raw, uint8_t extraBits) {
   long rawL = (long)raw;
   // (analogRead-512) * VCC/1024 * 1/sensitivity = (analogRead-512) * VCC/1024 * 1000/333
-  return rawL*getVCC()*3/1024;
+  return (rawL*_raw2mAScale) >> (10 + extraBits);
 }
 
-// converts a mV value (0-65000) to raw 10-bit form (0-1023)
-int MicroPanelH::mV2raw(unsigned int mV) { // mV * 10k/(10k+120k) * 1024/VCC
-  long temp = (long)mV * 79 / getVCC();
+// converts a mV value (0-65000) to raw 10-bit form (0-1023), or oversampled form (0 to 1023 << extraBits)
+int MicroPanelH::mV2raw(unsigned int mV, uint8_t extraBits) { // mV * 10k/(10k+120k) * 1024/VCC
+  long temp = ((long)mV*_mV2rawScale) >> (MV2RAW_Q - extraBits);
   return (int)(temp);
 }
 
 // converts a mA value (-5000 to 5000) to raw 10-bit form centered around 0 (-512 to 512)
-int MicroPanelH::mA2raw(int mA) {
+int MicroPanelH::mA2raw(int mA, uint8_t extraBits) {
   // mA * sensitivity * 1024/VCC = mA * 333/1000 * 1024/VCC
-  long temp = (long)mA*341/getVCC();
+  long temp = ((long)mA*_mA2rawScale) >> (MA2RAW_Q - extraBits);
   return (int)temp;
 }
 
+// caches the VCC-dependent conversion factors, so that conversions need no division
+void MicroPanelH::updateConversionScales() {
+  _raw2mVScale = (long)_vcc*13;
+  _raw2mAScale = (long)_vcc*3;
+  _mV2rawScale = (1L << (10 + MV2RAW_Q))/(13L*_vcc);
+  _mA2rawScale = (341L << MA2RAW_Q)/_vcc;
+}
+
 // Droop Resistance Conversions -------------------------------------------
 
 // sets the stored droop resistance
@@ -382,6 +461,7 @@ int MicroPanelH::getVDroopRaw(int iOut) {
 
 // returns the official VCC voltage in milliVolts
 int MicroPanelH::readVCC() {
+  bool isScanning = pauseADCScan(); // the scan engine must not switch channels during this reading
   // reads 1.1V reference against AVcc
   // set the reference to Vcc and the measurement to the internal 1.1V reference
   #if defined(__AVR_ATmega32U4__) || defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
@@ -401,7 +481,9 @@ int MicroPanelH::readVCC() {
  
   long result = (high<<8) | low;
  
-  result = 1125300L / result; // Calculate Vcc (in mV); 1125300 = 1.1*1023*1000
+  result = _bandgapScale / result; // Calculate Vcc (in mV), see _bandgapScale
+  if (isScanning)
+    resumeADCScan();
   return (int)result; // Vcc in millivolts
 }
 
@@ -425,20 +507,10 @@ void MicroPanelH::setLED2(int state) {
 // Safety -----------------------------------------------------------------
 
 // immediately triggers the all channels to shut down
+//  the channel pins are pulled low together and released to inputs together by the control timer tick
 void MicroPanelH::shutdownChannels() {
-  pinMode(CH1_PIN, OUTPUT);
-  pinMode(CH2_PIN, OUTPUT);
-  pinMode(CH3_PIN, OUTPUT);
-  pinMode(CH4_PIN, OUTPUT);
-  digitalWrite(CH1_PIN, LOW);
-  digitalWrite(CH2_PIN, LOW);
-  digitalWrite(CH3_PIN, LOW);
-  digitalWrite(CH4_PIN, LOW);
-  delayMicroseconds(10000);
-  pinMode(CH1_PIN, INPUT);
-  pinMode(CH2_PIN, INPUT);
-  pinMode(CH3_PIN, INPUT);
-  pinMode(CH4_PIN, INPUT);
+  const uint8_t pins[] = {CH1_PIN, CH2_PIN, CH3_PIN, CH4_PIN};
+  startPinPulses(pins, sizeof(pins), LOW, true, CHANNELSHUTDOWNMICROS);
 }
 
 // checks if one or more channels are active
@@ -483,16 +555,16 @@ void MicroPanelH::setCurrentLimitTotal(int current_mA) {
 // checks if last sensed current is greater than current limit
 void MicroPanelH::checkCurrentShutdown() {
   // this function takes negligable microseconds unless actually shutting down
-  if (_sensorAverages[I1_INDEX] > _currentLimitAmplitudeRaw1)
+  if (_sensors.average<I1_INDEX>() > _currentLimitAmplitudeRaw1)
     setCh1(LOW);
-  if (_sensorAverages[I2_INDEX] > _currentLimitAmplitudeRaw2)
+  if (_sensors.average<I2_INDEX>() > _currentLimitAmplitudeRaw2)
     setCh2(LOW);
-  if (_sensorAverages[I3_INDEX] > _currentLimitAmplitudeRaw3)
+  if (_sensors.average<I3_INDEX>() > _currentLimitAmplitudeRaw3)
     setCh3(LOW);
-  if (_sensorAverages[I4_INDEX] > _currentLimitAmplitudeRaw4)
+  if (_sensors.average<I4_INDEX>() > _currentLimitAmplitudeRaw4)
     setCh4(LOW);
-  if (_sensorAverages[I1_INDEX] + _sensorAverages[I2_INDEX] + 
-    _sensorAverages[I3_INDEX] + _sensorAverages[I4_INDEX] > _currentLimitAmplitudeRawTotal) {
+  if (_sensors.average<I1_INDEX>() + _sensors.average<I2_INDEX>() + 
+    _sensors.average<I3_INDEX>() + _sensors.average<I4_INDEX>() > _currentLimitAmplitudeRawTotal) {
     setCh1(LOW);
     setCh2(LOW);
     setCh3(LOW);
@@ -501,22 +573,22 @@ void MicroPanelH::checkCurrentShutdown() {
 }
 // void MicroPanelH::checkCurrentShutdown() {
 //   // this function takes negligable microseconds unless actually shutting down
-//   if (_sensorAverages[I1_INDEX] > _currentLimitAmplitudeRaw1
-//     || _sensorAverages[I1_INDEX] < -_currentLimitAmplitudeRaw1)
+//   if (_sensors.average<I1_INDEX>() > _currentLimitAmplitudeRaw1
+//     || _sensors.average<I1_INDEX>() < -_currentLimitAmplitudeRaw1)
 //     setCh1(LOW);
-//   if (_sensorAverages[I2_INDEX] > _currentLimitAmplitudeRaw2
-//     || _sensorAverages[I2_INDEX] < -_currentLimitAmplitudeRaw2)
+//   if (_sensors.average<I2_INDEX>() > _currentLimitAmplitudeRaw2
+//     || _sensors.average<I2_INDEX>() < -_currentLimitAmplitudeRaw2)
 //     setCh2(LOW);
-//   if (_sensorAverages[I3_INDEX] > _currentLimitAmplitudeRaw3
-//     || _sensorAverages[I3_INDEX] < -_currentLimitAmplitudeRaw3)
+//   if (_sensors.average<I3_INDEX>() > _currentLimitAmplitudeRaw3
+//     || _sensors.average<I3_INDEX>() < -_currentLimitAmplitudeRaw3)
 //     setCh3(LOW);
-//   if (_sensorAverages[I4_INDEX] > _currentLimitAmplitudeRaw4
-//     || _sensorAverages[I4_INDEX] < -_currentLimitAmplitudeRaw4)
+//   if (_sensors.average<I4_INDEX>() > _currentLimitAmplitudeRaw4
+//     || _sensors.average<I4_INDEX>() < -_currentLimitAmplitudeRaw4)
 //     setCh4(LOW);
-//   if (_sensorAverages[I1_INDEX] + _sensorAverages[I2_INDEX] + 
-//     _sensorAverages[I3_INDEX] + _sensorAverages[I4_INDEX] > _currentLimitAmplitudeRawTotal
-//     || _sensorAverages[I1_INDEX] + _sensorAverages[I2_INDEX] + 
-//     _sensorAverages[I3_INDEX] + _sensorAverages[I4_INDEX] < -_currentLimitAmplitudeRawTotal) {
+//   if (_sensors.average<I1_INDEX>() + _sensors.average<I2_INDEX>() + 
+//     _sensors.average<I3_INDEX>() + _sensors.average<I4_INDEX>() > _currentLimitAmplitudeRawTotal
+//     || _sensors.average<I1_INDEX>() + _sensors.average<I2_INDEX>() + 
+//     _sensors.average<I3_INDEX>() + _sensors.average<I4_INDEX>() < -_currentLimitAmplitudeRawTotal) {
 //     setCh1(LOW);
 //     setCh2(LOW);
 //     setCh3(LOW);
@@ -526,92 +598,37 @@ void MicroPanelH::checkCurrentShutdown() {
 
 // Communications ------------------------------------------------------------
 
-// process the parsed RX command, overrides base class virtual function
-// MicroPanel readable registers: RVB, RI1, RI2, RI3, RI4, RIT, RVCC, RCH1, RCH2, RCH3, RCH4
-// MicroPanel writable registers: WCH1, WCH2, WCH3, WCH4, WIL1, WIL2, WIL3, WIL4
-void MicroPanelH::interpretRXCommand(char* command, char* value, int receiveProtocol) {
-  if (strcmp(command, "RVB") == 0) { // read bus voltage
-    sprintf(getTXBuffer(receiveProtocol), "WVB:%u", getVBus());
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "RI1") == 0) { // read current at terminal 1
-    sprintf(getTXBuffer(receiveProtocol), "WI1:%d", getI1());
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "RI2") == 0) { // read current at terminal 2
-    sprintf(getTXBuffer(receiveProtocol), "WI2:%d", getI2());
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "RI3") == 0) { // read current at terminal 3
-    sprintf(getTXBuffer(receiveProtocol), "WI3:%d", getI3());
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "RI4") == 0) { // read current at terminal 4
-    sprintf(getTXBuffer(receiveProtocol), "WI4:%d", getI4());
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "RIT") == 0) { // read total current
-    sprintf(getTXBuffer(receiveProtocol), "WIT:%d", getITotal());
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "RVCC") == 0) { // read the ~5V VCC bus voltage
-    sprintf(getTXBuffer(receiveProtocol), "WVCC:%d", getVCC());
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "RCH1") == 0) { // read state of terminal 1
-    sprintf(getTXBuffer(receiveProtocol), "WCH1:%d", getCh1());
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "RCH2") == 0) { // read state of terminal 2
-    sprintf(getTXBuffer(receiveProtocol), "WCH2:%d", getCh2());
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "RCH3") == 0) { // read state of terminal 3
-    sprintf(getTXBuffer(receiveProtocol), "WCH3:%d", getCh3());
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "RCH4") == 0) { // read state of terminal 4
-    sprintf(getTXBuffer(receiveProtocol), "WCH4:%d", getCh4());
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "WCH1") == 0) { // write the desired terminal 1 state
-    int temp = atoi(value);
-    setCh1(temp);
-    sprintf(getTXBuffer(receiveProtocol), "WCH1:=%d", getCh1());
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "WCH2") == 0) { // write the desired terminal 2 state
-    int temp = atoi(value);
-    setCh2(temp);
-    sprintf(getTXBuffer(receiveProtocol), "WCH2:=%d", getCh2());
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "WCH3") == 0) { // write the desired terminal 3 state
-    int temp = atoi(value);
-    setCh3(temp);
-    sprintf(getTXBuffer(receiveProtocol), "WCH3:=%d", getCh3());
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "WCH4") == 0) { // write the desired terminal 4 state
-    int temp = atoi(value);
-    setCh4(temp);
-    sprintf(getTXBuffer(receiveProtocol), "WCH4:=%d", getCh4());
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "WIL1") == 0) { // write the terminal 1 current shutdown limit (mA)
-    int temp = atoi(value);
-    setCurrentLimit1(temp);
-    sprintf(getTXBuffer(receiveProtocol), "WIL1:=%d", temp);
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "WIL2") == 0) { // write the terminal 2 current shutdown limit (mA)
-    int temp = atoi(value);
-    setCurrentLimit2(temp);
-    sprintf(getTXBuffer(receiveProtocol), "WIL2:=%d", temp);
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "WIL3") == 0) { // write the terminal 3 current shutdown limit (mA)
-    int temp = atoi(value);
-    setCurrentLimit3(temp);
-    sprintf(getTXBuffer(receiveProtocol), "WIL3:=%d", temp);
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "WIL4") == 0) { // write the terminal 4 current shutdown limit (mA)
-    int temp = atoi(value);
-    setCurrentLimit4(temp);
-    sprintf(getTXBuffer(receiveProtocol), "WIL4:=%d", temp);
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "WILT") == 0) { // write the total terminal current shutdown limit (mA)
-    int temp = atoi(value);
-    setCurrentLimitTotal(temp);
-    sprintf(getTXBuffer(receiveProtocol), "WILT:=%d", temp);
-    respondToMaster(receiveProtocol);
-  } else { // send command data to the callback listener functions, registered from primary .ino file
-    for (int n = 0; n < _commandCallbacksEnd; n++) {
-      _commandCallbacks[n](command, value, receiveProtocol);
-    }
+// reads a binary protocol register, overrides base class virtual function
+bool MicroPanelH::readRegister(uint8_t reg, int* value) {
+  switch (reg) {
+    case BINREG_VB: *value = getVBus(); return true;
+    case BINREG_I1: *value = getI1(); return true;
+    case BINREG_I2: *value = getI2(); return true;
+    case BINREG_I3: *value = getI3(); return true;
+    case BINREG_I4: *value = getI4(); return true;
+    case BINREG_IT: *value = getITotal(); return true;
+    case BINREG_VCC: *value = getVCC(); return true;
+    case BINREG_CH1: *value = getCh1(); return true;
+    case BINREG_CH2: *value = getCh2(); return true;
+    case BINREG_CH3: *value = getCh3(); return true;
+    case BINREG_CH4: *value = getCh4(); return true;
+    default: return PicroBoard::readRegister(reg, value);
+  }
+}
+
+// writes a binary protocol register, overrides base class virtual function
+bool MicroPanelH::writeRegister(uint8_t reg, int value) {
+  switch (reg) {
+    case BINREG_CH1: setCh1(value); return true;
+    case BINREG_CH2: setCh2(value); return true;
+    case BINREG_CH3: setCh3(value); return true;
+    case BINREG_CH4: setCh4(value); return true;
+    case BINREG_IL1: setCurrentLimit1(value); return true;
+    case BINREG_IL2: setCurrentLimit2(value); return true;
+    case BINREG_IL3: setCurrentLimit3(value); return true;
+    case BINREG_IL4: setCurrentLimit4(value); return true;
+    case BINREG_ILT: setCurrentLimitTotal(value); return true;
+    default: return PicroBoard::writeRegister(reg, value);
   }
 }
 
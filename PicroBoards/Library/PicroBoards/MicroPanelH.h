@@ -10,6 +10,7 @@
 #define MicroPanelH_h
 
 #include "PicroBoard.h"
+#include "SensorBank.h"
 
 // In Arduino IDE, go to Sketch -> Include Library -> Manage Libraries
 #include <TimerOne.h> // In Library Manager, search for "TimerOne"
@@ -24,6 +25,7 @@ const int CH1_PIN = 9; // PB1
 const int CH2_PIN = 8; // PB0
 const int CH3_PIN = 3; // PD3
 const int CH4_PIN = 7; // PD7
+const unsigned long CHANNELSHUTDOWNMICROS = 10000; // time the channel pins are held low to latch the shutdown
 
 // pins for current and voltage sensing
 const int VBUS_PIN = A3; // PC3, Bus voltage
@@ -42,7 +44,7 @@ enum SensorIndex
     NUM_SENSORS
 };
 
-// moving average sample window length for sensors. Best to use powers of 2 so as to optimize division
+// moving average sample window length for sensors, rounded down to a power of 2 so that averages use a bit-shift
 //  use this before #include to override in the .ino file: #define XXX YY
 //  e.g. to set current averaging window to size 32: #define SENSOR_I_WINDOW_MAX 32
 #ifndef SENSOR_V_WINDOW_MAX
@@ -57,10 +59,45 @@ constexpr int AVERAGE_WINDOW_MAX[NUM_SENSORS] = {
   SENSOR_I_WINDOW_MAX,
   SENSOR_I_WINDOW_MAX,
   SENSOR_I_WINDOW_MAX};
+// oversampling bits for the widened raw accessors, e.g. getWideRawVBus(), added to the 10-bit ADC resolution
+//  the moving average sum of 4^n samples decimates to n extra bits, so n can be at most half the window bit-shift
+//    e.g. the default 32 sample windows allow up to 2 extra bits (12-bit readings): #define SENSOR_I_OVERSAMPLE_BITS 2
+//  oversampling relies on the natural noise of the sensors, which must span at least one 10-bit LSB
+//  off (0) by default, so getVBus(), RVB and RALL keep their 10-bit readings unless the sketch opts in
+#ifndef SENSOR_V_OVERSAMPLE_BITS
+#define SENSOR_V_OVERSAMPLE_BITS 0
+#endif
+#ifndef SENSOR_I_OVERSAMPLE_BITS
+#define SENSOR_I_OVERSAMPLE_BITS 0
+#endif
+// sensor moving averages, one channel per SensorIndex
+typedef SensorBank<sensorWindowShift(SENSOR_V_WINDOW_MAX), sensorWindowShift(SENSOR_I_WINDOW_MAX),
+  sensorWindowShift(SENSOR_I_WINDOW_MAX), sensorWindowShift(SENSOR_I_WINDOW_MAX),
+  sensorWindowShift(SENSOR_I_WINDOW_MAX)> MicroPanelSensorBank;
 
 // droop resistance multiplication factor to avoid floating point math (multiple of 2)
 const int RDROOPFACTOR = 1024;
 
+// binary protocol register IDs, each mirroring the ASCII command of the same name (R = readable, W = writable)
+enum MicroPanelRegisters
+{   BINREG_VB = 0x01, // R: bus voltage (mV, unsigned)
+    BINREG_I1, // R: terminal 1 current (mA)
+    BINREG_I2, // R: terminal 2 current (mA)
+    BINREG_I3, // R: terminal 3 current (mA)
+    BINREG_I4, // R: terminal 4 current (mA)
+    BINREG_IT, // R: total current (mA)
+    BINREG_VCC, // R: VCC voltage (mV)
+    BINREG_CH1, // RW: channel 1 state (0 or 1)
+    BINREG_CH2, // RW: channel 2 state (0 or 1)
+    BINREG_CH3, // RW: channel 3 state (0 or 1)
+    BINREG_CH4, // RW: channel 4 state (0 or 1)
+    BINREG_IL1, // W: terminal 1 current limit (mA)
+    BINREG_IL2, // W: terminal 2 current limit (mA)
+    BINREG_IL3, // W: terminal 3 current limit (mA)
+    BINREG_IL4, // W: terminal 4 current limit (mA)
+    BINREG_ILT // W: total current limit (mA)
+};
+
 class MicroPanelH : public PicroBoard
 {
   public:
@@ -88,8 +125,12 @@ class MicroPanelH : public PicroBoard
     int getCh3(); // gets the state of Channel 3
     int getCh4(); // gets the state of Channel 4
   // raw sensor values
-    void updateVCC(); // updates stored VCC value based on an average
+    void updateVCC(); // updates stored VCC value based on an average, blocks for ~8 ms (see updateVCCAsync())
+    void applyVCC(int vcc) override; // stores a measured VCC (mV) and updates the conversion scales
     void updateVISensors(); // updates voltage and current sensor averages
+    using PicroBoard::startADCScan;
+    void startADCScan(); // samples every sensor from the ADC interrupt instead of blocking reads
+    void updateScanSample(uint8_t sensorIndex, int sample) override; // feeds one scanned sample into the averages
     int readVCC(); // returns the sampled VCC voltage in milliVolts
     int getRawVBus(); // gets bus voltage ADC value (0 to 1023)
     int getRawI1(); // gets Terminal 1 current ADC value (0 to 1023)
@@ -97,6 +138,12 @@ class MicroPanelH : public PicroBoard
     int getRawI3(); // gets Terminal 3 current ADC value (0 to 1023)
     int getRawI4(); // gets Terminal 4 current ADC value (0 to 1023)
     int getRawITotal(); // gets total current ADC value (0 to 1023)
+    int getWideRawVBus(); // gets oversampled bus voltage (0 to 1023 << SENSOR_V_OVERSAMPLE_BITS)
+    int getWideRawI1(); // gets oversampled Terminal 1 current (-512 to 512 << SENSOR_I_OVERSAMPLE_BITS)
+    int getWideRawI2(); // gets oversampled Terminal 2 current (-512 to 512 << SENSOR_I_OVERSAMPLE_BITS)
+    int getWideRawI3(); // gets oversampled Terminal 3 current (-512 to 512 << SENSOR_I_OVERSAMPLE_BITS)
+    int getWideRawI4(); // gets oversampled Terminal 4 current (-512 to 512 << SENSOR_I_OVERSAMPLE_BITS)
+    int getWideRawITotal(); // gets oversampled total current (-2048 to 2048 << SENSOR_I_OVERSAMPLE_BITS)
   // fully-formatted sensors
     int getVCC(); // returns the averaged VCC value
     unsigned int getVBus(); // returns the averaged VBus mV value
@@ -121,29 +168,28 @@ class MicroPanelH : public PicroBoard
     void setCurrentLimitTotal(int current); // sets the total current shutoff limit in mA, max 7500 mA
     void checkCurrentShutdown(); // checks if last sensed current is greater than current limit
   // conversion utility functions
-    unsigned int raw2mV(int raw); // converts ADC reading to mV voltage scaled by resistor divider
-    int raw2mVADC(int raw); // converts ADC reading to mV voltage at ADC
-    int raw2mA(int raw); // converts raw ADC current sense output to mA
-    int mV2raw(unsigned int mV); // converts a mV value to raw 10-bit form
-    int mA2raw(int mA); // converts a mA value to raw 10-bit form
+    unsigned int raw2mV(int raw, uint8_t extraBits = 0); // converts ADC reading (10 + extraBits wide) to mV voltage scaled by resistor divider
+    int raw2mVADC(int raw, uint8_t extraBits = 0); // converts ADC reading (10 + extraBits wide) to mV voltage at ADC
+    int raw2mA(int raw, uint8_t extraBits = 0); // converts raw ADC current sense output (10 + extraBits wide) to mA
+    int mV2raw(unsigned int mV, uint8_t extraBits = 0); // converts a mV value to raw (10 + extraBits)-bit form
+    int mA2raw(int mA, uint8_t extraBits = 0); // converts a mA value to raw (10 + extraBits)-bit form
   // droop resistance conversions
     void setRDroop(int mOhm); // sets the stored droop resistance
     int getRDroop(); // gets the stored droop resistance, reported as a mOhm value
     unsigned int getRDroopRaw(); // gets the stored droop resisance in raw form
     int getVDroopRaw(int iOut); // get the droop voltage as (droop resistance)*(output current)
   // communications
-    void interpretRXCommand(char* command, char* value, int receiveProtocol) override; // process RX command
+    bool readRegister(uint8_t reg, int* value) override; // reads a binary protocol register
+    bool writeRegister(uint8_t reg, int value) override; // writes a binary protocol register
   private:
     // sensors and averaging
-    int _sensorAverages[NUM_SENSORS]; // array raw sensor moving averages
-    long _sensorAccumulators[NUM_SENSORS];
-    int _sensorIterators[NUM_SENSORS];
-    int _sensorPastVBus[AVERAGE_WINDOW_MAX[VBUS_INDEX]]; // array raw sensor moving averages
-    int _sensorPastI1[AVERAGE_WINDOW_MAX[I1_INDEX]]; // array raw sensor moving averages
-    int _sensorPastI2[AVERAGE_WINDOW_MAX[I2_INDEX]]; // array raw sensor moving averages
-    int _sensorPastI3[AVERAGE_WINDOW_MAX[I3_INDEX]]; // array raw sensor moving averages
-    int _sensorPastI4[AVERAGE_WINDOW_MAX[I4_INDEX]]; // array raw sensor moving averages
+    MicroPanelSensorBank _sensors; // raw sensor moving averages
     int _vcc; // stored value of vcc measured at start up and/or periodically
+    long _raw2mVScale; // VCC*13, cached by updateConversionScales()
+    long _raw2mAScale; // VCC*3, cached by updateConversionScales()
+    long _mV2rawScale; // 2^(10 + MV2RAW_Q)/(13*VCC), cached by updateConversionScales()
+    long _mA2rawScale; // 341*2^MA2RAW_Q/VCC, cached by updateConversionScales()
+    void updateConversionScales(); // caches the VCC-dependent conversion factors
     int _currentLimitAmplitudeRaw1 = 444; // the upper raw (0 to 1023) current limit before gate shutoff
     int _currentLimitAmplitudeRaw2 = 444; // the upper raw (0 to 1023) current limit before gate shutoff
     int _currentLimitAmplitudeRaw3 = 444; // the upper raw (0 to 1023) current limit before gate shutoff
@@ -152,8 +198,6 @@ class MicroPanelH : public PicroBoard
     int _holdProtectMicros[4] = {50, 50, 50, 50}; // default microseconds to overrides hardware current shutoff
     bool _hardwareShutoffEnabled[4] = {true, true, true, true}; // Expert Only: used to disable hardware shutoff
     long _rDroop = 0; // stored droop resistance value
-    // functions
-    void updateSensorRaw(int index, int sample); // updates the raw averaged sensor value
 };
 
 #endif
@@ -6,7 +6,50 @@
 
 #include "PiSupplyH.h"
 
+// ASCII command table, sorted by mnemonic for binary search
+// PiSupply readable registers: RV48, RV12, RVCC, RCPI, RC5V, RCGP, RC12V, RALL (snapshot)
+// PiSupply writable registers: WCPI, WC5V, WCGP, WC12V
+const RegisterCommandEntry PISUPPLY_COMMANDS[] PROGMEM = {
+  {"RC12V", BINREG_C12V, REGCMD_READ}, // read state of the 12V output power channel
+  {"RC5V", BINREG_C5V, REGCMD_READ}, // read state of the 5V output power channel
+  {"RCGP", BINREG_CGP, REGCMD_READ}, // read state of the GPIO power channel
+  {"RCPI", BINREG_CPI, REGCMD_READ}, // read state of the Pi power channel
+  {"RV12", BINREG_V12, REGCMD_READ}, // read 12V bus voltage
+  {"RV48", BINREG_V48, REGCMD_READ | REGCMD_UNSIGNED}, // read 48V input bus voltage
+  {"RVCC", BINREG_VCC, REGCMD_READ}, // read the ~5V VCC bus voltage
+  {"WC12V", BINREG_C12V, REGCMD_WRITE | REGCMD_READBACK}, // write the desired 12V output power channel state
+  {"WC5V", BINREG_C5V, REGCMD_WRITE | REGCMD_READBACK}, // write the desired 5V output power channel state
+  {"WCGP", BINREG_CGP, REGCMD_WRITE | REGCMD_READBACK}, // write the desired GPIO power channel state
+  {"WCPI", BINREG_CPI, REGCMD_WRITE | REGCMD_READBACK} // write the desired Pi power channel state
+};
+
+// registers returned together by the bulk snapshot (BINREG_SNAPSHOT or "RALL"), in frame order
+const SnapshotEntry PISUPPLY_SNAPSHOT[] PROGMEM = {
+  {BINREG_V48, REGCMD_UNSIGNED}, // 48V input bus voltage (mV)
+  {BINREG_V12, 0}, // 12V bus voltage (mV)
+  {BINREG_VCC, 0}, // VCC voltage (mV)
+  {BINREG_CPI, 0}, // Pi power channel state
+  {BINREG_C5V, 0}, // 5V output power channel state
+  {BINREG_CGP, 0}, // GPIO power channel state
+  {BINREG_C12V, 0} // 12V output power channel state
+};
+
+// channels sampled by the ADC scan engine (startADCScan), in scan order
+const ADCScanChannel PISUPPLY_ADCSCAN[] PROGMEM = {
+  {V48_PIN, V48_INDEX, 0}, // 48V input bus voltage
+  {V12_PIN, V12_INDEX, 0}, // 12V bus voltage
+  {A0_PIN, A0_INDEX, 0}, // analog GPIO pins
+  {A1_PIN, A1_INDEX, 0},
+  {A6_PIN, A6_INDEX, 0},
+  {A7_PIN, A7_INDEX, 0}
+};
+
 PiSupplyH::PiSupplyH() {
+  _boardCommands = PISUPPLY_COMMANDS;
+  _boardCommandsLength = sizeof(PISUPPLY_COMMANDS)/sizeof(PISUPPLY_COMMANDS[0]);
+  _snapshotRegisters = PISUPPLY_SNAPSHOT;
+  _snapshotLength = sizeof(PISUPPLY_SNAPSHOT)/sizeof(PISUPPLY_SNAPSHOT[0]);
+  _bandgapScale = 1126400L; // https://github.com/openenergymonitor/EmonLib/blob/master/EmonLib.h
 }
 
 // default initialization routine
@@ -51,7 +94,8 @@ void PiSupplyH::initializeSensors() {
 // example usage: PiSupplyH.initializeInterruptTimer(1, &controlUpdate);
 void PiSupplyH::initializeInterruptTimer(long periodus, void (*interruptFunction)(void)) {
   Timer1.initialize(periodus); // arg: period in microseconds
-  Timer1.attachInterrupt(interruptFunction); // arg: interrupt function to call
+  setControlFunction(interruptFunction); // arg: interrupt function to call, after the pin pulse update
+  Timer1.attachInterrupt(&PicroBoard::controlInterrupt);
 }
 
 // Channel State Set and Get -----------------------------------------------
@@ -100,34 +144,44 @@ void PiSupplyH::updateVCC() {
   int avgLength = 4; // should be less than 10 to avoid overflow
   for (int n = 0; n < avgLength; n++)
     accumulator = accumulator + readVCC();
-  _vcc = accumulator/avgLength;
+  applyVCC(accumulator/avgLength);
+}
+
+// stores a measured VCC (mV), from updateVCC() or a non-blocking updateVCCAsync()
+void PiSupplyH::applyVCC(int vcc) {
+  _vcc = vcc;
   // if (_vcc < 4950) { // readVCC() might measure ~4500 mV if connected via USB
   //   _vcc = 5000; // to avoid incorrect USB VCC, set to approximate supply output voltage 
   // }
+  updateConversionScales();
 }
 
 // updates voltage sensor averages
 void PiSupplyH::updateVSensors() {
-  // analogRead() measured at 116 microseconds, updateSensorRaw adds negligable time
-  updateSensorRaw(V48_INDEX, analogReadFast(V48_PIN));
-  updateSensorRaw(V12_INDEX, analogReadFast(V12_PIN));
+  if (isADCBusy()) // the scan engine already feeds the averages, or a VCC measurement owns the ADC
+    return;
+  // analogRead() measured at 116 microseconds, the moving average update adds negligable time
+  _sensors.update<V48_INDEX>(analogReadFast(V48_PIN));
+  _sensors.update<V12_INDEX>(analogReadFast(V12_PIN));
 }
 
 // updates a single analog GPIO sensor average (0, 1, 6, or 7)
 void PiSupplyH::updateASensor(int sensor) {
-  // analogRead() measured at 116 microseconds, updateSensorRaw adds negligable time
+  if (isADCBusy()) // the scan engine already feeds the averages, or a VCC measurement owns the ADC
+    return;
+  // analogRead() measured at 116 microseconds, the moving average update adds negligable time
   switch (sensor) {
     case 0:
-      updateSensorRaw(A0_INDEX, analogReadFast(A0_PIN));
+      _sensors.update<A0_INDEX>(analogReadFast(A0_PIN));
       break;
     case 1:
-      updateSensorRaw(A1_INDEX, analogReadFast(A1_PIN));
+      _sensors.update<A1_INDEX>(analogReadFast(A1_PIN));
       break;
     case 6:
-      updateSensorRaw(A6_INDEX, analogReadFast(A6_PIN));
+      _sensors.update<A6_INDEX>(analogReadFast(A6_PIN));
       break;
     case 7:
-      updateSensorRaw(A7_INDEX, analogReadFast(A7_PIN));
+      _sensors.update<A7_INDEX>(analogReadFast(A7_PIN));
       break;
   }
 }
@@ -145,73 +199,56 @@ void PiSupplyH::updateSensors() {
   updateASensors();
 }
 
-void PiSupplyH::updateSensorRaw(int index, int sample) {
-  // find correct sensorPast array
-  int * sensorPast;
-  switch (index) {
-    case V48_INDEX:
-      sensorPast = _sensorPastV48;
-      break;
-    case V12_INDEX:
-      sensorPast = _sensorPastV12;
-      break;
-    case A0_INDEX:
-      sensorPast = _sensorPastA0;
-      break;
-    case A1_INDEX:
-      sensorPast = _sensorPastA1;
-      break;
-    case A6_INDEX:
-      sensorPast = _sensorPastA6;
-      break;
-    case A7_INDEX:
-      sensorPast = _sensorPastA7;
-      break;
-    default:
-      return;
-  }
-  // subtract oldest value from accumulator, set new value in array, add new value to accumulator
-  _sensorAccumulators[index] -= sensorPast[_sensorIterators[index]];
-  sensorPast[_sensorIterators[index]] = sample;
-  _sensorAccumulators[index] += sensorPast[_sensorIterators[index]];
-  // update sensor average
-  _sensorAverages[index] = (int)(_sensorAccumulators[index]/AVERAGE_WINDOW_MAX[index]);
-  // increment iterator (or return it to zero)
-  _sensorIterators[index] ++;
-  if (_sensorIterators[index] >= AVERAGE_WINDOW_MAX[index])
-    _sensorIterators[index] = 0;
+// starts the ADC scan engine on every board sensor, so that the averages update without blocking reads
+void PiSupplyH::startADCScan() {
+  PicroBoard::startADCScan(PISUPPLY_ADCSCAN, sizeof(PISUPPLY_ADCSCAN)/sizeof(PISUPPLY_ADCSCAN[0]));
+}
+
+// feeds one sample from the ADC scan engine into the sensor moving averages
+void PiSupplyH::updateScanSample(uint8_t sensorIndex, int sample) {
+  _sensors.update(sensorIndex, sample);
 }
 
 // Raw Sensor Accessor Functions --------------------------------------
 
 // 48V input bus voltage (0 to 1023)
 int PiSupplyH::getRawV48() {
-  return _sensorAverages[V48_INDEX];
+  return _sensors.average<V48_INDEX>();
 }
 
 // 12V bus voltage (0 to 1023)
 int PiSupplyH::getRawV12() {
-  return _sensorAverages[V12_INDEX];
+  return _sensors.average<V12_INDEX>();
 }
 
 // Analog GPIO pin voltage (0 to 1023)
 int PiSupplyH::getRawAnalog(int analogInd) {
   switch(analogInd) {
     case 0:
-      return _sensorAverages[A0_INDEX];
+      return _sensors.average<A0_INDEX>();
       break;
     case 1:
-      return _sensorAverages[A1_INDEX];
+      return _sensors.average<A1_INDEX>();
       break;
     case 6:
-      return _sensorAverages[A6_INDEX];
+      return _sensors.average<A6_INDEX>();
       break;
     case 7:
-      return _sensorAverages[A7_INDEX];
+      return _sensors.average<A7_INDEX>();
       break;
   }
 }
 
+// 48V input bus voltage, oversampled (0 to 1023 << SENSOR_V_OVERSAMPLE_BITS)
+int PiSupplyH::getWideRawV48() {
+  return _sensors.average<V48_INDEX, SENSOR_V_OVERSAMPLE_BITS>();
+}
+
+// 12V bus voltage, oversampled (0 to 1023 << SENSOR_V_OVERSAMPLE_BITS)
+int PiSupplyH::getWideRawV12() {
+  return _sensors.average<V12_INDEX, SENSOR_V_OVERSAMPLE_BITS>();
+}
+
 // Fully-Formatted Sensor Accessor Functions --------------------------------------
 
 // returns the averaged VCC value
@@ -221,59 +258,69 @@ int PiSupplyH::getVCC() {
 
 // returns the averaged 48V input bus voltage value in mV
 unsigned int PiSupplyH::getV48() {
-  return raw2mV(getRawV48());
+  return raw2mV(getWideRawV48(), SENSOR_V_OVERSAMPLE_BITS);
 }
 
 // returns the averaged 12V bus voltage value in mA
 int PiSupplyH::getV12() {
-  return raw2mV(getRawV12());
+  return raw2mV(getWideRawV12(), SENSOR_V_OVERSAMPLE_BITS);
 }
 
 // returns the averaged 0-5000mV value of a analog GPIO pin (0, 1, 6, 7)
 int PiSupplyH::getAnalog(int analogInd) {
-  return (long)getRawAnalog(analogInd)*getVCC()/1024;
+  return raw2mVADC(getRawAnalog(analogInd));
 }
 
 // Conversion Utility Functions ---------------------------------------
 
 // converts a raw 10-bit analog reading (0-1023) to the actual mV (0-65000)
-unsigned int PiSupplyH::raw2mV(int raw) {
-  long numerator = (long)raw*getVCC()*13;
-  return (unsigned int)(numerator/1024); // analogRead*VCC/1024 * (120k+10k)/10k
+//  oversampled readings (0 to 1023 << extraBits) are scaled by the extra bits
+unsigned int PiSupplyH::raw2mV(int raw, uint8_t extraBits) {
+  long numerator = (long)raw*_raw2mVScale;
+  return (unsigned int)(numerator >> (10 + extraBits)); // analogRead*VCC/1024 * (120k+10k)/10k
 }
 
 // converts a raw 10-bit analog reading (0-1023) to ADC mV reading (0-5000)
-int PiSupplyH::raw2mVADC(int raw) {
+int PiSupplyH::raw2mVADC(int raw, uint8_t extraBits) {
   long rawL = (long)raw;
-  return (int)(rawL*getVCC()/1024); // analogRead*VCC/1024
+  return (int)((rawL*getVCC()) >> (10 + extraBits)); // analogRead*VCC/1024
 }
 
 // converts a raw 10-bit analog reading centered on zero (-512 to 512) to a mA reading (-5000 to 5000)
 //  for MT9221CT-06BR5 current sensor with VCC=5V, sensitivity is 333mV/A, 0A at 2.5V
 //  with variable VCC, sensitivity (mV/mA) is VCC/5000*333/1000, 0A at VCC/2
-int PiSupplyH::raw2mA(int raw) {
+int PiSupplyH::raw2mA(int raw, uint8_t extraBits) {
   long rawL = (long)raw;
   // (analogRead-512) * VCC/1024 * 1/sensitivity = (analogRead-512) * VCC/1024 * 1000/333
-  return rawL*getVCC()*3/1024;
+  return (rawL*_raw2mAScale) >> (10 + extraBits);
 }
 
-// converts a mV value (0-65000) to raw 10-bit form (0-1023)
-int PiSupplyH::mV2raw(unsigned int mV) { // mV * 10k/(10k+120k) * 1024/VCC
-  long temp = (long)mV * 79 / getVCC();
+// converts a mV value (0-65000) to raw 10-bit form (0-1023), or oversampled form (0 to 1023 << extraBits)
+int PiSupplyH::mV2raw(unsigned int mV, uint8_t extraBits) { // mV * 10k/(10k+120k) * 1024/VCC
+  long temp = ((long)mV*_mV2rawScale) >> (MV2RAW_Q - extraBits);
   return (int)(temp);
 }
 
 // converts a mA value (-5000 to 5000) to raw 10-bit form centered around 0 (-512 to 512)
-int PiSupplyH::mA2raw(int mA) {
+int PiSupplyH::mA2raw(int mA, uint8_t extraBits) {
   // mA * sensitivity * 1024/VCC = mA * 333/1000 * 1024/VCC
-  long temp = (long)mA*341/getVCC();
+  long temp = ((long)mA*_mA2rawScale) >> (MA2RAW_Q - extraBits);
   return (int)temp;
 }
 
+// caches the VCC-dependent conversion factors, so that conversions need no division
+void PiSupplyH::updateConversionScales() {
+  _raw2mVScale = (long)_vcc*13;
+  _raw2mAScale = (long)_vcc*3;
+  _mV2rawScale = (1L << (10 + MV2RAW_Q))/(13L*_vcc);
+  _mA2rawScale = (341L << MA2RAW_Q)/_vcc;
+}
+
 // Sensor Private Utility Functions ---------------------------------------
 
 // returns the official VCC voltage in milliVolts
 int PiSupplyH::readVCC() {
+  bool isScanning = pauseADCScan(); // the scan engine must not switch channels during this reading
   // reads 1.1V reference against AVcc
   // set the reference to Vcc and the measurement to the internal 1.1V reference
   #if defined(__AVR_ATmega32U4__) || defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
@@ -293,8 +340,9 @@ int PiSupplyH::readVCC() {
  
   long result = (high<<8) | low;
  
-  result = 1126400L / result; // https://github.com/openenergymonitor/EmonLib/blob/master/EmonLib.h
-  // result = 1125300L / result; // Calculate Vcc (in mV); 1125300 = 1.1*1023*1000
+  result = _bandgapScale / result; // Calculate Vcc (in mV), see _bandgapScale
+  if (isScanning)
+    resumeADCScan();
   return (int)result; // Vcc in millivolts
 }
 
@@ -334,55 +382,28 @@ void PiSupplyH::shutdownAllChannels() {
 
 // Communications ------------------------------------------------------------
 
-// process the parsed RX command, overrides base class virtual function
-// MicroPanel readable registers: RVB, RI1, RI2, RI3, RI4, RIT, RVCC, RCH1, RCH2, RCH3, RCH4
-// MicroPanel writable registers: WCH1, WCH2, WCH3, WCH4, WIL1, WIL2, WIL3, WIL4
-void PiSupplyH::interpretRXCommand(char* command, char* value, int receiveProtocol) {
-  if (strcmp(command, "RV48") == 0) { // read 48V input bus voltage
-    sprintf(getTXBuffer(receiveProtocol), "WV48:%u", getV48());
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "RV12") == 0) { // read 12V bus voltage
-    sprintf(getTXBuffer(receiveProtocol), "WV12:%d", getV12());
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "RVCC") == 0) { // read the ~5V VCC bus voltage
-    sprintf(getTXBuffer(receiveProtocol), "WVCC:%d", getVCC());
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "RCPI") == 0) { // read state of the Pi power channel
-    sprintf(getTXBuffer(receiveProtocol), "WCPI:%d", getChPi());
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "RC5V") == 0) { // read state of the 5V output power channel
-    sprintf(getTXBuffer(receiveProtocol), "WC5V:%d", getCh5V());
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "RCGP") == 0) { // read state of the GPIO power channel
-    sprintf(getTXBuffer(receiveProtocol), "WCGP:%d", getChGPIO());
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "RC12V") == 0) { // read state of the 12V output power channel
-    sprintf(getTXBuffer(receiveProtocol), "WC12V:%d", getCh12V());
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "WCPI") == 0) { // write the desired Pi power channel state
-    int temp = atoi(value);
-    setChPi(temp);
-    sprintf(getTXBuffer(receiveProtocol), "WCPI:=%d", getChPi());
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "WC5V") == 0) { // write the desired 5V output power channel state
-    int temp = atoi(value);
-    setCh5V(temp);
-    sprintf(getTXBuffer(receiveProtocol), "WC5V:=%d", getCh5V());
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "WCGP") == 0) { // write the desired GPIO power channel state
-    int temp = atoi(value);
-    setChGPIO(temp);
-    sprintf(getTXBuffer(receiveProtocol), "WCGP:=%d", getChGPIO());
-    respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "WC12V") == 0) { // write the desired 12V output power channel state
-    int temp = atoi(value);
-    setCh12V(temp);
-    sprintf(getTXBuffer(receiveProtocol), "WC12V:=%d", getCh12V());
-    respondToMaster(receiveProtocol);
-  } else { // send command data to the callback listener functions, registered from primary .ino file
-    for (int n = 0; n < _commandCallbacksEnd; n++) {
-      _commandCallbacks[n](command, value, receiveProtocol);
-    }
+// reads a binary protocol register, overrides base class virtual function
+bool PiSupplyH::readRegister(uint8_t reg, int* value) {
+  switch (reg) {
+    case BINREG_V48: *value = getV48(); return true;
+    case BINREG_V12: *value = getV12(); return true;
+    case BINREG_VCC: *value = getVCC(); return true;
+    case BINREG_CPI: *value = getChPi(); return true;
+    case BINREG_C5V: *value = getCh5V(); return true;
+    case BINREG_CGP: *value = getChGPIO(); return true;
+    case BINREG_C12V: *value = getCh12V(); return true;
+    default: return PicroBoard::readRegister(reg, value);
+  }
+}
+
+// writes a binary protocol register, overrides base class virtual function
+bool PiSupplyH::writeRegister(uint8_t reg, int value) {
+  switch (reg) {
+    case BINREG_CPI: setChPi(value); return true;
+    case BINREG_C5V: setCh5V(value); return true;
+    case BINREG_CGP: setChGPIO(value); return true;
+    case BINREG_C12V: setCh12V(value); return true;
+    default: return PicroBoard::writeRegister(reg, value);
   }
 }
 
@@ -10,6 +10,7 @@
 #define PiSupplyH_h
 
 #include "PicroBoard.h"
+#include "SensorBank.h"
 
 // In Arduino IDE, go to Sketch -> Include Library -> Manage Libraries
 #include <TimerOne.h> // In Library Manager, search for "TimerOne"
@@ -50,7 +51,7 @@ enum SensorIndex
     NUM_SENSORS
 };
 
-// moving average sample window length for sensors. Best to use powers of 2 so as to optimize division
+// moving average sample window length for sensors, rounded down to a power of 2 so that averages use a bit-shift
 //  use this before #include to override in the .ino file: #define XXX YY
 //  e.g. to set current averaging window to size 32: #define SENSOR_I_WINDOW_MAX 32
 #ifndef SENSOR_V_WINDOW_MAX
@@ -67,6 +68,29 @@ constexpr int AVERAGE_WINDOW_MAX[NUM_SENSORS] = {
   SENSOR_A_WINDOW_MAX,
   SENSOR_A_WINDOW_MAX
 };
+// oversampling bits for the widened raw accessors, e.g. getWideRawV48(), added to the 10-bit ADC resolution
+//  the moving average sum of 4^n samples decimates to n extra bits, so n can be at most half the window bit-shift
+//    e.g. the default 32 sample windows allow up to 2 extra bits (12-bit readings): #define SENSOR_V_OVERSAMPLE_BITS 2
+//  oversampling relies on the natural noise of the sensors, which must span at least one 10-bit LSB
+//  off (0) by default, so getV48(), RV48 and RALL keep their 10-bit readings unless the sketch opts in
+#ifndef SENSOR_V_OVERSAMPLE_BITS
+#define SENSOR_V_OVERSAMPLE_BITS 0
+#endif
+// sensor moving averages, one channel per SensorIndex
+typedef SensorBank<sensorWindowShift(SENSOR_V_WINDOW_MAX), sensorWindowShift(SENSOR_V_WINDOW_MAX),
+  sensorWindowShift(SENSOR_A_WINDOW_MAX), sensorWindowShift(SENSOR_A_WINDOW_MAX),
+  sensorWindowShift(SENSOR_A_WINDOW_MAX), sensorWindowShift(SENSOR_A_WINDOW_MAX)> PiSupplySensorBank;
+
+// binary protocol register IDs, each mirroring the ASCII command of the same name (R = readable, W = writable)
+enum PiSupplyRegisters
+{   BINREG_V48 = 0x01, // R: 48V input bus voltage (mV, unsigned)
+    BINREG_V12, // R: 12V bus voltage (mV)
+    BINREG_VCC, // R: VCC voltage (mV)
+    BINREG_CPI, // RW: Pi power channel state (0 or 1)
+    BINREG_C5V, // RW: 5V output power channel state (0 or 1)
+    BINREG_CGP, // RW: GPIO power channel state (0 or 1)
+    BINREG_C12V // RW: 12V output power channel state (0 or 1)
+};
 
 class PiSupplyH : public PicroBoard
 {
@@ -92,15 +116,21 @@ class PiSupplyH : public PicroBoard
     int getChGPIO(); // gets the state of GPIO output power channel
     int getCh12V(); // gets the state of 12V output power channel
   // raw sensor values
-    void updateVCC(); // updates stored VCC value based on an average
+    void updateVCC(); // updates stored VCC value based on an average, blocks for ~8 ms (see updateVCCAsync())
+    void applyVCC(int vcc) override; // stores a measured VCC (mV) and updates the conversion scales
     void updateVSensors(); // updates voltage sensor averages
     void updateASensor(int sensor); // updates a single analog GPIO sensor average (0, 1, 6, or 7)
     void updateASensors(); // updates all analog GPIO sensor averages
     void updateSensors(); // updates all sensor averages
+    using PicroBoard::startADCScan;
+    void startADCScan(); // samples every sensor from the ADC interrupt instead of blocking reads
+    void updateScanSample(uint8_t sensorIndex, int sample) override; // feeds one scanned sample into the averages
     int readVCC(); // returns the sampled VCC voltage in milliVolts
     int getRawV48(); // gets 48V input bus voltage ADC value (0 to 1023)
     int getRawV12(); // gets 12V bus voltage value (0 to 1023)
     int getRawAnalog(int analogInd); // gets analog GPIO pin voltage (0 to 1023)
+    int getWideRawV48(); // gets oversampled 48V input bus voltage (0 to 1023 << SENSOR_V_OVERSAMPLE_BITS)
+    int getWideRawV12(); // gets oversampled 12V bus voltage (0 to 1023 << SENSOR_V_OVERSAMPLE_BITS)
   // fully-formatted sensors
     int getVCC(); // returns the averaged VCC value
     unsigned int getV48(); // returns the averaged 48V input bus voltage mV value
@@ -111,27 +141,23 @@ class PiSupplyH : public PicroBoard
     void setLED1(int state); // sets LED1 (yellow) to HIGH or LOW
     void setLED2(int state); // sets LED2 (green) to HIGH or LOW
   // conversion utility functions
-    unsigned int raw2mV(int raw); // converts ADC reading to mV voltage scaled by resistor divider
-    int raw2mVADC(int raw); // converts ADC reading to mV voltage at ADC
-    int raw2mA(int raw); // converts raw ADC current sense output to mA
-    int mV2raw(unsigned int mV); // converts a mV value to raw 10-bit form
-    int mA2raw(int mA); // converts a mA value to raw 10-bit form
+    unsigned int raw2mV(int raw, uint8_t extraBits = 0); // converts ADC reading (10 + extraBits wide) to mV voltage scaled by resistor divider
+    int raw2mVADC(int raw, uint8_t extraBits = 0); // converts ADC reading (10 + extraBits wide) to mV voltage at ADC
+    int raw2mA(int raw, uint8_t extraBits = 0); // converts raw ADC current sense output (10 + extraBits wide) to mA
+    int mV2raw(unsigned int mV, uint8_t extraBits = 0); // converts a mV value to raw (10 + extraBits)-bit form
+    int mA2raw(int mA, uint8_t extraBits = 0); // converts a mA value to raw (10 + extraBits)-bit form
   // communications
-    void interpretRXCommand(char* command, char* value, int receiveProtocol) override; // process RX command
+    bool readRegister(uint8_t reg, int* value) override; // reads a binary protocol register
+    bool writeRegister(uint8_t reg, int value) override; // writes a binary protocol register
   private:
     // sensors and averaging
-    int _sensorAverages[NUM_SENSORS]; // array raw sensor moving averages
-    long _sensorAccumulators[NUM_SENSORS];
-    int _sensorIterators[NUM_SENSORS];
-    int _sensorPastV48[AVERAGE_WINDOW_MAX[V48_INDEX]]; // array raw sensor moving averages
-    int _sensorPastV12[AVERAGE_WINDOW_MAX[V12_INDEX]]; // array raw sensor moving averages
-    int _sensorPastA0[AVERAGE_WINDOW_MAX[A0_INDEX]]; // array raw sensor moving averages
-    int _sensorPastA1[AVERAGE_WINDOW_MAX[A1_INDEX]]; // array raw sensor moving averages
-    int _sensorPastA6[AVERAGE_WINDOW_MAX[A6_INDEX]]; // array raw sensor moving averages
-    int _sensorPastA7[AVERAGE_WINDOW_MAX[A7_INDEX]]; // array raw sensor moving averages
+    PiSupplySensorBank _sensors; // raw sensor moving averages
     int _vcc; // stored value of vcc measured at start up and/or periodically
-    // functions
-    void updateSensorRaw(int index, int sample); // updates the raw averaged sensor value
+    long _raw2mVScale; // VCC*13, cached by updateConversionScales()
+    long _raw2mAScale; // VCC*3, cached by updateConversionScales()
+    long _mV2rawScale; // 2^(10 + MV2RAW_Q)/(13*VCC), cached by updateConversionScales()
+    long _mA2rawScale; // 341*2^MA2RAW_Q/VCC, cached by updateConversionScales()
+    void updateConversionScales(); // caches the VCC-dependent conversion factors
 };
 
 #endif
@@ -8,7 +8,23 @@
 
 #include "PicroBoard.h"
 
+// ASCII command table common to all boards, sorted by mnemonic for binary search
+//  searched after the board command table, so a board may override any of these
+const RegisterCommandEntry PICROBOARD_COMMANDS[] PROGMEM = {
+  {"RCQD", BINREG_QUEUEDEPTH, REGCMD_READ}, // read the peak deferred command queue depth
+  {"RCQW", BINREG_QUEUEWAIT, REGCMD_READ | REGCMD_UNSIGNED}, // read the worst-case command queue wait (us)
+  {"RCSE", BINREG_COMMSTATS, REGCMD_READ | REGCMD_UNSIGNED}, // read the total communication event count
+  {"RSTD", BINREG_STREAMDECIMATION, REGCMD_READ}, // read the stream decimation (0 if not streaming)
+  {"RSTM", BINREG_STREAMMASK, REGCMD_READ | REGCMD_UNSIGNED}, // read the stream register mask
+  {"WCQR", BINREG_QUEUEDEPTH, REGCMD_WRITE}, // reset the command queue statistics
+  {"WCSR", BINREG_COMMSTATS, REGCMD_WRITE}, // reset the communication health statistics
+  {"WSTD", BINREG_STREAMDECIMATION, REGCMD_WRITE}, // start streaming every n control updates, 0 stops
+  {"WSTM", BINREG_STREAMMASK, REGCMD_WRITE | REGCMD_UNSIGNED} // select the snapshot entries to stream
+};
+
 PicroBoard::PicroBoard() {
+  resetCommStats();
+  addTransferBlock(COMMSTATSBLOCK, (uint8_t*)_commStats, sizeof(_commStats), false, NULL);
 }
 
 // adds a serial command callback to the array
@@ -19,27 +35,740 @@ void PicroBoard::addCommandCallback(CommandCallback callback) {
   }
 }
 
+// adds a binary register callback to the array
+void PicroBoard::addRegisterCallback(RegisterCallback callback) {
+  if (_registerCallbacksEnd < REGISTERCALLBACKSMAXLENGTH) {
+    _registerCallbacks[_registerCallbacksEnd] = callback;
+    _registerCallbacksEnd++;
+  }
+}
+
+// sets the sketch command dispatch table, stored in flash (PROGMEM) and sorted by command mnemonic
+//  an unsorted table still works, but is searched linearly
+void PicroBoard::setCommandTable(const CommandEntry* table, int length) {
+  _sketchCommands = table;
+  _sketchCommandsLength = length;
+  _sketchCommandsSorted = true;
+  char previous[COMMANDMNEMONICSIZE];
+  for (int n = 1; n < length; n++) {
+    strncpy_P(previous, table[n - 1].command, COMMANDMNEMONICSIZE); // strcmp_P needs one argument in RAM
+    if (strcmp_P(previous, table[n].command) >= 0)
+      _sketchCommandsSorted = false;
+  }
+}
+
 // parses the given rxBuffer and calls the appropriate valueFunction cooresponding to the command
+//  the buffer is split in place without strtok(), which is not reentrant: the I2C interrupt may parse a line
+//  while loop() is parsing a UART line
 void PicroBoard::parseRXLine(char* buffer, int receiveProtocol) {
-  char* command = strtok(buffer, ":");
-  char* value = strtok(NULL, "\n");
-  interpretRXCommand(command, value, receiveProtocol);
+  unsigned long startMicros = micros();
+  char* command = buffer;
+  char* value = strchr(buffer, ':');
+  if (value != NULL) {
+    *value = '\0';
+    value++;
+  }
+  char* end = strchr((value != NULL) ? value : command, '\n');
+  if (end != NULL)
+    *end = '\0';
+  if (value != NULL && value[0] == '\0')
+    value = NULL;
+  if (command[0] == '\0') {
+    if (value != NULL) // e.g. ":5", a value without a command
+      countCommEvent(receiveProtocol, COMMSTAT_PARSEERRORS);
+    return;
+  }
+  if (strcmp(command, "WBIN") == 0) { // negotiate the binary register protocol on this link
+    int temp = (value != NULL) ? atoi(value) : BINARY_PROTOCOL;
+    sprintf(getTXBuffer(receiveProtocol), "WBIN:=%d", temp);
+    respondToMaster(receiveProtocol); // reply in ASCII, then switch the link
+    setLinkProtocol(receiveProtocol, temp);
+  } else if (strcmp(command, "RALL") == 0) { // bulk snapshot of every board sensor and state
+    respondSnapshot(receiveProtocol);
+  } else if (strcmp(command, "RCST") == 0 || strcmp(command, "RCSC") == 0) { // communication health
+    respondCommStats(command, value, receiveProtocol);
+  } else {
+    interpretRXCommand(command, value, receiveProtocol);
+  }
+  recordHandlerTime(receiveProtocol, command, 0, startMicros);
 }
 
-// processes RX command, override it with something useful to the particular board
+// parses a line given as a (pointer, length) view, e.g. into the UART ring buffer, without copying it
+//  line[length] is overwritten with a null terminator, so it must be writable (normally the '\n' terminator)
+void PicroBoard::parseRXLine(char* line, int length, int receiveProtocol) {
+  line[length] = '\0';
+  parseRXLine(line, receiveProtocol);
+}
+
+// processes RX command, looking it up in the board command table, then the sketch command table
+//  commands found in neither are sent to the catch-all callback listener functions
 void PicroBoard::interpretRXCommand(char* command, char* value, int receiveProtocol) {
-  // program should never get to here
+  int index = findCommand(command, _boardCommands, _boardCommandsLength, sizeof(RegisterCommandEntry), true);
+  if (index >= 0) {
+    const RegisterCommandEntry* entry = &_boardCommands[index];
+    interpretRegisterCommand(command, value, receiveProtocol,
+      pgm_read_byte(&entry->reg), pgm_read_byte(&entry->format));
+    return;
+  }
+  index = findCommand(command, PICROBOARD_COMMANDS, sizeof(PICROBOARD_COMMANDS)/sizeof(PICROBOARD_COMMANDS[0]),
+    sizeof(RegisterCommandEntry), true);
+  if (index >= 0) {
+    const RegisterCommandEntry* entry = &PICROBOARD_COMMANDS[index];
+    interpretRegisterCommand(command, value, receiveProtocol,
+      pgm_read_byte(&entry->reg), pgm_read_byte(&entry->format));
+    return;
+  }
+  index = findCommand(command, _sketchCommands, _sketchCommandsLength, sizeof(CommandEntry), _sketchCommandsSorted);
+  if (index >= 0) {
+    CommandHandler handler = (CommandHandler)pgm_read_ptr(&_sketchCommands[index].handler);
+    handler(value, receiveProtocol);
+    return;
+  }
+  // send command data to the callback listener functions, registered from primary .ino file
+  if (_commandCallbacksEnd == 0) // no listener could handle it
+    countCommEvent(receiveProtocol, COMMSTAT_UNKNOWN);
+  for (int n = 0; n < _commandCallbacksEnd; n++) {
+    _commandCallbacks[n](command, value, receiveProtocol);
+  }
+}
+
+// responds to an ASCII command mapped onto a binary register by the board command table
+void PicroBoard::interpretRegisterCommand(char* command, char* value, int receiveProtocol,
+    uint8_t reg, uint8_t format) {
+  int temp = 0;
+  if (format & REGCMD_WRITE) {
+    temp = (value != NULL) ? atoi(value) : 0;
+    writeRegister(reg, temp);
+    if (format & REGCMD_READBACK)
+      readRegister(reg, &temp);
+    sprintf(getTXBuffer(receiveProtocol), (format & REGCMD_UNSIGNED) ? "%s:=%u" : "%s:=%d", command, temp);
+  } else {
+    readRegister(reg, &temp);
+    // respond with the write form of the command, e.g. "RV1" responds "WV1:value"
+    sprintf(getTXBuffer(receiveProtocol), (format & REGCMD_UNSIGNED) ? "W%s:%u" : "W%s:%d", command + 1, temp);
+  }
+  respondToMaster(receiveProtocol);
+}
+
+// responds to "RALL" with every snapshot register, latched at the same instant
+//  over UART: "WALL:value0,value1,...", which is longer than COMMBUFFERSIZE so it is printed directly
+//  over I2C: the binary snapshot frame, since the text form would not fit in the 32-byte Wire buffer
+//  each link latches into its own frame, so a UART RALL never overwrites a frame the I2C master has not read yet
+void PicroBoard::respondSnapshot(int receiveProtocol) {
+  if (receiveProtocol == I2C_INDEX) {
+    publishI2C(NULL, _snapshotFrameI2C, latchSnapshot(_snapshotFrameI2C));
+    return;
+  }
+  uint8_t frame[SNAPSHOTFRAMESIZE];
+  latchSnapshot(frame);
+  Serial.print("WALL:");
+  for (int n = 0; n < frame[1]; n++) {
+    uint16_t value = (uint16_t)frame[2 + 2*n] | ((uint16_t)frame[3 + 2*n] << 8);
+    if (n > 0)
+      Serial.print(",");
+    if (pgm_read_byte(&_snapshotRegisters[n].format) & REGCMD_UNSIGNED)
+      Serial.print((long)value);
+    else
+      Serial.print((long)(int16_t)value);
+  }
+  Serial.println();
+}
+
+// returns the index of command in a PROGMEM table whose entries each start with a command mnemonic, or -1
+//  sorted tables use a binary search, unsorted tables a linear search
+int PicroBoard::findCommand(const char* command, const void* table, int length, int entrySize, bool isSorted) {
+  if (table == NULL || command == NULL)
+    return -1;
+  const char* entries = (const char*)table;
+  if (!isSorted) {
+    for (int n = 0; n < length; n++) {
+      if (strcmp_P(command, entries + n*entrySize) == 0)
+        return n;
+    }
+    return -1;
+  }
+  int low = 0;
+  int high = length - 1;
+  while (low <= high) {
+    int mid = (low + high) >> 1;
+    int comparison = strcmp_P(command, entries + mid*entrySize);
+    if (comparison == 0)
+      return mid;
+    else if (comparison < 0)
+      high = mid - 1;
+    else
+      low = mid + 1;
+  }
+  return -1;
+}
+
+// Communication Health Statistics -------------------------------------------
+
+// gets one communication health statistic (a CommStatField) of a link, saturated to 16 bits
+//  handler times are in microseconds, and are 0 until the first timed command
+unsigned int PicroBoard::getCommStat(int commIndex, int field) {
+  if (commIndex < 0 || commIndex >= NUM_COMM_MODULES || field < 0 || field >= NUM_COMMSTATS)
+    return 0;
+  CommStats* stats = &_commStats[commIndex];
+  uint8_t oldSREG = SREG; // the I2C interrupt updates the statistics too
+  cli();
+  unsigned long value;
+  if (field < COMMSTAT_HANDLERCOUNT)
+    value = stats->events[field];
+  else if (stats->handlerCount == 0)
+    value = 0;
+  else if (field == COMMSTAT_HANDLERCOUNT)
+    value = stats->handlerCount;
+  else if (field == COMMSTAT_HANDLERMIN)
+    value = stats->handlerMinMicros;
+  else if (field == COMMSTAT_HANDLERMAX)
+    value = stats->handlerMaxMicros;
+  else
+    value = stats->handlerTotalMicros / stats->handlerCount;
+  SREG = oldSREG;
+  return (value > 65535UL) ? 65535U : value;
+}
+
+// gets the command that took the longest handler time on a link, "#xx" for binary register xx (hex)
+const char* PicroBoard::getCommSlowestCommand(int commIndex) {
+  if (commIndex < 0 || commIndex >= NUM_COMM_MODULES)
+    return "";
+  return _commStats[commIndex].handlerMaxCommand;
+}
+
+// resets the communication health statistics of both links
+void PicroBoard::resetCommStats() {
+  uint8_t oldSREG = SREG;
+  cli();
+  memset(_commStats, 0, sizeof(_commStats));
+  for (int n = 0; n < NUM_COMM_MODULES; n++)
+    _commStats[n].handlerMinMicros = 0xFFFF;
+  SREG = oldSREG;
+}
+
+// increments an event counter (COMMSTAT_OVERFLOWS to COMMSTAT_EMPTYREQUESTS) of a link, saturating at 65535
+void PicroBoard::countCommEvent(int commIndex, int field) {
+  uint8_t oldSREG = SREG; // called from both loop() and the I2C interrupt
+  cli();
+  if (_commStats[commIndex].events[field] < 0xFFFF)
+    _commStats[commIndex].events[field]++;
+  SREG = oldSREG;
+}
+
+// records the time a command handler took, from startMicros until now
+//  command is the ASCII mnemonic, or NULL for binary register reg
+void PicroBoard::recordHandlerTime(int commIndex, const char* command, uint8_t reg, unsigned long startMicros) {
+  unsigned long elapsed = micros() - startMicros;
+  unsigned int micro = (elapsed > 65535UL) ? 65535U : elapsed;
+  CommStats* stats = &_commStats[commIndex];
+  uint8_t oldSREG = SREG;
+  cli();
+  stats->handlerCount++;
+  stats->handlerTotalMicros += micro;
+  if (micro < stats->handlerMinMicros)
+    stats->handlerMinMicros = micro;
+  if (micro >= stats->handlerMaxMicros) {
+    stats->handlerMaxMicros = micro;
+    if (command != NULL) {
+      strncpy(stats->handlerMaxCommand, command, COMMANDMNEMONICSIZE - 1);
+      stats->handlerMaxCommand[COMMANDMNEMONICSIZE - 1] = '\0';
+    } else {
+      sprintf(stats->handlerMaxCommand, "#%02X", reg);
+    }
+  }
+  SREG = oldSREG;
+}
+
+// responds to "RCST:<link><field>" with one statistic, and to "RCSC:<link>" with the slowest command
+void PicroBoard::respondCommStats(const char* command, const char* value, int receiveProtocol) {
+  int selector = (value != NULL) ? atoi(value) : 0;
+  if (strcmp(command, "RCSC") == 0) {
+    sprintf(getTXBuffer(receiveProtocol), "WCSC:%s", getCommSlowestCommand(selector));
+  } else {
+    sprintf(getTXBuffer(receiveProtocol), "WCST:%u", getCommStat(selector / 10, selector % 10));
+  }
+  respondToMaster(receiveProtocol);
+}
+
+// Telemetry Stream ----------------------------------------------------------
+
+// starts pushing stream frames of the snapshot registers selected by mask, one every decimation control updates
+//  e.g. with a 1ms control interrupt, startStream(5, 0x000F) pushes the first four snapshot values at 200 Hz
+//  a decimation of 0 stops the stream
+void PicroBoard::startStream(unsigned int decimation, unsigned int mask) {
+  _streamMask = mask;
+  _streamCounter = decimation;
+  _streamDecimation = decimation;
+}
+
+// starts pushing stream frames of every snapshot register, one every decimation control updates
+void PicroBoard::startStream(unsigned int decimation) {
+  startStream(decimation, 0xFFFF);
+}
+
+// stops pushing stream frames
+void PicroBoard::stopStream() {
+  _streamDecimation = 0;
+}
+
+// latches a stream frame every decimation calls, call this from the control interrupt
+//  the frame is only latched here; processUART() writes it out, so this takes no time when not streaming
+void PicroBoard::updateStream() {
+  if (_streamDecimation == 0 || --_streamCounter > 0)
+    return;
+  _streamCounter = _streamDecimation;
+  unsigned int sequence = _streamSequence++;
+  if (_streamLength > 0) { // the previous frame has not been sent yet, the sequence gap marks the drop
+    _streamDrops++;
+    return;
+  }
+  unsigned long timestamp = millis();
+  int count = 0;
+  for (int n = 0; n < _snapshotLength && n < SNAPSHOTMAXREGISTERS; n++) {
+    if (!(_streamMask & (1U << n)))
+      continue;
+    int value = 0;
+    readRegister(pgm_read_byte(&_snapshotRegisters[n].reg), &value);
+    _streamFrame[8 + 2*count] = (uint16_t)value & 0xFF;
+    _streamFrame[9 + 2*count] = (uint16_t)value >> 8;
+    count++;
+  }
+  _streamFrame[0] = STREAMFRAMEID;
+  _streamFrame[1] = sequence & 0xFF;
+  _streamFrame[2] = sequence >> 8;
+  for (int n = 0; n < 4; n++)
+    _streamFrame[3 + n] = (timestamp >> (8*n)) & 0xFF;
+  _streamFrame[7] = count;
+  _streamFrame[8 + 2*count] = crc8(_streamFrame, 8 + 2*count);
+  _streamLength = 9 + 2*count; // publish the frame only once it is complete
+}
+
+// gets the number of stream frames dropped because the UART could not keep up
+//  raise the baud rate with startUART(baud), select fewer registers, or raise the decimation to avoid drops
+unsigned int PicroBoard::getStreamDrops() {
+  return _streamDrops;
+}
+
+// writes out a latched stream frame once the UART transmit buffer has room, so that loop() never blocks on it
+void PicroBoard::sendStreamUART() {
+  uint8_t length = _streamLength;
+  if (length == 0 || Serial.availableForWrite() < length)
+    return;
+  Serial.write(_streamFrame, length);
+  _streamLength = 0; // release the frame back to updateStream()
+}
+
+// Interrupt-Driven ADC Scan Engine ------------------------------------------
+
+PicroBoard* PicroBoard::_adcScanBoard = NULL;
+
+// the ADC conversion complete interrupt only runs while a scan is active (ADIE is otherwise clear)
+ISR(ADC_vect) {
+  PicroBoard::adcCompleteEvent();
+}
+
+// starts scanning a PROGMEM channel list from the ADC conversion complete interrupt, see ADCScanChannel
+//  only one board per sketch owns the ADC, so the latest call wins
+void PicroBoard::startADCScan(const ADCScanChannel* channels, int length) {
+  if (channels == NULL || length <= 0)
+    return;
+  stopADCScan();
+  _adcScanChannels = channels;
+  _adcScanLength = length;
+  _adcScanBoard = this;
+  resumeADCScan();
+}
+
+// stops the scan once the conversion in flight completes, analogRead() may then be used again
+void PicroBoard::stopADCScan() {
+  pauseADCScan();
+}
+
+// returns true while the scan engine owns the ADC
+bool PicroBoard::isADCScanRunning() {
+  return _isADCScanRunning;
+}
+
+// gets the number of scanned samples since startup, e.g. to measure the per-channel sample rate
+unsigned long PicroBoard::getADCScanCount() {
+  uint8_t oldSREG = SREG;
+  cli();
+  unsigned long count = _adcScanCount;
+  SREG = oldSREG;
+  return count;
+}
+
+// feeds one scanned sample into the board sensor averages, override it with the particular board
+void PicroBoard::updateScanSample(uint8_t sensorIndex, int sample) {
+}
+
+// handles the ADC conversion complete interrupt: starts the next conversion first, so the ADC is never idle
+//  while the sample is averaged, then hands the finished sample to the board
+//  a requested VCC measurement takes over the ADC in between two scan conversions
+void PicroBoard::adcCompleteEvent() {
+  PicroBoard* board = _adcScanBoard;
+  if (board == NULL)
+    return;
+  if (board->_vccState == VCCSETTLING || board->_vccState == VCCCONVERTING) {
+    board->updateVCCConversion(ADC);
+    return;
+  }
+  if (!board->_isADCScanRunning)
+    return;
+  int sample = ADC;
+  const ADCScanChannel* channel = &board->_adcScanChannels[board->_adcScanIndex];
+  uint8_t sensorIndex = pgm_read_byte(&channel->sensorIndex);
+  sample -= (int)pgm_read_word(&channel->offset);
+  if (++board->_adcScanIndex >= board->_adcScanLength)
+    board->_adcScanIndex = 0;
+  if (board->_vccState == VCCREQUESTED)
+    board->startVCCConversion();
+  else
+    board->startADCScanConversion();
+  board->updateScanSample(sensorIndex, sample);
+  board->_adcScanCount++;
+}
+
+// stops the scan so that the ADC can be read directly (e.g. by readVCC), returns true if it was running
+//  waits for the conversion in flight, at most 13 ADC clocks
+//  a VCC measurement in progress is abandoned
+bool PicroBoard::pauseADCScan() {
+  bool isScanning = _isADCScanRunning;
+  if (!isScanning && !isVCCUpdateRunning())
+    return false;
+  _isADCScanRunning = false; // the interrupt starts no further conversions
+  ADCSRA &= ~_BV(ADIE);
+  while (bit_is_set(ADCSRA, ADSC)); // let the conversion in flight finish
+  ADCSRA |= _BV(ADIF); // and discard it
+  if (isVCCUpdateRunning()) {
+    if (!isScanning && _vccState != VCCREQUESTED)
+      ADCSRA = _vccSavedADCSRA & ~_BV(ADIE);
+    _vccState = VCCIDLE;
+  }
+  return isScanning;
+}
+
+// restarts the scan after pauseADCScan(), from the first channel
+void PicroBoard::resumeADCScan() {
+  if (_adcScanChannels == NULL)
+    return;
+  _adcScanIndex = 0;
+  _isADCScanRunning = true;
+  ADCSRA = _BV(ADEN) | _BV(ADIE) | _BV(ADIF) | (_adcScanPrescalerBS & 0x07); // single conversions, clear ADIF
+  startADCScanConversion();
+}
+
+// selects the current scan channel and starts its conversion. AVcc is the reference, as with analogRead()
+void PicroBoard::startADCScanConversion() {
+  uint8_t pin = pgm_read_byte(&_adcScanChannels[_adcScanIndex].pin);
+  if (pin >= A0)
+    pin -= A0;
+  ADMUX = _BV(REFS0) | (pin & 0x07);
+  armADCScanTrigger();
+}
+
+// starts the selected scan conversion at once, override it with the particular board to start it on a timer event
+//  (e.g. at a fixed phase of the switching period); the ADC interrupt enable (ADIE) is clear once the scan pauses
+void PicroBoard::armADCScanTrigger() {
+  ADCSRA |= _BV(ADSC);
+}
+
+// returns true while the ADC interrupt owns the ADC, i.e. while scanning or measuring VCC
+//  the board update functions (e.g. updateVISensors) must not call analogRead() then
+bool PicroBoard::isADCBusy() {
+  return _isADCScanRunning || isVCCUpdateRunning();
+}
+
+// Timed Pin Pulses ----------------------------------------------------------
+
+PicroBoard* PicroBoard::_controlBoard = NULL;
+void (*PicroBoard::_controlFunction)(void) = NULL;
+
+// control timer tick: releases expired pin pulses, runs the sketch control function, then the board tick update
+void PicroBoard::controlInterrupt() {
+  if (_controlBoard != NULL)
+    _controlBoard->updatePinPulses();
+  if (_controlFunction != NULL)
+    _controlFunction();
+  if (_controlBoard != NULL)
+    _controlBoard->updateControlTick();
+}
+
+// runs at the end of every control timer tick, after the sketch control function, override it with the particular board
+void PicroBoard::updateControlTick() {
+}
+
+// sets the sketch function run by controlInterrupt(), from the board initializeInterruptTimer()
+void PicroBoard::setControlFunction(void (*interruptFunction)(void)) {
+  _controlBoard = this;
+  _controlFunction = interruptFunction;
+}
+
+// drives a pin to level at once, and releases it once durationMicros have passed
+//  the release either makes the pin a high-impedance input or drives it to !level
+//  restarting a pulse on a pin that is already pulsing extends it
+//  before the control timer is attached (e.g. in initialize()), nothing would release the pin, so the pulse blocks
+void PicroBoard::startPinPulse(uint8_t pin, uint8_t level, bool isReleasedToInput, unsigned long durationMicros) {
+  startPinPulses(&pin, 1, level, isReleasedToInput, durationMicros);
+}
+
+// drives several pins to level together, and releases them together once durationMicros have passed
+//  if the pulses do not all fit in the free slots, or there is no control timer yet, all the pins share a single
+//  blocking pulse, so that none is held longer than the others
+void PicroBoard::startPinPulses(const uint8_t* pins, uint8_t length, uint8_t level, bool isReleasedToInput,
+  unsigned long durationMicros) {
+  uint8_t oldSREG = SREG;
+  cli();
+  uint8_t newSlots = 0;
+  for (uint8_t p = 0; p < length; p++) {
+    if (!isPinPulsing(pins[p]))
+      newSlots++;
+  }
+  if (_pinPulsesLength + newSlots > PINPULSESMAXLENGTH || _controlBoard != this) { // better a blocking pulse than none
+    SREG = oldSREG;
+    for (uint8_t p = 0; p < length; p++) {
+      pinMode(pins[p], OUTPUT);
+      digitalWrite(pins[p], level);
+    }
+    delayMicroseconds(durationMicros);
+    for (uint8_t p = 0; p < length; p++) {
+      if (isReleasedToInput)
+        pinMode(pins[p], INPUT);
+      else
+        digitalWrite(pins[p], !level);
+    }
+    return;
+  }
+  unsigned long startMicros = micros();
+  for (uint8_t p = 0; p < length; p++) {
+    int n = 0;
+    while (n < _pinPulsesLength && _pinPulses[n].pin != pins[p])
+      n++;
+    pinMode(pins[p], OUTPUT);
+    digitalWrite(pins[p], level);
+    _pinPulses[n].pin = pins[p];
+    _pinPulses[n].level = level;
+    _pinPulses[n].isReleasedToInput = isReleasedToInput;
+    _pinPulses[n].startMicros = startMicros;
+    _pinPulses[n].durationMicros = durationMicros;
+    if (n == _pinPulsesLength)
+      _pinPulsesLength++;
+  }
+  SREG = oldSREG;
+}
+
+// ends a pulse early, releasing the pin now
+void PicroBoard::releasePinPulse(uint8_t pin) {
+  endPinPulse(pin, true);
+}
+
+// forgets a pulse without touching the pin, e.g. when the pin is about to be set another way
+void PicroBoard::cancelPinPulse(uint8_t pin) {
+  endPinPulse(pin, false);
+}
+
+// returns true while a pin is held by a pulse
+bool PicroBoard::isPinPulsing(uint8_t pin) {
+  uint8_t oldSREG = SREG;
+  cli();
+  bool isPulsing = false;
+  for (int n = 0; n < _pinPulsesLength; n++)
+    if (_pinPulses[n].pin == pin)
+      isPulsing = true;
+  SREG = oldSREG;
+  return isPulsing;
+}
+
+// releases every pulse whose duration has passed, takes a few microseconds when no pulse is in progress
+void PicroBoard::updatePinPulses() {
+  if (_pinPulsesLength == 0)
+    return;
+  unsigned long now = micros();
+  uint8_t oldSREG = SREG;
+  cli();
+  int n = 0;
+  while (n < _pinPulsesLength) {
+    if (now - _pinPulses[n].startMicros >= _pinPulses[n].durationMicros)
+      endPinPulse(_pinPulses[n].pin, true); // moves the last pulse into slot n
+    else
+      n++;
+  }
+  SREG = oldSREG;
+}
+
+// removes a pulse, optionally releasing its pin, by moving the last pulse into its slot
+void PicroBoard::endPinPulse(uint8_t pin, bool isReleased) {
+  uint8_t oldSREG = SREG;
+  cli();
+  for (int n = 0; n < _pinPulsesLength; n++) {
+    if (_pinPulses[n].pin != pin)
+      continue;
+    if (isReleased) {
+      if (_pinPulses[n].isReleasedToInput)
+        pinMode(pin, INPUT);
+      else
+        digitalWrite(pin, !_pinPulses[n].level);
+    }
+    _pinPulses[n] = _pinPulses[--_pinPulsesLength];
+    break;
+  }
+  SREG = oldSREG;
+}
+
+// Non-Blocking VCC Measurement ----------------------------------------------
+
+// applies a finished VCC measurement and starts the next one, without waiting for the bandgap to settle
+//  returns true if a new VCC was applied, so the first call only starts a measurement
+//  e.g. call it once per second, even from the control interrupt
+bool PicroBoard::updateVCCAsync() {
+  bool isApplied = false;
+  if (_vccState == VCCREADY) {
+    if (_vccAccumulator > 0)
+      applyVCC((int)(_bandgapScale*VCCSAMPLES/_vccAccumulator));
+    _vccState = VCCIDLE;
+    isApplied = true;
+  }
+  uint8_t oldSREG = SREG;
+  cli();
+  if (_vccState == VCCIDLE) {
+    _adcScanBoard = this;
+    if (_isADCScanRunning) {
+      _vccState = VCCREQUESTED; // the interrupt switches to the bandgap after the scan conversion in flight
+    } else {
+      _vccSavedADCSRA = ADCSRA;
+      ADCSRA = _BV(ADEN) | _BV(ADIE) | _BV(ADIF) | (_adcScanPrescalerBS & 0x07);
+      startVCCConversion();
+    }
+  }
+  SREG = oldSREG;
+  return isApplied;
+}
+
+// returns true while a VCC measurement owns the ADC
+bool PicroBoard::isVCCUpdateRunning() {
+  uint8_t state = _vccState;
+  return state == VCCREQUESTED || state == VCCSETTLING || state == VCCCONVERTING;
+}
+
+// stores a measured VCC (mV), override it with the particular board
+void PicroBoard::applyVCC(int vcc) {
+}
+
+// selects the bandgap against AVcc and starts the first (discarded) conversion
+void PicroBoard::startVCCConversion() {
+  #if defined(__AVR_ATmega32U4__) || defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+    ADMUX = _BV(REFS0) | _BV(MUX4) | _BV(MUX3) | _BV(MUX2) | _BV(MUX1);
+  #else
+    ADMUX = _BV(REFS0) | _BV(MUX3) | _BV(MUX2) | _BV(MUX1);
+  #endif
+  _vccSettleStart = micros();
+  _vccSampleCount = 0;
+  _vccAccumulator = 0;
+  _vccState = VCCSETTLING;
+  ADCSRA |= _BV(ADSC);
+}
+
+// steps the VCC measurement with a finished bandgap conversion, from the ADC interrupt
+void PicroBoard::updateVCCConversion(int sample) {
+  if (_vccState == VCCSETTLING) { // discard conversions until the bandgap has settled
+    if (micros() - _vccSettleStart >= VCCSETTLEMICROS)
+      _vccState = VCCCONVERTING; // the next conversion is the first averaged one
+    ADCSRA |= _BV(ADSC);
+    return;
+  }
+  _vccAccumulator += sample;
+  if (++_vccSampleCount < VCCSAMPLES) {
+    ADCSRA |= _BV(ADSC);
+    return;
+  }
+  _vccState = VCCREADY;
+  releaseVCCConversion();
+}
+
+// hands the ADC back to the scan engine, which continues with its next channel, or to analogRead()
+void PicroBoard::releaseVCCConversion() {
+  if (_isADCScanRunning)
+    startADCScanConversion();
+  else
+    ADCSRA = _vccSavedADCSRA & ~_BV(ADIE);
+}
+
+// Deferred Command Queue ----------------------------------------------------
+
+// queues ASCII commands received in the I2C interrupt instead of executing them there
+//  processCommandQueue() must then be called from loop() to execute them
+void PicroBoard::enableCommandQueue() {
+  _isCommandQueueEnabled = true;
+}
+
+// copies a command line into the deferred command queue, the single producer side of the queue
+//  returns false, and counts a drop, if the queue is full or the line does not fit
+bool PicroBoard::queueCommand(const char* line, int receiveProtocol) {
+  uint8_t head = _commandQueueHead;
+  uint8_t next = (head + 1) & (COMMANDQUEUESIZE - 1);
+  if (next == _commandQueueTail || strlen(line) >= COMMBUFFERSIZE) {
+    _commandQueueDrops++;
+    return false;
+  }
+  strcpy(_commandQueue[head].line, line);
+  _commandQueue[head].receiveProtocol = receiveProtocol;
+  _commandQueue[head].queuedMicros = micros();
+  _commandQueueHead = next; // publish the command only once it is stored
+  uint8_t depth = (next - _commandQueueTail) & (COMMANDQUEUESIZE - 1);
+  if (depth > _commandQueueDepthMax)
+    _commandQueueDepthMax = depth;
+  return true;
+}
+
+// executes every command in the deferred command queue, the single consumer side of the queue
+//  the queue holds at most COMMANDQUEUESIZE - 1 commands, so one call does a bounded amount of work
+void PicroBoard::processCommandQueue() {
+  while (_commandQueueTail != _commandQueueHead) {
+    QueuedCommand* entry = &_commandQueue[_commandQueueTail];
+    unsigned long wait = micros() - entry->queuedMicros;
+    if (wait > _commandQueueWaitMax)
+      _commandQueueWaitMax = wait;
+    parseRXLine(entry->line, entry->receiveProtocol);
+    _commandQueueTail = (_commandQueueTail + 1) & (COMMANDQUEUESIZE - 1); // release the entry after parsing
+  }
+}
+
+// gets the number of commands currently waiting in the deferred command queue
+int PicroBoard::getCommandQueueDepth() {
+  return (uint8_t)(_commandQueueHead - _commandQueueTail) & (COMMANDQUEUESIZE - 1);
+}
+
+// gets the peak number of commands waiting in the deferred command queue since the last reset
+int PicroBoard::getCommandQueueDepthMax() {
+  return _commandQueueDepthMax;
+}
+
+// gets the worst-case time in microseconds a command waited in the queue since the last reset
+unsigned long PicroBoard::getCommandQueueWaitMax() {
+  return _commandQueueWaitMax;
+}
+
+// gets the number of commands rejected because the queue was full since the last reset
+unsigned int PicroBoard::getCommandQueueDrops() {
+  return _commandQueueDrops;
+}
+
+// resets the peak depth, worst-case wait and drop count of the deferred command queue
+void PicroBoard::resetCommandQueueStats() {
+  _commandQueueDepthMax = 0;
+  _commandQueueWaitMax = 0;
+  _commandQueueDrops = 0;
 }
 
 void PicroBoard::respondToMaster(int receiveProtocol) { // responds to the raspberry Pi
   switch (receiveProtocol) {
     case UART_INDEX:
-      Serial.println(_txBuffer[UART_INDEX]);
-      _txBuffer[UART_INDEX][0] = '\0';
+      Serial.println(_txBufferUART);
+      _txBufferUART[0] = '\0';
       break;
     case I2C_INDEX:
-      // Serial.println(_txBuffer[I2C_INDEX]); // for debugging only (adds a bad delay otherwise)
-      // do nothing, wait for next I2C request from master
+      // Serial.println(getTXBuffer(I2C_INDEX)); // for debugging only (adds a bad delay otherwise)
+      publishI2C(NULL, NULL, 0); // swap in the finished response, then wait for next I2C request from master
       break;
     default:
       // do nothing
@@ -48,8 +777,224 @@ void PicroBoard::respondToMaster(int receiveProtocol) { // responds to the raspb
 }
 
 // get a pointer to the indexed stored transmit buffer
+//  for I2C this is the back buffer, which the master cannot see until respondToMaster() publishes it
 char * PicroBoard::getTXBuffer(int commIndex) {
-  return _txBuffer[commIndex];
+  if (commIndex == I2C_INDEX)
+    return _txBuffersI2C[_txFrontI2C ^ 1];
+  return _txBufferUART;
+}
+
+// gets the I2C response status byte: I2CSTATUSREADY if a response is waiting, and its sequence number
+uint8_t PicroBoard::getStatusI2C() {
+  return _statusI2C;
+}
+
+// publishes the next I2C response and marks it ready, with interrupts held off so the master never sees
+//  a partial update. error (a string literal) or frame (a binary frame of length bytes) is published if not
+//  NULL, otherwise the back buffer is swapped with the front buffer
+void PicroBoard::publishI2C(const char* error, const uint8_t* frame, int length) {
+  uint8_t oldSREG = SREG; // also called from the I2C interrupt, so restore rather than enable interrupts
+  cli();
+  _txErrorI2C = error;
+  _txFrameI2C = frame;
+  _txLengthI2C = (frame != NULL) ? length : 0;
+  if (error == NULL && frame == NULL)
+    _txFrontI2C ^= 1;
+  _statusI2C = I2CSTATUSREADY | ((_statusI2C + 1) & I2CSTATUSSEQUENCE);
+  SREG = oldSREG;
+}
+
+// Binary Register Protocol --------------------------------------------------
+
+// sets the protocol (ASCII_PROTOCOL or BINARY_PROTOCOL) of a communications link
+void PicroBoard::setLinkProtocol(int commIndex, int protocol) {
+  if (commIndex < 0 || commIndex >= NUM_COMM_MODULES || protocol < 0 || protocol >= NUM_LINK_PROTOCOLS)
+    return;
+  _linkProtocol[commIndex] = protocol;
+}
+
+// gets the protocol (ASCII_PROTOCOL or BINARY_PROTOCOL) of a communications link
+int PicroBoard::getLinkProtocol(int commIndex) {
+  return _linkProtocol[commIndex];
+}
+
+// reads a binary register, override it with the registers of the particular board
+//  unknown registers are offered to the RegisterCallback functions registered from the .ino file
+bool PicroBoard::readRegister(uint8_t reg, int* value) {
+  switch (reg) {
+    case BINREG_STREAMMASK: *value = _streamMask; return true;
+    case BINREG_STREAMDECIMATION: *value = _streamDecimation; return true;
+    case BINREG_QUEUEDEPTH: *value = getCommandQueueDepthMax(); return true;
+    case BINREG_QUEUEWAIT: // saturate to the 16-bit register width
+      *value = (getCommandQueueWaitMax() > 65535UL) ? 65535U : getCommandQueueWaitMax(); return true;
+    case BINREG_COMMSTATS: { // every event counter of both links, saturating at 65535
+      unsigned long total = 0;
+      for (int n = 0; n < NUM_COMM_MODULES; n++) {
+        for (int field = COMMSTAT_OVERFLOWS; field <= COMMSTAT_EMPTYREQUESTS; field++)
+          total += getCommStat(n, field);
+      }
+      *value = (total > 65535UL) ? 65535U : total; return true;
+    }
+  }
+  for (int n = 0; n < _registerCallbacksEnd; n++) {
+    if (_registerCallbacks[n](reg, value, false))
+      return true;
+  }
+  return false;
+}
+
+// writes a binary register, override it with the registers of the particular board
+//  unknown registers are offered to the RegisterCallback functions registered from the .ino file
+bool PicroBoard::writeRegister(uint8_t reg, int value) {
+  switch (reg) {
+    case BINREG_STREAMMASK: _streamMask = value; return true;
+    case BINREG_STREAMDECIMATION: startStream(value, _streamMask); return true;
+    case BINREG_QUEUEDEPTH: resetCommandQueueStats(); return true;
+    case BINREG_COMMSTATS: resetCommStats(); return true;
+  }
+  for (int n = 0; n < _registerCallbacksEnd; n++) {
+    if (_registerCallbacks[n](reg, &value, true))
+      return true;
+  }
+  return false;
+}
+
+// executes a received binary frame and overwrites it in place with the response frame
+void PicroBoard::processBinaryFrame(uint8_t* frame, int receiveProtocol) {
+  uint8_t reg = frame[0] & BINREGMASK;
+  bool isWrite = frame[0] & BINWRITEFLAG;
+  int value = (int)((uint16_t)frame[1] | ((uint16_t)frame[2] << 8));
+  bool isValid = (crc8(frame, BINFRAMESIZE - 1) == frame[BINFRAMESIZE - 1]);
+  bool handled;
+  if (!isValid) {
+    countCommEvent(receiveProtocol, COMMSTAT_PARSEERRORS);
+    handled = false;
+  } else if (reg == BINREG_PROTOCOL) {
+    if (isWrite)
+      setLinkProtocol(receiveProtocol, value);
+    value = getLinkProtocol(receiveProtocol);
+    handled = true;
+  } else if (isWrite) {
+    handled = writeRegister(reg, value);
+    if (handled)
+      readRegister(reg, &value); // respond with the register value actually stored, if readable
+  } else {
+    handled = readRegister(reg, &value);
+  }
+  if (!handled && isValid) // the CRC passed, but no register matched
+    countCommEvent(receiveProtocol, COMMSTAT_UNKNOWN);
+  if (handled) {
+    frame[0] = reg;
+    frame[1] = (uint16_t)value & 0xFF;
+    frame[2] = (uint16_t)value >> 8;
+  } else {
+    frame[0] = BINREG_NACK;
+    frame[1] = reg;
+    frame[2] = 0;
+  }
+  frame[3] = crc8(frame, BINFRAMESIZE - 1);
+}
+
+// latches every snapshot register into frame with interrupts held off, so that the control interrupt cannot
+//  update the sensor averages partway through: [BINREG_SNAPSHOT][count][LSB][MSB]...[CRC-8]
+//  frame must hold SNAPSHOTFRAMESIZE bytes. returns the frame length
+int PicroBoard::latchSnapshot(uint8_t* frame) {
+  int count = (_snapshotLength < SNAPSHOTMAXREGISTERS) ? _snapshotLength : SNAPSHOTMAXREGISTERS;
+  frame[0] = BINREG_SNAPSHOT;
+  frame[1] = count;
+  uint8_t oldSREG = SREG; // may be called from the I2C interrupt, so restore rather than enable interrupts
+  cli();
+  for (int n = 0; n < count; n++) {
+    int value = 0;
+    readRegister(pgm_read_byte(&_snapshotRegisters[n].reg), &value);
+    frame[2 + 2*n] = (uint16_t)value & 0xFF;
+    frame[3 + 2*n] = (uint16_t)value >> 8;
+  }
+  SREG = oldSREG;
+  frame[2 + 2*count] = crc8(frame, 2 + 2*count);
+  return 3 + 2*count;
+}
+
+// exposes a RAM block to chunked transfers under a block ID, returns false if the block array is full
+//  callback is called after the last chunk of a write, e.g. to apply a new coefficient set all at once
+bool PicroBoard::addTransferBlock(uint8_t block, uint8_t* data, int length, bool isWritable,
+    TransferCallback callback) {
+  if (_transferBlocksEnd >= TRANSFERBLOCKSMAXLENGTH)
+    return false;
+  TransferBlock* entry = &_transferBlocks[_transferBlocksEnd];
+  entry->block = block;
+  entry->data = data;
+  entry->length = length;
+  entry->isWritable = isWritable;
+  entry->callback = callback;
+  _transferBlocksEnd++;
+  return true;
+}
+
+// gets the expected length of a chunk frame from its first CHUNKHEADERSIZE bytes, 0 if the header is invalid
+//  only write frames carry data, read frames are always just the header and CRC
+int PicroBoard::getChunkFrameLength(const uint8_t* frame) {
+  if (frame[4] > CHUNKDATAMAX)
+    return 0;
+  return CHUNKHEADERSIZE + ((frame[0] & BINWRITEFLAG) ? frame[4] : 0) + 1;
+}
+
+// executes a received chunk frame of the given length and writes the response frame into response
+//  response must hold CHUNKFRAMESIZE bytes and may not overlap frame. returns the response length
+int PicroBoard::processChunkFrame(const uint8_t* frame, int length, uint8_t* response) {
+  bool isWrite = frame[0] & BINWRITEFLAG;
+  unsigned int offset = (uint16_t)frame[2] | ((uint16_t)frame[3] << 8);
+  int count = frame[4];
+  memcpy(response, frame, CHUNKHEADERSIZE);
+  response[0] = BINREG_CHUNK;
+  response[5] = 0;
+  TransferBlock* entry = NULL;
+  for (int n = 0; n < _transferBlocksEnd; n++) {
+    if (_transferBlocks[n].block == frame[1])
+      entry = &_transferBlocks[n];
+  }
+  bool isValid = length >= CHUNKHEADERSIZE + 1 && length == getChunkFrameLength(frame)
+      && crc8(frame, length - 1) == frame[length - 1]
+      && entry != NULL && (int)offset <= entry->length && (!isWrite || entry->isWritable);
+  if (!isValid) {
+    response[4] = 0;
+    response[5] = CHUNKERROR;
+  } else if (isWrite) {
+    if (count > entry->length - (int)offset) {
+      response[4] = 0;
+      response[5] = CHUNKERROR;
+    } else {
+      memcpy(&entry->data[offset], &frame[CHUNKHEADERSIZE], count);
+      response[5] = frame[5] & CHUNKMORE;
+      if (!(frame[5] & CHUNKMORE) && entry->callback != NULL)
+        entry->callback(entry->block, offset + count);
+    }
+  } else {
+    if (count > entry->length - (int)offset) // clip the read to the end of the block
+      count = entry->length - offset;
+    uint8_t oldSREG = SREG;
+    if (entry->block == COMMSTATSBLOCK) // the I2C interrupt updates the statistics, copy them in one piece
+      cli();
+    memcpy(&response[CHUNKHEADERSIZE], &entry->data[offset], count);
+    SREG = oldSREG;
+    response[4] = count;
+    if ((int)offset + count < entry->length)
+      response[5] = CHUNKMORE;
+  }
+  int responseLength = CHUNKHEADERSIZE + (isWrite ? 0 : response[4]);
+  response[responseLength] = crc8(response, responseLength);
+  return responseLength + 1;
+}
+
+// CRC-8 with polynomial 0x07 and initial value 0x00, computed bitwise to avoid a 256-byte table
+uint8_t PicroBoard::crc8(const uint8_t* data, int length) {
+  uint8_t crc = 0;
+  for (int n = 0; n < length; n++) {
+    crc ^= data[n];
+    for (int b = 0; b < 8; b++)
+      crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : (crc << 1);
+  }
+  return crc;
 }
 
 // start serial communications
@@ -62,32 +1007,147 @@ void PicroBoard::startUART() {
   startUART(38400);
 }
 
-// read in from the UART buffer and store it, returns true if \n detected
+// moves new characters into the UART ring buffer and parses every complete line (or binary frame)
+//  sketches that call this from the control interrupt should use receiveUART() and processUART() instead
 void PicroBoard::readUART() {
+  receiveUART();
+  processUART();
+}
+
+// moves characters from the Serial receive buffer (filled by the USART receive interrupt) into the UART ring
+//  buffer. It does no parsing, so it is cheap enough to call from the periodic control interrupt
+void PicroBoard::receiveUART() {
   while (Serial.available())
-  {
-    char c = Serial.read();
-    // _rxBufferUART[_rxCntUART++] = c;
-    _rxBufferUART[_rxCntUART] = c;
-    _rxCntUART++;
-    //
-    if ((c == '\n') || (_rxCntUART == COMMBUFFERSIZE-1))
-    {
-        _rxBufferUART[_rxCntUART] = '\0';
-        _rxCntUART = 0;
-        parseRXLineUART();
+    receiveByteUART(Serial.read());
+}
+
+// adds one received byte to the UART ring buffer, the single producer side of the ring, safe in an interrupt
+//  if the ring is full the rest of the line is dropped, and its '\n' is stored as '\0' so that processUART()
+//  rejects (and counts) exactly the line that lost bytes. Binary frames instead resync on their CRC, so an
+//  overrun in binary mode is counted here, once per run of dropped bytes
+void PicroBoard::receiveByteUART(uint8_t c) {
+  uint8_t head = _rxHeadUART;
+  uint8_t next = (head + 1) & (UARTRINGSIZE - 1);
+  bool isBinary = (_linkProtocol[UART_INDEX] == BINARY_PROTOCOL);
+  if (next == _rxTailUART) {
+    if (isBinary && !_rxOverrunUART)
+      countCommEvent(UART_INDEX, COMMSTAT_OVERFLOWS);
+    _rxOverrunUART = true;
+    return;
+  }
+  if (_rxOverrunUART && !isBinary) {
+    if (c != '\n')
+      return;
+    c = '\0'; // mark the end of the broken line
+  }
+  _rxOverrunUART = false;
+  _rxRingUART[head] = c;
+  if (head < UARTLINEMAX)
+    _rxRingUART[UARTRINGSIZE + head] = c; // mirror the start of the ring past its end so no line wraps around
+  _rxHeadUART = next; // publish the byte only once it is stored
+}
+
+// parses every complete line (or binary frame) in the UART ring buffer, the single consumer side of the ring
+//  each line is handed to parseRXLine() in place, as a (pointer, length) view into the ring. Lines longer than
+//  UARTLINEMAX, or missing bytes dropped by a full ring, are discarded and answered with an "Error:" response
+void PicroBoard::processUART() {
+  sendStreamUART();
+  while (true) {
+    uint8_t head = _rxHeadUART;
+    if (_linkProtocol[UART_INDEX] == BINARY_PROTOCOL) {
+      if (!readBinaryUART((head - _rxTailUART) & (UARTRINGSIZE - 1)))
+        return;
+      continue;
+    }
+    if (_rxScanUART == head)
+      return;
+    char c = _rxRingUART[_rxScanUART];
+    _rxScanUART = (_rxScanUART + 1) & (UARTRINGSIZE - 1);
+    int length = (_rxScanUART - _rxTailUART) & (UARTRINGSIZE - 1); // line length so far, including c
+    if (_rxDiscardUART) { // skip the rest of an overlong line
+      _rxTailUART = _rxScanUART;
+      if (c == '\n' || c == '\0') {
+        _rxDiscardUART = false;
+        rejectLineUART("LEN");
+      }
+    } else if (c == '\0') { // the ring overflowed while this line was arriving
+      _rxTailUART = _rxScanUART;
+      rejectLineUART("OVR");
+    } else if (c == '\n') {
+      _rxLineUART = &_rxRingUART[_rxTailUART];
+      parseRXLine(_rxLineUART, length - 1, UART_INDEX);
+      _rxTailUART = _rxScanUART; // release the line back to the producer only after it has been parsed
+    } else if (length >= UARTLINEMAX) {
+      _rxDiscardUART = true;
+      _rxTailUART = _rxScanUART;
     }
   }
 }
 
-// get the stored UART buffer 
+// counts and answers a UART line that could not be parsed, so that truncation is never silent
+void PicroBoard::rejectLineUART(const char* reason) {
+  countCommEvent(UART_INDEX, COMMSTAT_OVERFLOWS);
+  sprintf(getTXBuffer(UART_INDEX), "Error:%s", reason);
+  respondToMaster(UART_INDEX);
+}
+
+// executes the binary frame at the tail of the UART ring buffer in place, then writes back the response
+//  available is the number of received bytes in the ring. returns false if the frame is not complete yet
+//  if the CRC does not match, the oldest byte is dropped so the receiver can resync to the frame boundary
+bool PicroBoard::readBinaryUART(int available) {
+  uint8_t * frame = (uint8_t *)&_rxRingUART[_rxTailUART]; // contiguous thanks to the mirrored ring end
+  if (available < BINFRAMESIZE)
+    return false;
+  unsigned long startMicros = micros();
+  uint8_t reg = frame[0] & BINREGMASK; // the frame is overwritten by the response
+  uint8_t advance = BINFRAMESIZE;
+  if (reg == BINREG_CHUNK) { // variable-length chunk frame
+    if (available < CHUNKHEADERSIZE)
+      return false;
+    advance = getChunkFrameLength(frame);
+    if (advance == 0) {
+      advance = 1;
+    } else if (available < advance) {
+      return false;
+    } else if (crc8(frame, advance - 1) != frame[advance - 1]) {
+      advance = 1;
+    } else {
+      uint8_t response[CHUNKFRAMESIZE]; // not shared with I2C, which may not have read its response yet
+      Serial.write(response, processChunkFrame(frame, advance, response));
+      if (response[5] & CHUNKERROR)
+        countCommEvent(UART_INDEX, COMMSTAT_PARSEERRORS);
+    }
+  } else if (crc8(frame, BINFRAMESIZE - 1) != frame[BINFRAMESIZE - 1]) {
+    advance = 1;
+  } else if (frame[0] == BINREG_SNAPSHOT) { // bulk read, responds with a multi-byte snapshot frame
+    uint8_t snapshot[SNAPSHOTFRAMESIZE]; // not shared with I2C, which may not have read its frame yet
+    Serial.write(snapshot, latchSnapshot(snapshot));
+  } else {
+    processBinaryFrame(frame, UART_INDEX);
+    Serial.write(frame, BINFRAMESIZE);
+  }
+  if (advance == 1) // dropped one byte to resync
+    countCommEvent(UART_INDEX, COMMSTAT_PARSEERRORS);
+  else
+    recordHandlerTime(UART_INDEX, NULL, reg, startMicros);
+  _rxTailUART = (_rxTailUART + advance) & (UARTRINGSIZE - 1);
+  _rxScanUART = _rxTailUART;
+  return true;
+}
+
+// gets the number of UART lines rejected as too long or incomplete since startup
+unsigned int PicroBoard::getRXErrorsUART() {
+  return getCommStat(UART_INDEX, COMMSTAT_OVERFLOWS);
+}
+
+// get the most recent UART line, only valid while its command is being processed
 char * PicroBoard::getRXBufferUART() {
-  return _rxBufferUART;
+  return _rxLineUART;
 }
 
-// parses the current UART rxBuffer
+// parses the most recent UART line again
 void PicroBoard::parseRXLineUART() {
-  parseRXLine(_rxBufferUART, UART_INDEX);
+  parseRXLine(_rxLineUART, UART_INDEX);
 }
 
 // start serial communications
@@ -102,20 +1162,94 @@ void PicroBoard::startI2C(int address, ReceiveEventI2C receiveCallback, RequestE
 // function to handle when an I2C message comes in
 void PicroBoard::receiveEventI2C(int howMany) {
   // Serial.println("received");
+  if (_linkProtocol[I2C_INDEX] == BINARY_PROTOCOL) {
+    receiveBinaryI2C(howMany);
+    return;
+  }
+  //RPi first byte is cmd byte so skip it, the rest is our string
+  //  a lone cmd byte only selects what the next read returns: the status byte, or the response
+  if (howMany == 1) {
+    _isStatusRequestI2C = (Wire.read() == I2CSTATUSCOMMAND);
+    return;
+  }
+  _rxCntI2C = 0;
+  bool isTruncated = false;
   for (int i = 0; i < howMany; i++) {
-    _rxBufferI2C[i] = Wire.read();
-    _rxBufferI2C[i + 1] = '\0'; //add null after ea. char
+    char c = Wire.read();
+    if (i == 0)
+      continue;
+    if (_rxCntI2C < COMMBUFFERSIZE - 1)
+      _rxBufferI2C[_rxCntI2C++] = c;
+    else
+      isTruncated = true;
+  }
+  _rxBufferI2C[_rxCntI2C] = '\0';
+  if (isTruncated) { // answer instead of parsing a truncated command
+    countCommEvent(I2C_INDEX, COMMSTAT_OVERFLOWS);
+    publishI2C("Error:LEN", NULL, 0);
+    return;
+  }
+  if (_isCommandQueueEnabled) { // execute the command later from loop(), not in the I2C interrupt
+    if (!queueCommand(_rxBufferI2C, I2C_INDEX)) {
+      countCommEvent(I2C_INDEX, COMMSTAT_OVERFLOWS);
+      publishI2C("Error:BSY", NULL, 0);
+    }
+    return;
   }
-  //RPi first byte is cmd byte so shift everything to the left 1 pos so temp contains our string
-  for (int i = 0; i < howMany; ++i)
-    _rxBufferI2C[i] = _rxBufferI2C[i + 1];
   parseRXLineI2C();
 }
 
+// handles an I2C transmit message in binary mode. The RPi command byte is the register ID, so that
+//  read_i2c_block_data(address, register, 4) selects and returns a register in a single combined transaction
+//  and write_i2c_block_data(address, register | 0x80, [LSB, MSB, CRC]) writes it
+//  chunk frames fill up to the whole 32-byte Wire buffer, and are answered with a chunk frame
+void PicroBoard::receiveBinaryI2C(int howMany) {
+  unsigned long startMicros = micros();
+  uint8_t frame[CHUNKFRAMESIZE] = {0, 0, 0, 0};
+  for (int i = 0; i < howMany; i++) {
+    uint8_t c = Wire.read();
+    if (i < CHUNKFRAMESIZE)
+      frame[i] = c;
+  }
+  uint8_t reg = frame[0] & BINREGMASK; // the frame is overwritten by the response
+  if (reg == BINREG_CHUNK && howMany > 1) {
+    int length = (howMany < CHUNKFRAMESIZE) ? howMany : CHUNKFRAMESIZE;
+    publishI2C(NULL, _chunkFrameI2C, processChunkFrame(frame, length, _chunkFrameI2C));
+    if (_chunkFrameI2C[5] & CHUNKERROR)
+      countCommEvent(I2C_INDEX, COMMSTAT_PARSEERRORS);
+  } else if (howMany == 1 && frame[0] == BINREG_SNAPSHOT) { // bulk read, responds with a multi-byte snapshot frame
+    publishI2C(NULL, _snapshotFrameI2C, latchSnapshot(_snapshotFrameI2C));
+  } else {
+    if (howMany == 1) // register select for a read: no payload, the I2C bus already acknowledges every byte
+      frame[BINFRAMESIZE - 1] = crc8(frame, BINFRAMESIZE - 1);
+    else if (howMany != BINFRAMESIZE)
+      frame[BINFRAMESIZE - 1] = ~crc8(frame, BINFRAMESIZE - 1); // force a NACK for malformed frames
+    processBinaryFrame(frame, I2C_INDEX);
+    memcpy(_txBinaryI2C, frame, BINFRAMESIZE);
+    publishI2C(NULL, _txBinaryI2C, BINFRAMESIZE);
+  }
+  recordHandlerTime(I2C_INDEX, NULL, reg, startMicros);
+}
+
+// function to handle when an I2C request message comes in, sends the published response only once
 void PicroBoard::requestEventI2C() {
   // Serial.println("requested");
-  Wire.write(_txBuffer[I2C_INDEX]);
-  _txBuffer[I2C_INDEX][0] = '\0';
+  if (_isStatusRequestI2C) { // the master is polling for its response
+    _isStatusRequestI2C = false;
+    Wire.write(_statusI2C);
+    return;
+  }
+  if (!(_statusI2C & I2CSTATUSREADY)) { // nothing new since the last read, e.g. the command has not run yet
+    countCommEvent(I2C_INDEX, COMMSTAT_EMPTYREQUESTS);
+    return;
+  }
+  _statusI2C &= ~I2CSTATUSREADY;
+  if (_txErrorI2C != NULL)
+    Wire.write(_txErrorI2C);
+  else if (_txLengthI2C > 0) // binary response, may contain zero bytes
+    Wire.write(_txFrameI2C, _txLengthI2C);
+  else
+    Wire.write(_txBuffersI2C[_txFrontI2C]);
 }
 
 char * PicroBoard::getRXBufferI2C() { // get the stored I2C buffer
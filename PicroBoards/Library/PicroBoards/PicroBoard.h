@@ -11,12 +11,25 @@
 
 #include "Arduino.h"
 #include <Wire.h>
+#include <avr/pgmspace.h>
 
 // In Arduino IDE, go to Sketch -> Include Library -> Add .ZIP Library
 
 // Function template for interpreting command strings: (char* command, char* value, int receiveProtocol)
 typedef void (*CommandCallback)(const char*, const char*, int);
 
+// Function template for a handler of one specific command: (char* value, int receiveProtocol)
+typedef void (*CommandHandler)(const char*, int);
+
+// Function template for sketch-defined binary registers: (uint8_t register, int* value, bool isWrite)
+//  on a read, store the register value in *value; on a write, *value holds the written value
+//  return true if the register was handled, false otherwise
+typedef bool (*RegisterCallback)(uint8_t, int*, bool);
+
+// Function template for a completed chunked block transfer: (uint8_t block ID, int length written)
+//  called after the last chunk of a write, from the I2C interrupt or from processUART()
+typedef void (*TransferCallback)(uint8_t, int);
+
 // I2C function templates that work with Wire.h library
 typedef void (*ReceiveEventI2C)(int);
 typedef void (*RequestEventI2C)();
@@ -28,8 +41,235 @@ enum CommunicationsProtocol
     NUM_COMM_MODULES
 };
 
+// link protocol enumerator, negotiated per communications link (UART or I2C)
+enum LinkProtocol
+{   ASCII_PROTOCOL = 0, // text lines of the form "CMD:value\n"
+    BINARY_PROTOCOL, // fixed-width frames: [register ID][value LSB][value MSB][CRC-8]
+    NUM_LINK_PROTOCOLS
+};
+
 const int COMMBUFFERSIZE = 16; // length of all character buffers (both receive and transmit)
 const int COMMANDCALLBACKSMAXLENGTH = 10; // max length of command callback array
+const int REGISTERCALLBACKSMAXLENGTH = 4; // max length of register callback array
+const int UARTRINGSIZE = 64; // length of the UART receive ring buffer, must be a power of 2 and at most 256
+const int UARTLINEMAX = 32; // max UART line length including '\n', longer lines are rejected with "Error:LEN"
+const int COMMANDMNEMONICSIZE = 8; // max command mnemonic length in dispatch tables, including the null terminator
+const int COMMANDQUEUESIZE = 4; // length of the deferred command queue, must be a power of 2 and at most 256
+
+// command dispatch tables are stored in flash (PROGMEM) and sorted by mnemonic (in strcmp order), so that an
+//  incoming command is found with a binary search: O(log n) strcmp_P calls instead of a strcmp if-else chain
+//  e.g. in the .ino file:
+//    const CommandEntry COMMANDS[] PROGMEM = {{"RFN", readFileName}, {"RVLIM", readVLIM}, {"WVLIM", writeVLIM}};
+//    atverter.setCommandTable(COMMANDS, sizeof(COMMANDS)/sizeof(COMMANDS[0]));
+
+// one entry of a sketch command dispatch table
+struct CommandEntry
+{   char command[COMMANDMNEMONICSIZE]; // command mnemonic, e.g. "RFN"
+    CommandHandler handler; // function called with the command value and receive protocol
+};
+
+// one entry of a board command dispatch table, mapping an ASCII command onto a binary register
+struct RegisterCommandEntry
+{   char command[COMMANDMNEMONICSIZE]; // command mnemonic, e.g. "RV1"
+    uint8_t reg; // binary register ID, accessed through readRegister() and writeRegister()
+    uint8_t format; // RegisterCommandFormat flags
+};
+
+// register command format flags
+enum RegisterCommandFormat
+{   REGCMD_READ = 0x01, // "RXX:" reads the register and responds "WXX:value"
+    REGCMD_WRITE = 0x02, // "WXX:value" writes the register and responds "WXX:=value"
+    REGCMD_UNSIGNED = 0x04, // format the value as unsigned
+    REGCMD_READBACK = 0x08 // respond to a write with the value read back from the register, not the written value
+};
+
+// binary protocol framing
+//  master writes a register: [register ID | BINWRITEFLAG][value LSB][value MSB][CRC-8]
+//  master reads a register: [register ID][0][0][CRC-8] over UART, or just [register ID] as the I2C command byte
+//  board responds with: [register ID][value LSB][value MSB][CRC-8], or [BINREG_NACK][register ID][0][CRC-8]
+//  the CRC-8 (polynomial 0x07, initial value 0x00) covers the first three bytes of the frame
+const int BINFRAMESIZE = 4; // length of every binary frame in bytes
+const uint8_t BINWRITEFLAG = 0x80; // set in the register ID byte by the master to write instead of read
+const uint8_t BINREGMASK = 0x7F; // register ID with the write flag removed
+
+// bulk snapshot framing
+//  master reads register BINREG_SNAPSHOT like any other register (or sends "RALL:" in ASCII)
+//  board responds with: [BINREG_SNAPSHOT][count][value 0 LSB][value 0 MSB]...[value count-1 MSB][CRC-8]
+//  every value is latched with interrupts held off, so the whole board is sampled at the same instant
+//  the frame is sized to fit the 32-byte Wire buffer, so it is always returned in a single I2C transaction
+const int SNAPSHOTMAXREGISTERS = 13; // max number of registers in a snapshot
+const int SNAPSHOTFRAMESIZE = 3 + 2*SNAPSHOTMAXREGISTERS; // max length of a snapshot frame in bytes
+
+// one entry of a board snapshot list, the registers returned by BINREG_SNAPSHOT and "RALL"
+struct SnapshotEntry
+{   uint8_t reg; // binary register ID, accessed through readRegister()
+    uint8_t format; // RegisterCommandFormat flags, only REGCMD_UNSIGNED is used
+};
+
+// push-mode telemetry stream over UART
+//  the master selects snapshot registers with a bit mask (bit n = snapshot entry n) and sets a decimation:
+//  one frame is latched every decimation calls of updateStream(), which the sketch calls from its control interrupt
+//  board pushes: [STREAMFRAMEID][sequence LSB][sequence MSB][millis() 4 bytes LSB first][count]
+//    [value 0 LSB][value 0 MSB]...[value count-1 MSB][CRC-8], with no request from the master
+//  the frame is latched in the interrupt and written out by processUART(), so it never splits another response
+//  a gap in the sequence counter means frames were dropped because the UART could not keep up
+const uint8_t STREAMFRAMEID = 0xFB; // first byte of a stream frame, never the first byte of a binary response
+const int STREAMFRAMESIZE = 9 + 2*SNAPSHOTMAXREGISTERS; // max length of a stream frame in bytes
+
+// I2C response status, for ASCII commands over I2C
+//  every response is written into a back buffer and published atomically, with a 7-bit sequence number
+//  reading with command byte I2CSTATUSCOMMAND (e.g. read_byte_data(address, 0x01)) returns one status byte:
+//  [I2CSTATUSREADY if a new response is waiting | sequence number of the last published response]
+//  so the master can poll until its response is ready instead of sleeping a fixed time
+const uint8_t I2CSTATUSCOMMAND = 0x01; // smbus command byte that selects the status byte instead of the response
+const uint8_t I2CSTATUSREADY = 0x80; // status bit set from publishing a response until the master reads it
+const uint8_t I2CSTATUSSEQUENCE = 0x7F; // status bits holding the response sequence number
+
+// chunked block transfers, for data longer than one frame (coefficient sets, lookup tables, trace buffers)
+//  the sketch exposes a RAM array as a numbered block with addTransferBlock(), then the master moves it in chunks
+//  master reads a chunk: [BINREG_CHUNK][block][offset LSB][offset MSB][length][flags][CRC-8]
+//  master writes a chunk: [BINREG_CHUNK | BINWRITEFLAG][block][offset LSB][offset MSB][length][flags][data...][CRC-8]
+//  board responds with: [BINREG_CHUNK][block][offset LSB][offset MSB][length][flags][data (reads only)...][CRC-8]
+//  a read response is clipped to the end of the block and sets CHUNKMORE if the block continues past it
+//  a write without CHUNKMORE is the last chunk, and calls the TransferCallback of the block
+//  the largest chunk fills the 32-byte Wire buffer, so a 100-byte block moves in 4 I2C transactions
+//  chunks are binary protocol frames, so the link must first be switched to binary mode (e.g. "WBIN:1")
+const int CHUNKHEADERSIZE = 6; // length of the chunk frame header, before the data
+const int CHUNKFRAMESIZE = 32; // max length of a chunk frame in bytes, the Wire buffer length
+const int CHUNKDATAMAX = CHUNKFRAMESIZE - CHUNKHEADERSIZE - 1; // max data bytes per chunk
+const int TRANSFERBLOCKSMAXLENGTH = 5; // max length of transfer block array, one is used by COMMSTATSBLOCK
+
+// chunk frame flags
+enum ChunkFlags
+{   CHUNKMORE = 0x01, // write: more chunks follow; read response: the block continues past this chunk
+    CHUNKERROR = 0x80 // response: unknown block, read-only block, bad range or bad CRC, no data was moved
+};
+
+// one RAM block exposed to chunked transfers
+struct TransferBlock
+{   uint8_t block; // block ID chosen by the sketch
+    uint8_t* data; // block contents
+    int length; // block length in bytes
+    bool isWritable; // if false, chunked writes are answered with CHUNKERROR
+    TransferCallback callback; // called after the last chunk of a write, may be NULL
+};
+
+// communication health statistics, kept per link (UART_INDEX or I2C_INDEX) since startup or resetCommStats()
+//  "RCST:<link><field>" reads one statistic, e.g. "RCST:12" reads COMMSTAT_UNKNOWN of I2C and responds "WCST:value"
+//  "RCSC:<link>" responds with the command that took the longest handler time, e.g. "WCSC:RALL" ("#7E" if binary)
+//  "RCSE:" reads the sum of every event counter (fields 0-3) of both links, and "WCSR:" resets all statistics
+//  in binary mode, chunked reads of block COMMSTATSBLOCK return the raw CommStats array of both links
+//  each chunk is copied with interrupts held off, so its counters are never torn by an I2C update
+enum CommStatField
+{   COMMSTAT_OVERFLOWS = 0, // lines too long for the buffers, ring overruns and full command queues
+    COMMSTAT_PARSEERRORS, // empty commands, bad binary frames (each byte skipped to resync UART), rejected chunks
+    COMMSTAT_UNKNOWN, // ASCII commands and binary registers that no handler accepted
+    COMMSTAT_EMPTYREQUESTS, // I2C reads that found no new response waiting
+    COMMSTAT_HANDLERCOUNT, // number of timed command handler calls (saturates at 65535)
+    COMMSTAT_HANDLERMIN, // fastest command handler time (microseconds)
+    COMMSTAT_HANDLERMAX, // slowest command handler time (microseconds)
+    COMMSTAT_HANDLERMEAN, // mean command handler time (microseconds)
+    NUM_COMMSTATS
+};
+const uint8_t COMMSTATSBLOCK = 0xFF; // transfer block ID of the CommStats array, read-only
+
+// communication health statistics of one link
+struct CommStats
+{   unsigned int events[COMMSTAT_HANDLERCOUNT]; // error and event counters, indexed by CommStatField
+    unsigned long handlerCount; // number of timed command handler calls
+    unsigned long handlerTotalMicros; // total command handler time, for the mean
+    unsigned int handlerMinMicros; // fastest command handler time
+    unsigned int handlerMaxMicros; // slowest command handler time
+    char handlerMaxCommand[COMMANDMNEMONICSIZE]; // command that took handlerMaxMicros
+};
+
+// interrupt-driven ADC scan engine
+//  startADCScan() walks a channel list from the ADC conversion complete interrupt: each interrupt feeds the finished
+//  sample into the board sensor moving averages, selects the next channel and starts its conversion, so no code ever
+//  busy-waits on the ADC. Each channel is then sampled about every (13 ADC clocks + interrupt time) * channels,
+//  e.g. ~120us * 6 = ~0.7ms with the default 125 kHz ADC clock, independent of how fast loop() runs
+//  while the scan runs, the board update functions (e.g. updateVISensors) return at once, and the sketch must not
+//  call analogRead(); readVCC() pauses the scan itself
+//  e.g. in the .ino file: atverter.initialize(); atverter.startADCScan();
+#ifndef ADCSCAN_PRESCALER_BS
+#define ADCSCAN_PRESCALER_BS 7 // ADC clock = F_CPU >> ADCSCAN_PRESCALER_BS, i.e. 125 kHz at 16 MHz (ADPS bits)
+#endif
+
+// one channel of an ADC scan list, stored in flash (PROGMEM)
+struct ADCScanChannel
+{   uint8_t pin; // analog pin, e.g. A3
+    uint8_t sensorIndex; // board SensorIndex fed with the samples of this pin
+    int offset; // subtracted from every sample, e.g. 512 to center bidirectional current sensors on zero
+};
+
+// non-blocking VCC measurement
+//  VCC is measured by converting the internal 1.1V bandgap against AVcc. After the ADC mux switches to the bandgap,
+//  the reading needs about 2 ms to settle, which readVCC() (and so updateVCC()) spends busy-waiting.
+//  updateVCCAsync() instead runs the measurement from the ADC conversion complete interrupt: it switches to the bandgap,
+//  converts and discards until VCCSETTLEMICROS have passed, averages VCCSAMPLES conversions, then hands the ADC back
+//  to the scan engine (or to analogRead()). Each step costs a few microseconds of interrupt time, and the sensor
+//  averages hold their values for the ~2.5 ms of the measurement
+//  e.g. in controlUpdate(), once per second: atverter.updateVCCAsync();
+const unsigned int VCCSETTLEMICROS = 2000; // bandgap settling time after the ADC mux switches to it
+const uint8_t VCCSAMPLES = 4; // averaged bandgap conversions per VCC measurement
+
+enum VCCUpdateState
+{   VCCIDLE = 0, // no measurement running
+    VCCREQUESTED = 1, // waiting for the scan conversion in flight to finish
+    VCCSETTLING = 2, // bandgap selected, conversions discarded until settled
+    VCCCONVERTING = 3, // averaging bandgap conversions
+    VCCREADY = 4 // measurement finished, applied by the next updateVCCAsync()
+};
+
+// timed pin pulses
+//  protection latches need a pin held for milliseconds (e.g. 10 ms on a gate shutdown line). Instead of busy-waiting,
+//  startPinPulse() drives the pin at once and the control timer tick releases it once the duration has passed, so a
+//  shutdown triggered from the control interrupt no longer stalls telemetry, logging and the other safety checks
+//  the boards route their control timer through controlInterrupt(), which runs updatePinPulses() before the sketch
+//  control function; until the control timer is attached, pulses block as before
+const int PINPULSESMAXLENGTH = 4; // max number of pins pulsing at once
+
+// a pin driven for a while, then released
+struct PinPulse
+{   uint8_t pin; // pulsed pin
+    uint8_t level; // level driven during the pulse, HIGH or LOW
+    bool isReleasedToInput; // if true, the pin is released to a high-impedance input, else driven to !level
+    unsigned long startMicros; // micros() when the pulse started
+    unsigned long durationMicros; // pulse length
+};
+
+// unit conversion scales
+//  each board caches its VCC-dependent conversion factors in updateVCC(), so that raw2mV(), raw2mA(), mV2raw() and
+//  mA2raw() are one 32-bit multiply and a shift, with no division (the ATmega328p has no hardware divider)
+//  the reciprocal factors of mV2raw() and mA2raw() are fixed-point, with these fraction bits (results within 1 LSB)
+const uint8_t MV2RAW_Q = 20; // mV2raw scale = 2^(10 + MV2RAW_Q)/(13*VCC), mV*scale < 2^31 for VCC > 2521 mV
+const uint8_t MA2RAW_Q = 18; // mA2raw scale = 341*2^MA2RAW_Q/VCC, mA*scale < 2^31 for VCC > 1364 mV
+
+// deferred command queue
+//  with enableCommandQueue(), ASCII commands received in the I2C interrupt are only copied into the queue
+//  processCommandQueue(), called from loop(), then parses and executes them outside of any interrupt
+//  so a slow command (e.g. sprintf in a long response) can never delay the next control update
+
+// one entry of the deferred command queue
+struct QueuedCommand
+{   char line[COMMBUFFERSIZE]; // null-terminated command line, e.g. "WDRP:100"
+    uint8_t receiveProtocol; // link the command arrived on (UART_INDEX or I2C_INDEX)
+    unsigned long queuedMicros; // micros() when the command was queued
+};
+
+// binary registers common to all boards. board registers start at 0x01, sketch registers start at 0x40
+enum BinaryRegisters
+{   BINREG_NACK = 0x00, // response register ID when the requested register is unknown or the CRC failed
+    BINREG_SKETCH = 0x40, // first register ID available to RegisterCallback functions in the .ino file
+    BINREG_COMMSTATS = 0x78, // R: total event count (overflows to empty I2C reads) of both links; W: resets
+    BINREG_CHUNK = 0x79, // chunked block transfer, see chunk framing above
+    BINREG_STREAMMASK = 0x7A, // RW: snapshot entries included in stream frames, bit n = entry n (unsigned)
+    BINREG_STREAMDECIMATION = 0x7B, // RW: control updates per stream frame, 0 stops the stream
+    BINREG_QUEUEDEPTH = 0x7C, // R: peak deferred command queue depth; W: any value resets the queue statistics
+    BINREG_QUEUEWAIT = 0x7D, // R: worst-case deferred command wait (microseconds, unsigned, saturates at 65535)
+    BINREG_SNAPSHOT = 0x7E, // R: bulk snapshot of every board sensor and state, see snapshot framing above
+    BINREG_PROTOCOL = 0x7F // link protocol; write ASCII_PROTOCOL (0) to leave binary mode
+};
 
 class PicroBoard
 {
@@ -37,16 +277,79 @@ class PicroBoard
     PicroBoard(); // constructor
     // Communication functions for commands parsing and interpretation
     void addCommandCallback(CommandCallback callback); // adds a serial command callback to the array
+    void addRegisterCallback(RegisterCallback callback); // adds a binary register callback to the array
+    void setCommandTable(const CommandEntry* table, int length); // sets the sorted PROGMEM sketch command table
     void parseRXLine(char* buffer, int receiveProtocol); // parses given rxBuffer and calls appropriate valueFunction
-    virtual void interpretRXCommand(char* command, char* value, int receiveProtocol); // processes RX command, override it
+    void parseRXLine(char* line, int length, int receiveProtocol); // parses a (pointer, length) line in place
+    virtual void interpretRXCommand(char* command, char* value, int receiveProtocol); // processes RX command
     void respondToMaster(int receiveProtocol); // responds to the raspberry Pi
     char * getTXBuffer(int commIndex); // get a pointer to the indexed stored transmit buffer
+    uint8_t getStatusI2C(); // gets the I2C response status byte: I2CSTATUSREADY | sequence number
+    // Communication functions for the binary register protocol
+    void setLinkProtocol(int commIndex, int protocol); // sets the protocol (ASCII or binary) of a link
+    int getLinkProtocol(int commIndex); // gets the protocol (ASCII or binary) of a link
+    virtual bool readRegister(uint8_t reg, int* value); // reads a binary register, override it
+    virtual bool writeRegister(uint8_t reg, int value); // writes a binary register, override it
+    void processBinaryFrame(uint8_t* frame, int receiveProtocol); // executes a received binary frame
+    int latchSnapshot(uint8_t* frame); // latches all snapshot registers into a frame, returns its length
+    // Chunked block transfers over the binary protocol
+    bool addTransferBlock(uint8_t block, uint8_t* data, int length, bool isWritable, TransferCallback callback);
+    int processChunkFrame(const uint8_t* frame, int length, uint8_t* response); // returns the response length
+    static int getChunkFrameLength(const uint8_t* frame); // expected frame length from its header, 0 if invalid
+    static uint8_t crc8(const uint8_t* data, int length); // CRC-8 used by binary frames
+    static int findCommand(const char* command, const void* table, int length, int entrySize, bool isSorted);
+    // Push-mode telemetry stream over UART
+    void startStream(unsigned int decimation, unsigned int mask); // pushes selected snapshot registers
+    void startStream(unsigned int decimation); // pushes every snapshot register
+    void stopStream(); // stops pushing stream frames
+    void updateStream(); // latches a stream frame every decimation calls, call from the control interrupt
+    unsigned int getStreamDrops(); // number of stream frames dropped because the UART could not keep up
+    // Interrupt-driven ADC scan engine
+    void startADCScan(const ADCScanChannel* channels, int length); // scans a PROGMEM channel list from the interrupt
+    void stopADCScan(); // stops the scan once the conversion in flight completes
+    bool isADCScanRunning(); // returns true while the scan engine owns the ADC
+    unsigned long getADCScanCount(); // number of scanned samples since startup
+    virtual void updateScanSample(uint8_t sensorIndex, int sample); // feeds one scanned sample, override it
+    static void adcCompleteEvent(); // called from the ADC conversion complete interrupt
+    virtual void armADCScanTrigger(); // starts the selected scan conversion, override it to start on a timer event
+    bool isADCBusy(); // returns true while the ADC interrupt owns the ADC (scan or VCC measurement)
+    // Timed pin pulses, released by the control timer tick
+    void startPinPulse(uint8_t pin, uint8_t level, bool isReleasedToInput, unsigned long durationMicros);
+    void startPinPulses(const uint8_t* pins, uint8_t length, uint8_t level, bool isReleasedToInput,
+      unsigned long durationMicros); // pulses several pins together, e.g. every channel of a shutdown
+    void releasePinPulse(uint8_t pin); // ends a pulse early, releasing the pin now
+    void cancelPinPulse(uint8_t pin); // forgets a pulse without touching the pin, e.g. the pin is reassigned
+    bool isPinPulsing(uint8_t pin); // returns true while a pin is held by a pulse
+    void updatePinPulses(); // releases expired pulses, runs from controlInterrupt()
+    static void controlInterrupt(); // control timer tick: runs updatePinPulses(), then the sketch control function
+    virtual void updateControlTick(); // runs at the end of every control timer tick, override it with the particular board
+    // Non-blocking VCC measurement
+    bool updateVCCAsync(); // applies a finished VCC measurement and starts the next one, true if applied
+    bool isVCCUpdateRunning(); // returns true while a VCC measurement owns the ADC
+    virtual void applyVCC(int vcc); // stores a measured VCC (mV), override it with the particular board
+    // Deferred command queue, so that commands received in interrupts are executed from loop()
+    void enableCommandQueue(); // queue I2C commands in the receive interrupt instead of executing them there
+    bool queueCommand(const char* line, int receiveProtocol); // copies a command line into the queue
+    void processCommandQueue(); // executes every queued command, call from loop()
+    int getCommandQueueDepth(); // number of commands currently waiting in the queue
+    int getCommandQueueDepthMax(); // peak number of commands waiting in the queue
+    unsigned long getCommandQueueWaitMax(); // worst-case microseconds a command waited in the queue
+    unsigned int getCommandQueueDrops(); // number of commands rejected because the queue was full
+    void resetCommandQueueStats(); // resets the peak depth, worst-case wait and drop count
+    // Communication health statistics
+    unsigned int getCommStat(int commIndex, int field); // gets one CommStatField of a link
+    const char* getCommSlowestCommand(int commIndex); // gets the command that took the longest handler time
+    void resetCommStats(); // resets the statistics of both links
     // Communication functions for UART
     void startUART(long baud); // start serial communications
     void startUART(); // start serial communications
-    void readUART(); // read in from the UART buffer and store it, and parse it if \n detected
-    char * getRXBufferUART(); // get a pointer to the stored UART receive buffer
-    void parseRXLineUART(); // parses the current UART rxBuffer
+    void readUART(); // receiveUART() then processUART(), for sketches that poll UART from loop()
+    void receiveUART(); // moves new UART characters into the ring buffer, cheap enough for the control interrupt
+    void receiveByteUART(uint8_t c); // adds one received byte to the UART ring buffer (producer side)
+    void processUART(); // parses every complete line in the UART ring buffer, call from loop() (consumer side)
+    unsigned int getRXErrorsUART(); // number of UART lines rejected as too long or incomplete
+    char * getRXBufferUART(); // get a pointer to the most recent UART line
+    void parseRXLineUART(); // parses the most recent UART line again
     // Communication functions for I2C
     void startI2C(int address, ReceiveEventI2C receiveCallback, RequestEventI2C requestCallback); // start I2C
     void receiveEventI2C(int howMany); // function to handle when an I2C transmit message comes in
@@ -56,11 +359,93 @@ class PicroBoard
   protected:
     CommandCallback _commandCallbacks[COMMANDCALLBACKSMAXLENGTH]; // callback listeners to call at end of interpretRXCommand
     int _commandCallbacksEnd = 0; // moving end index of _commandCallbacks
-    char _rxBufferUART [COMMBUFFERSIZE]; // receive holding buffer for UART packets
-    int _rxCntUART = 0; // end index of _rxBufferUART
+    RegisterCallback _registerCallbacks[REGISTERCALLBACKSMAXLENGTH]; // binary register listeners in the .ino file
+    int _registerCallbacksEnd = 0; // moving end index of _registerCallbacks
+    const RegisterCommandEntry* _boardCommands = NULL; // sorted PROGMEM board command table, set by the board
+    int _boardCommandsLength = 0; // number of entries in _boardCommands
+    const CommandEntry* _sketchCommands = NULL; // PROGMEM sketch command table, set by setCommandTable()
+    int _sketchCommandsLength = 0; // number of entries in _sketchCommands
+    bool _sketchCommandsSorted = true; // if false, _sketchCommands is searched linearly
+    const SnapshotEntry* _snapshotRegisters = NULL; // PROGMEM snapshot register list, set by the board
+    int _snapshotLength = 0; // number of entries in _snapshotRegisters
+    CommStats _commStats[NUM_COMM_MODULES]; // communication health statistics per link
+    TransferBlock _transferBlocks[TRANSFERBLOCKSMAXLENGTH]; // RAM blocks exposed to chunked transfers
+    int _transferBlocksEnd = 0; // moving end index of _transferBlocks
+    uint8_t _chunkFrameI2C [CHUNKFRAMESIZE]; // I2C transmit holding buffer for chunk responses
+    uint8_t _linkProtocol[NUM_COMM_MODULES] = {ASCII_PROTOCOL, ASCII_PROTOCOL}; // negotiated protocol per link
+    // UART receive ring buffer: single producer (receiveByteUART) and single consumer (processUART)
+    //  the first UARTLINEMAX bytes are mirrored past the end, so every line is contiguous in memory
+    char _rxRingUART [UARTRINGSIZE + UARTLINEMAX]; // receive ring buffer for UART lines and frames
+    volatile uint8_t _rxHeadUART = 0; // next index written by the producer
+    volatile uint8_t _rxTailUART = 0; // start of the oldest line not yet released by the consumer
+    uint8_t _rxScanUART = 0; // next index checked by the consumer for a '\n'
+    bool _rxDiscardUART = false; // true while skipping the rest of an overlong line
+    volatile bool _rxOverrunUART = false; // true while the producer drops the rest of a line that did not fit
+    char* _rxLineUART = _rxRingUART; // most recent UART line, a view into _rxRingUART
+    volatile unsigned int _streamDecimation = 0; // control updates per stream frame, 0 if not streaming
+    volatile unsigned int _streamMask = 0xFFFF; // snapshot entries included in stream frames
+    unsigned int _streamCounter = 0; // control updates until the next stream frame
+    unsigned int _streamSequence = 0; // sequence number of the next stream frame
+    unsigned int _streamDrops = 0; // count of stream frames dropped because the previous one was not sent
+    volatile uint8_t _streamLength = 0; // length of the latched stream frame, 0 if none is waiting to be sent
+    uint8_t _streamFrame [STREAMFRAMESIZE]; // transmit holding buffer for stream frames
+    const ADCScanChannel* _adcScanChannels = NULL; // PROGMEM channel list of the ADC scan
+    int _adcScanLength = 0; // number of channels in _adcScanChannels
+    uint8_t _adcScanIndex = 0; // channel of the conversion in flight
+    volatile bool _isADCScanRunning = false; // if true, the ADC interrupt starts the next conversion
+    volatile unsigned long _adcScanCount = 0; // number of scanned samples
+    uint8_t _adcScanPrescalerBS = ADCSCAN_PRESCALER_BS; // ADC clock = F_CPU >> _adcScanPrescalerBS while scanning
+    bool pauseADCScan(); // stops the scan for a direct ADC reading, returns true if it was running
+    void resumeADCScan(); // restarts the scan after pauseADCScan(), from the first channel
+    void setControlFunction(void (*interruptFunction)(void)); // sets the sketch function run by controlInterrupt()
+    PinPulse _pinPulses [PINPULSESMAXLENGTH]; // pulses in progress
+    volatile uint8_t _pinPulsesLength = 0; // number of pulses in progress
+    long _bandgapScale = 1125300L; // VCC (mV) = _bandgapScale/(bandgap ADC reading), 1125300 = 1.1*1023*1000
+    volatile uint8_t _vccState = VCCIDLE; // VCCUpdateState of the non-blocking VCC measurement
+    unsigned long _vccSettleStart = 0; // micros() when the ADC mux switched to the bandgap
+    uint8_t _vccSampleCount = 0; // bandgap conversions averaged so far
+    unsigned int _vccAccumulator = 0; // sum of the averaged bandgap conversions
+    uint8_t _vccSavedADCSRA = 0; // ADC control register to restore if no scan is running
+    QueuedCommand _commandQueue [COMMANDQUEUESIZE]; // deferred commands: I2C interrupt in, loop() out
+    volatile uint8_t _commandQueueHead = 0; // next index written by the producer
+    volatile uint8_t _commandQueueTail = 0; // oldest command not yet executed by the consumer
+    bool _isCommandQueueEnabled = false; // if true, I2C commands are queued instead of executed in the interrupt
+    volatile uint8_t _commandQueueDepthMax = 0; // peak depth of _commandQueue
+    unsigned long _commandQueueWaitMax = 0; // worst-case wait in _commandQueue (microseconds)
+    volatile unsigned int _commandQueueDrops = 0; // count of commands rejected by a full queue
     char _rxBufferI2C [COMMBUFFERSIZE]; // receive holding buffer for I2C packets
-    int _rxCntI2C = 0; // end index of _rxBufferUART
-    char _txBuffer [NUM_COMM_MODULES][COMMBUFFERSIZE]; // transmit holding buffer prior to transmission  
+    int _rxCntI2C = 0; // end index of _rxBufferI2C
+    char _txBufferUART [COMMBUFFERSIZE]; // UART transmit holding buffer prior to transmission
+    // I2C transmit double buffer: responses are written into the back buffer, then published by swapping it
+    //  with the front buffer, so requestEventI2C() never sends a half-written response
+    char _txBuffersI2C [2][COMMBUFFERSIZE]; // I2C transmit front and back buffers
+    volatile uint8_t _txFrontI2C = 0; // index of the published (front) buffer in _txBuffersI2C
+    volatile uint8_t _statusI2C = 0; // I2CSTATUSREADY | sequence number of the last published response
+    const char* _txErrorI2C = NULL; // error response published from the I2C interrupt, a string literal
+    bool _isStatusRequestI2C = false; // true if the master selected the status byte for its next read
+    uint8_t _txBinaryI2C [BINFRAMESIZE]; // binary I2C response frame
+    uint8_t _snapshotFrameI2C [SNAPSHOTFRAMESIZE]; // I2C transmit holding buffer for snapshot frames
+    const uint8_t* _txFrameI2C = NULL; // binary I2C response: _txBinaryI2C, _snapshotFrameI2C or _chunkFrameI2C
+    volatile int _txLengthI2C = 0; // number of bytes in a binary I2C response (ASCII responses are null-terminated)
+  private:
+    void interpretRegisterCommand(char* command, char* value, int receiveProtocol, uint8_t reg, uint8_t format);
+    void respondSnapshot(int receiveProtocol); // responds to "RALL" with every snapshot register
+    bool readBinaryUART(int available); // executes the binary frame at the tail of the UART ring, false if incomplete
+    void rejectLineUART(const char* reason); // counts and answers a UART line that could not be parsed
+    void sendStreamUART(); // writes out a latched stream frame once the UART transmit buffer has room
+    void receiveBinaryI2C(int howMany); // handles an I2C transmit message in binary mode
+    void countCommEvent(int commIndex, int field); // increments an event counter of a link
+    void recordHandlerTime(int commIndex, const char* command, uint8_t reg, unsigned long startMicros);
+    void respondCommStats(const char* command, const char* value, int receiveProtocol); // "RCST" and "RCSC"
+    void startADCScanConversion(); // selects the current scan channel and starts its conversion
+    void startVCCConversion(); // selects the bandgap and starts settling, from the interrupt or updateVCCAsync()
+    void updateVCCConversion(int sample); // steps the VCC measurement with a finished bandgap conversion
+    void releaseVCCConversion(); // hands the ADC back to the scan engine, or to analogRead()
+    static PicroBoard* _adcScanBoard; // board that owns the ADC conversion complete interrupt
+    static PicroBoard* _controlBoard; // board whose pin pulses the control timer tick releases
+    static void (*_controlFunction)(void); // sketch control function run by controlInterrupt()
+    void endPinPulse(uint8_t pin, bool isReleased); // removes a pulse, optionally releasing its pin
+    void publishI2C(const char* error, const uint8_t* frame, int length); // publishes the next I2C response
 };
 
 #endif
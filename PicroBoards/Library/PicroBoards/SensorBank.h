@@ -0,0 +1,128 @@
+/*
+  SensorBank.h - Moving averages of raw sensor samples, shared by all PicroBoards
+  Released into the public domain.
+*/
+
+#ifndef SensorBank_h
+#define SensorBank_h
+
+#include "Arduino.h"
+
+// a SensorBank holds one moving average per sensor channel, each over a window of 2^shift samples
+//  e.g. SensorBank<2, 2, 4> has two channels averaged over 4 samples and one averaged over 16 samples
+//  every channel is a ring buffer wrapped with a bit mask, and averages are computed with a bit-shift, so an
+//  update is a handful of instructions with no division and no switch on the channel
+//  samples are raw 10-bit ADC values (-1023 to 1023), so windows up to 32 samples use 16-bit accumulators
+//  averages can also be read oversampled, with up to half the window bit-shift in extra bits (e.g. 12 bits from 16 samples)
+//  the ADC interrupt updates the accumulators, so they are read with interrupts held off: an accumulator is 2 or 4
+//  bytes, and a read interrupted between bytes could mix the old and new value (e.g. 0x00FF -> 0x0100 read as 0x01FF)
+
+// window bit-shift for a window of n samples, rounded down to a power of 2 (e.g. 32 -> 5, 20 -> 4)
+constexpr uint8_t sensorWindowShift(int n) {
+  return (n <= 1) ? 0 : 1 + sensorWindowShift(n >> 1);
+}
+
+// total window length and largest window shift of a list of channels, at compile time
+template <uint8_t... Shifts> struct SensorWindows;
+template <> struct SensorWindows<>
+{   static const uint16_t total = 0;
+    static const uint8_t maxShift = 0;
+};
+template <uint8_t First, uint8_t... Rest> struct SensorWindows<First, Rest...>
+{   static const uint16_t total = (1 << First) + SensorWindows<Rest...>::total;
+    static const uint8_t maxShift = (First > SensorWindows<Rest...>::maxShift) ? First : SensorWindows<Rest...>::maxShift;
+};
+
+// window shift of one channel in a list of channels, at compile time
+template <uint8_t Channel, uint8_t... Shifts> struct SensorWindowShift;
+template <uint8_t First, uint8_t... Rest> struct SensorWindowShift<0, First, Rest...>
+{   static const uint8_t value = First;
+};
+template <uint8_t Channel, uint8_t First, uint8_t... Rest> struct SensorWindowShift<Channel, First, Rest...>
+{   static const uint8_t value = SensorWindowShift<Channel - 1, Rest...>::value;
+};
+
+// narrowest accumulator that holds a full window of 10-bit samples
+template <bool isNarrow> struct SensorAccumulator { typedef long type; };
+template <> struct SensorAccumulator<true> { typedef int type; };
+
+template <uint8_t... Shifts>
+class SensorBank
+{
+  public:
+    static const uint8_t CHANNELS = sizeof...(Shifts); // number of sensor channels
+    typedef typename SensorAccumulator<(SensorWindows<Shifts...>::maxShift <= 5)>::type Accumulator;
+
+    SensorBank() { // lays out every channel ring buffer back to back in one array
+      const uint8_t shifts[CHANNELS] = {Shifts...};
+      int* past = _past;
+      for (uint8_t n = 0; n < CHANNELS; n++) {
+        _rings[n].past = past;
+        _rings[n].accumulator = 0;
+        _rings[n].iterator = 0;
+        _rings[n].mask = (1 << shifts[n]) - 1;
+        _rings[n].shift = shifts[n];
+        past += 1 << shifts[n];
+      }
+      memset(_past, 0, sizeof(_past));
+    }
+
+    // adds a sample to a channel chosen at run time, e.g. by the ADC scan engine
+    void update(uint8_t channel, int sample) {
+      Ring* ring = &_rings[channel];
+      int* oldest = &ring->past[ring->iterator];
+      ring->accumulator += sample - *oldest; // subtract oldest value from accumulator, add new value
+      *oldest = sample;
+      ring->iterator = (ring->iterator + 1) & ring->mask;
+    }
+
+    // adds a sample to a channel known at compile time, with a constant mask
+    template <uint8_t Channel> void update(int sample) {
+      Ring* ring = &_rings[Channel];
+      int* oldest = &ring->past[ring->iterator];
+      ring->accumulator += sample - *oldest;
+      *oldest = sample;
+      ring->iterator = (ring->iterator + 1) & ((1 << SensorWindowShift<Channel, Shifts...>::value) - 1);
+    }
+
+    // gets the moving average of a channel known at compile time, with a constant bit-shift
+    //  Bits > 0 oversamples: the window sum of 4^Bits samples is decimated to Bits more bits than the ADC
+    template <uint8_t Channel, uint8_t Bits = 0> int average() const {
+      static_assert(2*Bits <= SensorWindowShift<Channel, Shifts...>::value,
+        "oversampling by n bits needs a window of at least 4^n samples");
+      return (int)(sum(Channel) >> (SensorWindowShift<Channel, Shifts...>::value - Bits));
+    }
+
+    // gets the moving average of a channel chosen at run time
+    int average(uint8_t channel) const {
+      return (int)(sum(channel) >> _rings[channel].shift);
+    }
+
+    // gets the window length (in samples) of a channel
+    int window(uint8_t channel) const {
+      return _rings[channel].mask + 1;
+    }
+
+  private:
+    // one channel ring buffer
+    struct Ring
+    {   int* past; // past samples of this channel, a view into _past
+        Accumulator accumulator; // sum of the past samples
+        uint8_t iterator; // index of the oldest sample, the next to be replaced
+        uint8_t mask; // window length - 1
+        uint8_t shift; // window bit-shift
+    };
+    Ring _rings[CHANNELS];
+    int _past[SensorWindows<Shifts...>::total]; // past samples of every channel, back to back
+
+    // gets the window sum of a channel in one piece, even if the ADC interrupt updates it meanwhile
+    Accumulator sum(uint8_t channel) const {
+      uint8_t oldSREG = SREG;
+      cli();
+      Accumulator accumulator = _rings[channel].accumulator;
+      SREG = oldSREG;
+      return accumulator;
+    }
+};
+
+#endif
@@ -44,7 +44,7 @@ void controlUpdate(void)
   slowInterruptCounter++; // in this example, do some special stuff every 1 second (1000ms)
   if (slowInterruptCounter > 1000) {
     slowInterruptCounter = 0;
-    micropanel.updateVCC(); // read on-board VCC voltage, update stored average (shouldn't change)
+    micropanel.updateVCCAsync(); // measure on-board VCC in the background, update stored average (shouldn't change)
     // prints channel state (as binary), VCC, VBus, I1, I2, I3, I4 to the serial console of attached computer
     Serial.print("State: ");
     Serial.print(micropanel.getCh1());
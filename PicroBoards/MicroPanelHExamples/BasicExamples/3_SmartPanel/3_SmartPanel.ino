@@ -17,6 +17,7 @@ long slowInterruptCounter = 0;
 void setup() {
   micropanel.setupPinMode(); // set pins to input or output
   micropanel.initializeSensors(); // set filtered sensor values to initial reading
+  micropanel.startADCScan(); // from now on, sample every sensor from the ADC interrupt instead of loop()
   micropanel.setCurrentLimit1(6000); // set gate shutdown at 6A peak current 
   micropanel.setCurrentLimit2(6000); // set gate shutdown at 6A peak current 
   micropanel.setCurrentLimit3(6000); // set gate shutdown at 6A peak current 
@@ -33,25 +34,28 @@ void setup() {
   ReceiveEventI2C receiveEvent = [] (int howMany) {micropanel.receiveEventI2C(howMany);};
   RequestEventI2C requestEvent = [] () {micropanel.requestEventI2C();};
   micropanel.startI2C(8, receiveEvent, requestEvent); // first argument is the slave device address (max 127)
+  micropanel.enableCommandQueue(); // run I2C commands from loop(), not inside the I2C interrupt
 
   // initialize interrupt timer for periodic calls to control update funciton
   micropanel.initializeInterruptTimer(1000, &controlUpdate); // control update every 1ms (= 1000 microseconds)
 }
 
 void loop() {
-  micropanel.updateVISensors(); // read voltage and current sensors and update moving average
+  micropanel.processUART(); // parse complete UART lines outside of the control interrupt
+  micropanel.processCommandQueue(); // run I2C commands queued by the I2C interrupt
 }
 
 // main controller update function, which runs on every timer interrupt
 void controlUpdate(void)
 {
-  micropanel.readUART(); // if using UART, check every cycle if there are new characters in the UART buffer
+  micropanel.receiveUART(); // if using UART, move new characters into the ring buffer (parsed in loop())
+  micropanel.updateStream(); // if the master subscribed to a telemetry stream, latch a frame at a fixed rate
   micropanel.checkCurrentShutdown(); // checks average current and shut down gates if necessary
 
   slowInterruptCounter++; // in this example, do some special stuff every 1 second (1000ms)
   if (slowInterruptCounter > 1000) {
     slowInterruptCounter = 0;
-    micropanel.updateVCC(); // read on-board VCC voltage, update stored average (shouldn't change)
+    micropanel.updateVCCAsync(); // measure on-board VCC in the background, update stored average (shouldn't change)
     // prints channel state (as binary), VCC, VBus, I1, I2, I3, I4 to the serial console of attached computer
   //   Serial.print("State: ");
   //   Serial.print(micropanel.getCh1());
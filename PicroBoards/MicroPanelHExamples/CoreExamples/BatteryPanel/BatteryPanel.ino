@@ -35,6 +35,7 @@
 */
 
 #include <MicroPanelH.h>
+#include <LookupTable.h>
 
 MicroPanelH micropanel;
 long slowInterruptCounter = 0;
@@ -47,19 +48,21 @@ const long BATTMASEC = 50*1000L*3600; // battery milliamp-second rating (= amp-h
 const int SOCLOW = 10; // below this SOC coulomb counter is updated every second based on adjusted battery voltage
 const int SOCHIGH = 90; // above this SOC, columb counter is updated every second based on adjusted battery voltage
 
-// bati8tery curve lookup table
+// battery curve lookup table (battery voltage mV, SOC %), in flash (see RaspberryPi/CoreExamples/BatteryCurve/LerpLUT.py)
 const int LUTN = 9;
-const unsigned int BATTV[LUTN] = {43439, 46006, 48225, 49663, 50820, 52756, 52814, 53174, 53953};
-// const unsigned int BATTV[LUTN] = {21720, 23003, 24112, 24832, 25410, 26378, 26407, 26587, 26977};
-const int BATTSOC[LUTN] = {0, 1, 3, 5, 8, 51, 86, 95, 100};
+const LookupPoint<unsigned int> BATTCURVE[LUTN] PROGMEM = {
+  {43439, 0}, {46006, 1}, {48225, 3}, {49663, 5}, {50820, 8}, {52756, 51}, {52814, 86}, {53174, 95}, {53953, 100}};
+// const LookupPoint<unsigned int> BATTCURVE[LUTN] PROGMEM = {
+//   {21720, 0}, {23003, 1}, {24112, 3}, {24832, 5}, {25410, 8}, {26378, 51}, {26407, 86}, {26587, 95}, {26977, 100}};
+LookupTable<unsigned int> battCurve(BATTCURVE, LUTN);
 
 
 
 
 // test data
 // const long BATTMASEC = 1*1000L*3600; // battery milliamp-second rating (= amp-hours * 1000 * 3600)
-// const unsigned int BATTV[LUTN] = {15000, 16000, 17000, 18000, 19000, 20000, 21000, 22000, 23000};
-// const int BATTSOC[LUTN] = {0, 13, 25, 37, 50, 63, 75, 87, 100};
+// const LookupPoint<unsigned int> BATTCURVE[LUTN] PROGMEM = {
+//   {15000, 0}, {16000, 13}, {17000, 25}, {18000, 37}, {19000, 50}, {20000, 63}, {21000, 75}, {22000, 87}, {23000, 100}};
 // const int SOCLOW = 25; // below this SOC coulomb counter is updated every second based on adjusted battery voltage
 // const int SOCHIGH = 75; // above this SOC, columb counter is updated every second based on adjusted battery voltage
 
@@ -72,10 +75,9 @@ const int BATTSOC[LUTN] = {0, 1, 3, 5, 8, 51, 86, 95, 100};
 int iBatExtIn = 0; // raw battery input current (-512 to 512), which must be measured externally or ignored
 int iBatExtOut = 0; // raw battery input current (-512 to 512), which must be measured externally or ignored
 int soc; // global variable to track the SOC, calculated by battery voltage
-unsigned int battVArr[LUTN]; // raw version of battery voltage to SOC array
 
 // global variables for coulomb counting (relevant for SOC calculations)
-long ccntAccumulator = 0; // sub-second column counter accumulator for averaging (raw 0-1023)
+long ccntAccumulator = 0; // sub-second column counter accumulator for averaging (oversampled raw, see getWideRawITotal())
 long coulombCounter = 0L; // coulomb counter (mA-sec), (1 A-h = 3,600,000 mA-sec)
 
 // cumulative moving average for channel 4 software shutoff
@@ -88,6 +90,7 @@ int iCh4Acc[CH4AVGWINDOW] = {0}; // accumulator for moving average
 void setup() {
   micropanel.setupPinMode(); // set pins to input or output
   micropanel.initializeSensors(); // set filtered sensor values to initial reading
+  micropanel.startADCScan(); // from now on, sample every sensor from the ADC interrupt instead of loop()
   micropanel.setCurrentLimit1(6000); // set software current shutdown at 6A peak current 
   micropanel.setCurrentLimit2(6000); // set software current shutdown at 6A peak current 
   micropanel.setCurrentLimit3(6000); // set software current shutdown at 6A peak current 
@@ -105,11 +108,10 @@ void setup() {
   ReceiveEventI2C receiveEvent = [] (int howMany) {micropanel.receiveEventI2C(howMany);};
   RequestEventI2C requestEvent = [] () {micropanel.requestEventI2C();};
   micropanel.startI2C(8, receiveEvent, requestEvent); // first argument is the slave device address (max 127)
+  micropanel.enableCommandQueue(); // run I2C commands from loop(), not inside the I2C interrupt
 
   // set battery raw parameters (raw 0-1023)
   micropanel.setRDroop(RINTERNAL);
-  for (int n = 0; n < LUTN; n++)
-    battVArr[n] = micropanel.mV2raw(BATTV[n]);
 
   // initialize inrush override for channels
   micropanel.setDefaultInrushOverride(200); // hold default channel protection for 200us to ride through inrush current
@@ -125,17 +127,19 @@ void setup() {
 
   // initialize coulomb counter based on battery voltage and current measured by micropanel only
   int vBat0A = micropanel.getRawVBus() + micropanel.getVDroopRaw(micropanel.getRawITotal());
-  coulombCounter = soc2mAsec(interpolate(battVArr, BATTSOC, LUTN, vBat0A));
+  coulombCounter = soc2mAsec(battCurve.lookup(micropanel.raw2mV(vBat0A)));
 }
 
 void loop() {
-  micropanel.updateVISensors(); // read voltage and current sensors and update moving average
+  micropanel.processUART(); // parse complete UART lines outside of the control interrupt
+  micropanel.processCommandQueue(); // run I2C commands queued by the I2C interrupt
 }
 
 // main controller update function, which runs on every timer interrupt
 void controlUpdate(void)
 {
-  micropanel.readUART(); // if using UART, check every cycle if there are new characters in the UART buffer
+  micropanel.receiveUART(); // if using UART, move new characters into the ring buffer (parsed in loop())
+  micropanel.updateStream(); // if the master subscribed to a telemetry stream, latch a frame at a fixed rate
   micropanel.checkCurrentShutdown(); // checks average current and shut down gates if necessary
 
   // analog read battery voltage
@@ -152,12 +156,12 @@ void controlUpdate(void)
   int iBatOut = micropanel.getRawITotal(); // current out of battery (positive)
   int iBat = iBatOut + iBatExtOut - iBatExtIn; // iBat represents the raw net current out of the battery
 
-  // update the sub-second raw coulomb counter accumulator
-  ccntAccumulator += iBat;
+  // update the sub-second raw coulomb counter accumulator, oversampled to resolve currents below one 10-bit LSB
+  ccntAccumulator += micropanel.getWideRawITotal() + (long)(iBatExtOut - iBatExtIn)*(1 << SENSOR_I_OVERSAMPLE_BITS);
 
   // BMS code: turn off loads if battery SOC is too low
   int vBat0A = vBat + micropanel.getVDroopRaw(iBat); // adjusted battery voltage, accounting for voltage droop due to iBat
-  int socInterp = interpolate(battVArr, BATTSOC, LUTN, vBat0A); // temporary soc value based only on battery voltage and current
+  int socInterp = battCurve.lookup(micropanel.raw2mV(vBat0A)); // temporary soc value based only on battery voltage and current
   if (socInterp < SOCMIN) { // SOC goes below min threshold
     if (micropanel.isSomeChannelsActive())
       micropanel.shutdownChannels();
@@ -167,7 +171,7 @@ void controlUpdate(void)
   slowInterruptCounter++; 
   if (slowInterruptCounter > 1000) {
     slowInterruptCounter = 0;
-    micropanel.updateVCC(); // read on-board VCC voltage, update stored average (shouldn't change)
+    micropanel.updateVCCAsync(); // measure on-board VCC in the background, update stored average (shouldn't change)
 
     // SOC final calculation and coulomb counter update
     if (socInterp < SOCLOW || socInterp > SOCHIGH) { // at high or low battery voltage
@@ -175,7 +179,7 @@ void controlUpdate(void)
       soc = socInterp; // calculate SOC based entirely on battery voltage and current
     } else { // at mid range battery voltage
       // average the sub-second raw coulomb count accumulator, and convert it to a mA-second value to accumulate
-      coulombCounter -= micropanel.raw2mA(ccntAccumulator/1000);
+      coulombCounter -= micropanel.raw2mA(ccntAccumulator/1000, SENSOR_I_OVERSAMPLE_BITS);
       ccntAccumulator = 0;
       soc = mAsec2soc(coulombCounter); // use coulomb counter to calculate SOC
       if (soc < SOCLOW || soc > SOCHIGH) // if the coulomb counter gets too desynchronized from the voltage measurement
@@ -228,25 +232,6 @@ void controlUpdate(void)
   }
 }
 
-// interpolation for finding battery SOC based on voltage using lookup table
-int interpolate(int x[], int y[], int n, int x_query)
-{
-  // Handle out-of-range queries by clamping
-  if (x_query <= x[0]) return y[0];
-  if (x_query >= x[n - 1]) return y[n - 1];
-  // Find the interval [x[i], x[i+1]] containing x_query
-  int i = 0;
-  while (i < n - 1 && x_query > x[i + 1])
-    ++i;
-  int x0 = x[i], x1 = x[i + 1];
-  int y0 = y[i], y1 = y[i + 1];
-  // Protect against zero-division if x values are identical
-  if (x1 == x0)
-    return y0;
-  // Linear interpolation formula
-  return y0 + (y1 - y0) * (x_query - x0) / (x1 - x0);
-}
-
 // convert SOC to an equivalent mA-sec value for coulomb counter
 long soc2mAsec(int socInput)
 {
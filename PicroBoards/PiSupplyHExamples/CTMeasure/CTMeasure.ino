@@ -45,18 +45,22 @@ void setup() {
   ReceiveEventI2C receiveEvent = [] (int howMany) {pisupply.receiveEventI2C(howMany);};
   RequestEventI2C requestEvent = [] () {pisupply.requestEventI2C();};
   pisupply.startI2C(5, receiveEvent, requestEvent); // first argument is the slave device address (max 127)
+  pisupply.enableCommandQueue(); // run I2C commands from loop(), not inside the I2C interrupt
 
   pisupply.initializeInterruptTimer(1000, &controlUpdate); // control update every 1ms
 }
 
 void loop() {
+  pisupply.processUART(); // parse complete UART lines outside of the control interrupt
+  pisupply.processCommandQueue(); // run I2C commands queued by the I2C interrupt
   pisupply.updateSensors();
 }
 
 // main controller update function, which runs on every timer interrupt
 void controlUpdate(void)
 {
-  pisupply.readUART(); // if using UART, check every cycle if there are new characters in the UART buffer
+  pisupply.receiveUART(); // if using UART, move new characters into the ring buffer (parsed in loop())
+  pisupply.updateStream(); // if the master subscribed to a telemetry stream, latch a frame at a fixed rate
 }
 
 void interpretRXCommand(char* command, char* value, int receiveProtocol) {
@@ -1,7 +1,7 @@
 # python3 Picrogrid/RaspberryPi/BasicExamples/Pi_I2C_Shell.py
 
 #!/usr/bin/env python
-from time import sleep
+from time import sleep, time
 import smbus2
 bus = smbus2.SMBus(1)
 address = 0x08
@@ -12,6 +12,21 @@ def StringToBytes(val):
         retVal.append(ord(c))
     return retVal
 
+# I2C response status byte (see PicroBoard.h): [0x80 if a new response is ready | 7-bit sequence number]
+I2CSTATUSCOMMAND = 0x01
+I2CSTATUSREADY = 0x80
+I2CSTATUSSEQUENCE = 0x7F
+
+# polls the status byte until the response after the given sequence number is ready, or until timeout
+def waitForResponseI2C(address, sequence, timeout=0.5):
+    start = time()
+    while time() - start < timeout:
+        status = bus.read_byte_data(address, I2CSTATUSCOMMAND)
+        if (status & I2CSTATUSREADY) and (status & I2CSTATUSSEQUENCE) != sequence:
+            return True
+        sleep(0.002)
+    return False
+
 print("what is the I2C address? (0 to 127)")
 addrStr = input(">>>>   ")
 address = int(addrStr)
@@ -27,7 +42,10 @@ while 1:
     byteValue = StringToBytes(charstring) # I2C requires bytes
     # Send the byte packet to the slave. This could be a set command or get command.
     #   For get commands, this will arm the TX register with the returned value, but not return it yet
+    sequence = bus.read_byte_data(address, I2CSTATUSCOMMAND) & I2CSTATUSSEQUENCE
     bus.write_i2c_block_data(address, 0x00, byteValue)
+    # Poll the status byte until the board has published its response
+    waitForResponseI2C(address, sequence)
     # Send a register byte to slave with request flag.
     #   Calls onReceive() with the register byte, but this is useless to our code
     #   Also calls onRequest(), which is what returns the TX data back to the master
@@ -0,0 +1,97 @@
+#!/usr/bin/python3
+
+# reads and writes a PicroBoard transfer block over I2C in chunks of up to 25 bytes (see PicroBoard.h)
+# ex: python3 I2C_Transfer.py -a 3 -b 1
+#   reads block 1 of the PowerSupply example, its four compensator coefficients {num0, num1, den0, den1}
+# ex: python3 I2C_Transfer.py -a 3 -b 1 -w 2,0,8,-8
+#   uploads new compensator coefficients, which the board applies once the last chunk has arrived
+
+import sys, getopt
+from time import sleep
+import smbus2
+
+argv = sys.argv[1:];
+usage = "Usage : I2C_Transfer -a address -b block [-w value,value,...]"
+opts, args = getopt.getopt(argv,"ha:b:w:",["address=","block=","write="])
+
+address = 3
+block = 1
+writeValues = None
+for opt, arg in opts:
+    if opt in ("-a", "--address"):
+         address = int(arg)
+    if opt in ("-b", "--block"):
+         block = int(arg)
+    if opt in ("-w", "--write"):
+         writeValues = [int(v) for v in arg.split(",")]
+    if opt == '-h':
+         print (usage)
+         sys.exit()
+
+BINWRITEFLAG = 0x80
+BINREG_CHUNK = 0x79 # chunk frame: [0x79 | write][block][offset LSB][offset MSB][length][flags][data...][CRC-8]
+BINREG_PROTOCOL = 0x7F
+CHUNKHEADERSIZE = 6
+CHUNKFRAMESIZE = 32 # the whole Wire buffer
+CHUNKDATAMAX = CHUNKFRAMESIZE - CHUNKHEADERSIZE - 1
+CHUNKMORE = 0x01
+CHUNKERROR = 0x80
+
+bus = smbus2.SMBus(1)
+
+def crc8(data):
+    crc = 0
+    for b in data:
+        crc ^= b
+        for n in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+    return crc
+
+# sends a chunk frame and reads the response in one combined transaction (write, repeated start, read)
+def transferChunk(frame):
+    frame.append(crc8(frame))
+    write = smbus2.i2c_msg.write(address, frame)
+    read = smbus2.i2c_msg.read(address, CHUNKFRAMESIZE)
+    bus.i2c_rdwr(write, read)
+    response = list(read)
+    length = CHUNKHEADERSIZE + (0 if frame[0] & BINWRITEFLAG else response[4])
+    if length >= CHUNKFRAMESIZE or response[0] != BINREG_CHUNK or crc8(response[:length]) != response[length]:
+        raise IOError("bad chunk response")
+    if response[5] & CHUNKERROR:
+        raise IOError("board rejected chunk at offset " + str(frame[2] | (frame[3] << 8)))
+    return response[:length]
+
+# reads a whole transfer block, one full chunk per transaction until the board clears CHUNKMORE
+def readBlockI2C(block):
+    data = []
+    while True:
+        offset = len(data)
+        response = transferChunk([BINREG_CHUNK, block, offset & 0xFF, offset >> 8, CHUNKDATAMAX, 0])
+        data += response[CHUNKHEADERSIZE:]
+        if not response[5] & CHUNKMORE:
+            return data
+
+# writes a whole transfer block, setting CHUNKMORE on every chunk but the last
+def writeBlockI2C(block, data):
+    for offset in range(0, len(data), CHUNKDATAMAX):
+        chunk = list(data[offset:offset + CHUNKDATAMAX])
+        flags = CHUNKMORE if offset + len(chunk) < len(data) else 0
+        transferChunk([BINREG_CHUNK | BINWRITEFLAG, block, offset & 0xFF, offset >> 8, len(chunk), flags] + chunk)
+
+# switch the I2C link to the binary protocol, since chunk frames are binary frames
+bus.write_i2c_block_data(address, 0, [ord(c) for c in "WBIN:1"])
+sleep(0.05) # the command may be queued until the next loop() on the board
+
+try:
+    if writeValues is not None:
+        data = []
+        for v in writeValues:
+            data += [v & 0xFF, (v >> 8) & 0xFF] # 16-bit values, LSB first
+        writeBlockI2C(block, data)
+    data = readBlockI2C(block)
+    values = [data[n] | (data[n+1] << 8) for n in range(0, len(data) - 1, 2)]
+    print([v - 65536 if v > 32767 else v for v in values])
+finally:
+    # leave binary mode, so that ASCII tools work again
+    frame = [BINREG_PROTOCOL | BINWRITEFLAG, 0, 0]
+    bus.write_i2c_block_data(address, frame[0], frame[1:] + [crc8(frame)])
@@ -0,0 +1,85 @@
+
+#!/usr/bin/python3
+
+# subscribes to a PicroBoard telemetry stream over UART and prints every frame
+# sudo raspi-config > interfaces > serial, disable serial login but keep serial port enabled
+# ex: python3 UART_Stream.py -b 38400 -d 5 -m 15
+#   streams the first four snapshot values (mask 15 = 0b1111) every 5 control updates (200 Hz at 1 ms)
+
+import sys, getopt
+import serial
+
+serialPort = "/dev/ttyUSB0"
+argv = sys.argv[1:];
+usage = "Usage : UART_Stream [-b baudrate] [-d decimation] [-m mask]"
+opts, args = getopt.getopt(argv,"hb:d:m:",["baud=","decimation=","mask="])
+
+baud = 38400
+decimation = 10
+mask = 0xFFFF
+for opt, arg in opts:
+    if opt in ("-b", "--baud"):
+         baud = int(arg)
+    if opt in ("-d", "--decimation"):
+         decimation = int(arg)
+    if opt in ("-m", "--mask"):
+         mask = int(arg)
+    if opt == '-h':
+         print (usage)
+         sys.exit()
+
+STREAMFRAMEID = 0xFB # stream frame: [0xFB][seq LSB][seq MSB][millis 4 bytes][count][values...][CRC-8]
+
+def crc8(data):
+    crc = 0
+    for b in data:
+        crc ^= b
+        for n in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+    return crc
+
+def toSigned16(lsb, msb):
+    value = lsb | (msb << 8)
+    return value - 65536 if value > 32767 else value
+
+try:
+    ser = serial.Serial (port=serialPort, baudrate = baud,
+        parity=serial.PARITY_NONE,
+        stopbits=serial.STOPBITS_ONE,
+        bytesize=serial.EIGHTBITS,
+        timeout=1)
+except serial.SerialException as ex:
+    print ("Could not open /dev/ttyUSB0. Is it enabled it in the kernel?")
+    sys.exit(-1)
+
+# select the snapshot values, then start the stream
+ser.write(("WSTM:" + str(mask) + "\n").encode('utf_8'))
+ser.readline()
+ser.write(("WSTD:" + str(decimation) + "\n").encode('utf_8'))
+
+buffer = bytearray()
+lastSequence = None
+try:
+    while True:
+        buffer += ser.read(max(1, ser.in_waiting))
+        # resync on the frame ID, then check the length and CRC before accepting a frame
+        while len(buffer) >= 9:
+            if buffer[0] != STREAMFRAMEID:
+                del buffer[0]
+                continue
+            length = 9 + 2*buffer[7]
+            if len(buffer) < length:
+                break
+            if crc8(buffer[0:length - 1]) != buffer[length - 1]:
+                del buffer[0]
+                continue
+            sequence = buffer[1] | (buffer[2] << 8)
+            timestamp = int.from_bytes(buffer[3:7], 'little')
+            values = [toSigned16(buffer[8 + 2*n], buffer[9 + 2*n]) for n in range(buffer[7])]
+            if lastSequence is not None and sequence != (lastSequence + 1) & 0xFFFF:
+                print ("dropped " + str((sequence - lastSequence - 1) & 0xFFFF) + " frames")
+            lastSequence = sequence
+            print (str(timestamp) + " ms, #" + str(sequence) + ": " + str(values))
+            del buffer[0:length]
+except KeyboardInterrupt:
+    ser.write("WSTD:0\n".encode('utf_8')) # stop the stream
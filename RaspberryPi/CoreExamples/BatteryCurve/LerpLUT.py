@@ -227,6 +227,19 @@ def create_interpolation_table(
 
     return table
 
+def print_progmem_table(table, x_col, y_col, x_scale=1, y_scale=1, name="BATTCURVE", x_type="unsigned int"):
+    """
+    Print a lookup table as a PROGMEM LookupPoint array for the PicroBoards LookupTable.h,
+    ready to paste into a sketch. Breakpoints are scaled (e.g. V to mV), rounded and sorted by x.
+    """
+    x = np.rint(table[x_col].to_numpy() * x_scale).astype(int)
+    y = np.rint(table[y_col].to_numpy() * y_scale).astype(int)
+    sort_idx = np.argsort(x)
+    points = ", ".join("{%d, %d}" % (x[i], y[i]) for i in sort_idx)
+    print("const int LUTN = %d;" % len(x))
+    print("const LookupPoint<%s> %s[LUTN] PROGMEM = {\n  %s};" % (x_type, name, points))
+    print("LookupTable<%s> %s(%s, LUTN);" % (x_type, name.lower(), name))
+
 # Example usage:
 if __name__ == "__main__":
     out = create_interpolation_table(
@@ -239,3 +252,5 @@ if __name__ == "__main__":
         plot=True,
     )
     print(out)
+    # battery voltage (mV) to SOC curve, as used by the BatteryPanel example
+    print_progmem_table(out, x_col="VBus @SS", y_col="SOC %")
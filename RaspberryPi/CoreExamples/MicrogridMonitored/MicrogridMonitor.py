@@ -41,6 +41,51 @@ def StringToBytes(val):
         retVal.append(ord(c))
     return retVal
 
+# binary register protocol (see PicroBoard.h): frames are [register][value LSB][value MSB][CRC-8]
+BINWRITEFLAG = 0x80
+BINREG_PROTOCOL = 0x7F
+BINREG_SNAPSHOT = 0x7E # bulk read: [0x7E][count][value 0 LSB][value 0 MSB]...[CRC-8]
+SNAPSHOT_V1 = 0 # AtverterH snapshot value indices (see ATVERTER_SNAPSHOT in AtverterH.cpp)
+SNAPSHOT_V2 = 1
+SNAPSHOT_I1 = 2
+SNAPSHOT_I2 = 3
+
+def crc8(data):
+    crc = 0
+    for b in data:
+        crc ^= b
+        for n in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+    return crc
+
+def toSigned16(lsb, msb):
+    value = lsb | (msb << 8)
+    return value - 65536 if value > 32767 else value
+
+# reads one register in a single combined I2C transaction, no sleep needed between write and read
+def readRegisterI2C(address, register, signed=True):
+    frame = bus.read_i2c_block_data(address, register, 4)
+    if frame[0] != register or crc8(frame[0:3]) != frame[3]:
+        raise IOError("binary register read failed")
+    return toSigned16(frame[1], frame[2]) if signed else frame[1] | (frame[2] << 8)
+
+# reads every snapshot value of a board, all sampled at the same instant, in a single I2C transaction
+def readSnapshotI2C(address):
+    frame = bus.read_i2c_block_data(address, BINREG_SNAPSHOT, 32)
+    count = frame[1]
+    if frame[0] != BINREG_SNAPSHOT or 3 + 2*count > 32 or crc8(frame[0:2 + 2*count]) != frame[2 + 2*count]:
+        raise IOError("binary snapshot read failed")
+    return [toSigned16(frame[2 + 2*n], frame[3 + 2*n]) for n in range(count)]
+
+# asks a board to switch its I2C link to the binary register protocol, returns True if the board supports it
+def enableBinaryI2C(address):
+    try:
+        bus.write_i2c_block_data(address, 0x00, StringToBytes("WBIN:1\n"))
+        sleep(0.05)
+        return readRegisterI2C(address, BINREG_PROTOCOL) == 1
+    except:
+        return False
+
 def parseValueStr(message):
     splitArr = message.split(':')
     if len(splitArr) < 2 or splitArr[0] == "Error":
@@ -69,6 +114,13 @@ commands = [["RV1:\n", "RI1:\n", "RV2:\n", "RI2:\n"], \
             ["RV1:\n", "RI1:\n", "RV2:\n", "RI2:\n"], \
             ["RV1:\n", "RI1:\n", "RV2:\n", "RI2:\n"] \
             ]
+snapshotIndices = [[SNAPSHOT_V1, SNAPSHOT_I1, SNAPSHOT_V2, SNAPSHOT_I2], \
+            [SNAPSHOT_V1, SNAPSHOT_I1, SNAPSHOT_V2, SNAPSHOT_I2], \
+            [SNAPSHOT_V1, SNAPSHOT_I1, SNAPSHOT_V2, SNAPSHOT_I2] \
+            ]
+unsignedIndices = [SNAPSHOT_V1, SNAPSHOT_V2] # voltages can exceed 32767 mV
+# boards running older firmware without the binary protocol fall back to ASCII commands
+isBinary = [enableBinaryI2C(address) for address in addresses]
 
 while True:
     failureCounter = 0
@@ -77,6 +129,16 @@ while True:
     line = now.strftime("%Y,%m,%d,%H,%M,%S")
     for n in range(len(addresses)):
         address = addresses[n]
+        if isBinary[n]:
+            try:
+                snapshot = readSnapshotI2C(address)
+                for index in snapshotIndices[n]:
+                    value = snapshot[index] & 0xFFFF if index in unsignedIndices else snapshot[index]
+                    line = line + ',' + str(value)
+            except:
+                line = line + ',???' * len(snapshotIndices[n])
+                failureCounter = failureCounter + 1
+            continue
         commandSet = commands[n]
         for command in commandSet:
             try:
@@ -114,6 +176,8 @@ while True:
         GPIO.output(pin, False)
         GPIO.output(pin, True)
         GPIO.setup(pin, GPIO.IN)
+        sleep(2)
+        isBinary = [enableBinaryI2C(address) for address in addresses] # boards restart in ASCII mode
         # os.system('echo 26 > /sys/class/gpio/unexport')
         # os.system('sudo avrdude -c linuxgpio26 -p atmega328p -v')
         # sleep(2)
@@ -24,7 +24,7 @@
 
 # for debugging: python3 Picrogrid/RaspberryPi/BasicExamples/Pi_I2C_Shell.py
 
-from time import sleep
+from time import sleep, time
 import sys
 from datetime import datetime
 import csv
@@ -88,11 +88,28 @@ def resetI2CBus():
         GPIO.setup(pin, GPIO.IN)
     sleep(.5)
 
+# I2C response status byte (see PicroBoard.h): [0x80 if a new response is ready | 7-bit sequence number]
+I2CSTATUSCOMMAND = 0x01
+I2CSTATUSREADY = 0x80
+I2CSTATUSSEQUENCE = 0x7F
+
+# polls the status byte until the response after the given sequence number is ready, or until timeout
+#  requires boards running the matching PicroBoards firmware
+def waitForResponseI2C(address, sequence, timeout=0.2):
+    start = time()
+    while time() - start < timeout:
+        status = bus.read_byte_data(address, I2CSTATUSCOMMAND)
+        if (status & I2CSTATUSREADY) and (status & I2CSTATUSSEQUENCE) != sequence:
+            return True
+        sleep(0.002)
+    return False
+
 def sendI2CCommand(address, command):
     try:
         byteValue = StringToBytes(command) # I2C requires bytes
+        sequence = bus.read_byte_data(address, I2CSTATUSCOMMAND) & I2CSTATUSSEQUENCE
         bus.write_i2c_block_data(address, 0x00, byteValue) # Send the byte packet to the slave.
-        sleep(0.2)
+        waitForResponseI2C(address, sequence) # read as soon as the response is published
         data = bus.read_i2c_block_data(address, 0x00, 32) # Send a register byte to slave with request flag.
         outString = ""
         for n in data: